@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+
+
+// Runs work on its own thread, then runs finish on whichever thread polls it. Meant for jobs that build data on the
+// CPU and then have to hand it to OpenGL on the main thread
+class BackgroundTask
+{
+public:
+	BackgroundTask() {}
+
+	~BackgroundTask()
+	{
+		if (mFuture.valid())
+		{
+			mFuture.wait();
+		}
+	}
+
+	// Returns false without doing anything if a task is still running
+	bool start(std::function<void(BackgroundTask&)> work, std::function<void()> finish)
+	{
+		if (isRunning()) return false;
+
+		setProgress(0, "Starting");
+		mFinish = finish;
+
+		// Not the thread pool, the work uses parallelFor itself and the pool might not have any spare workers
+		mFuture = std::async(std::launch::async, [this, work] { work(*this); });
+
+		return true;
+	}
+
+	// Call once a frame, returns true on the frame the work completed and finish was run
+	bool poll()
+	{
+		if (!mFuture.valid() || mFuture.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+
+		mFuture.get(); // Rethrows anything work threw
+
+		std::function<void()> finish = mFinish;
+		mFinish = nullptr;
+		finish();
+
+		return true;
+	}
+
+	bool isRunning() const { return mFuture.valid(); }
+
+	// Called from work, stage has to be a string that outlives the task (a literal)
+	void setProgress(float progress, const char* stage)
+	{
+		mProgress = progress;
+		mStage = stage;
+	}
+
+	float getProgress() const { return mProgress; }
+	const char* getStage() const { return mStage; }
+
+private:
+	std::future<void> mFuture;
+	std::function<void()> mFinish;
+
+	std::atomic<float> mProgress{ 0 };
+	std::atomic<const char*> mStage{ "" };
+};
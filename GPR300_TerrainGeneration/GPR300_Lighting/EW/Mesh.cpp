@@ -1,6 +1,7 @@
 //Author: Eric Winebrenner
 
 #include "Mesh.h"
+#include <utility>
 namespace ew {
 	Mesh::Mesh(MeshData* meshData) {
 
@@ -9,23 +10,113 @@ namespace ew {
 
 	Mesh::~Mesh()
 	{
-		glDeleteVertexArrays(1, &mVAO);
-		glDeleteBuffers(1, &mVBO);
-		glDeleteBuffers(1, &mEBO);
+		release();
 	}
 
 	void Mesh::initialize(MeshData* meshData)
+	{
+		initialize(meshData->vertices.data(), meshData->vertices.size(), meshData->indices.data(), meshData->indices.size());
+	}
+
+	void Mesh::initialize(const Vertex* vertices, size_t numVertices, const unsigned int* indices, size_t numIndices)
+	{
+		//Initializing again replaces the old buffers instead of leaking them
+		release();
+
+		createBuffers(0, numVertices, vertices, numIndices, indices);
+	}
+
+	bool Mesh::map(size_t numVertices, size_t numIndices, Vertex*& vertices, unsigned int*& indices)
+	{
+		release();
+
+		vertices = nullptr;
+		indices = nullptr;
+
+		if (!(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) || numVertices == 0 || numIndices == 0) return false;
+
+		// Immutable storage the CPU only writes, so the driver can put it straight in GPU memory
+		createBuffers(GL_MAP_WRITE_BIT, numVertices, nullptr, numIndices, nullptr);
+
+		vertices = (Vertex*)glMapBufferRange(GL_ARRAY_BUFFER, 0, numVertices * sizeof(Vertex), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		indices = (unsigned int*)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, numIndices * sizeof(unsigned int), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+		mMapped = true;
+
+		if (vertices == nullptr || indices == nullptr)
+		{
+			unmap();
+			release();
+
+			vertices = nullptr;
+			indices = nullptr;
+
+			return false;
+		}
+
+		return true;
+	}
+
+	bool Mesh::unmap()
+	{
+		if (!mMapped) return mVAO != 0;
+
+		glBindVertexArray(mVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+
+		bool verticesKept = glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+		bool indicesKept = glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER) == GL_TRUE;
+
+		mMapped = false;
+
+		if (!verticesKept || !indicesKept)
+		{
+			release();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Mesh::swap(Mesh& other)
+	{
+		std::swap(mVAO, other.mVAO);
+		std::swap(mVBO, other.mVBO);
+		std::swap(mEBO, other.mEBO);
+		std::swap(mNumIndices, other.mNumIndices);
+		std::swap(mNumVertices, other.mNumVertices);
+		std::swap(mMapped, other.mMapped);
+	}
+
+	//Storage flags of 0 makes regular buffers, anything else immutable ones with those flags
+	void Mesh::createBuffers(GLbitfield storageFlags, size_t numVertices, const Vertex* vertices, size_t numIndices, const unsigned int* indices)
 	{
 		glGenVertexArrays(1, &mVAO);
 		glBindVertexArray(mVAO);
 
 		glGenBuffers(1, &mVBO);
 		glBindBuffer(GL_ARRAY_BUFFER, mVBO);
-		glBufferData(GL_ARRAY_BUFFER, meshData->vertices.size() * sizeof(Vertex), &meshData->vertices[0], GL_STATIC_DRAW);
+
+		if (storageFlags != 0)
+		{
+			glBufferStorage(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex), vertices, storageFlags);
+		}
+		else
+		{
+			glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+		}
 
 		glGenBuffers(1, &mEBO);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshData->indices.size() * sizeof(unsigned int), &meshData->indices[0], GL_STATIC_DRAW);
+
+		if (storageFlags != 0)
+		{
+			glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(unsigned int), indices, storageFlags);
+		}
+		else
+		{
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+		}
 
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)(offsetof(Vertex, position)));
 		glEnableVertexAttribArray(0);
@@ -33,14 +124,37 @@ namespace ew {
 		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)(offsetof(Vertex, normal)));
 		glEnableVertexAttribArray(1);
 
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)(offsetof(Vertex, uv)));
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)(offsetof(Vertex, uv)));
 		glEnableVertexAttribArray(2);
 
-		mNumIndices = (GLsizei)meshData->indices.size();
-		mNumVertices = (GLsizei)meshData->vertices.size();
+		mNumIndices = (GLsizei)numIndices;
+		mNumVertices = (GLsizei)numVertices;
 	}
 
 
+	void Mesh::updateVertices(const Vertex* vertices, size_t first, size_t count)
+	{
+		if (mVBO == 0 || count == 0 || first + count > (size_t)mNumVertices) return;
+
+		glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+		glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(Vertex), count * sizeof(Vertex), vertices);
+	}
+
+	void Mesh::release()
+	{
+		if (mVAO == 0) return;
+
+		//Deleting a mapped buffer unmaps it
+		mMapped = false;
+
+		glDeleteVertexArrays(1, &mVAO);
+		glDeleteBuffers(1, &mVBO);
+		glDeleteBuffers(1, &mEBO);
+
+		mVAO = mVBO = mEBO = 0;
+		mNumIndices = mNumVertices = 0;
+	}
+
 	void Mesh::draw()
 	{
  		glBindVertexArray(mVAO);
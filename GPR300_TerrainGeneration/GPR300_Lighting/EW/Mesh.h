@@ -34,10 +34,48 @@ namespace ew {
 
 		void initialize(MeshData* meshData);
 
+		/// <summary>
+		/// Same as initialize(MeshData*) for data that isn't in a MeshData, like a memory mapped file
+		/// </summary>
+		void initialize(const Vertex* vertices, size_t numVertices, const unsigned int* indices, size_t numIndices);
+
+		/// <summary>
+		/// Overwrites count vertices starting at first, the buffer size and indices stay the same
+		/// </summary>
+		void updateVertices(const Vertex* vertices, size_t first, size_t count);
+
+		/// <summary>
+		/// Makes buffers for numVertices and numIndices and maps them, so they can be filled in place (from any thread)
+		/// instead of copied in. Needs GL 4.4 or ARB_buffer_storage. Returns false if they couldn't be mapped
+		/// </summary>
+		bool map(size_t numVertices, size_t numIndices, Vertex*& vertices, unsigned int*& indices);
+
+		/// <summary>
+		/// Call once the mapped buffers are filled, before drawing. False if the driver lost their contents (the mesh is
+		/// released then and has to be filled again)
+		/// </summary>
+		bool unmap();
+
+		void swap(Mesh& other);
+
 		void draw();
+
+		/// <summary>
+		/// For drawing parts of the mesh yourself, like glDrawElementsBaseVertex for chunks that share indices
+		/// </summary>
+		GLuint getVAO() const { return mVAO; }
+		GLsizei getNumIndices() const { return mNumIndices; }
+
+		/// <summary>
+		/// Deletes the OpenGL buffers, initialize can be called again afterwards
+		/// </summary>
+		void release();
 	private:
-		GLuint mVAO, mVBO, mEBO;
-		GLsizei mNumIndices;
-		GLsizei mNumVertices;
+		void createBuffers(GLbitfield storageFlags, size_t numVertices, const Vertex* vertices, size_t numIndices, const unsigned int* indices);
+
+		GLuint mVAO = 0, mVBO = 0, mEBO = 0;
+		GLsizei mNumIndices = 0;
+		GLsizei mNumVertices = 0;
+		bool mMapped = false;
 	};
 }
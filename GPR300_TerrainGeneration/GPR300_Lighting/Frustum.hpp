@@ -0,0 +1,58 @@
+#pragma once
+#include <glm/glm.hpp>
+
+
+// Six planes (xyz = normal pointing inside, w = distance) in whatever space the matrix maps from
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+
+
+// Pass projection * view * model to get the planes in that model's local space
+Frustum extractFrustum(const glm::mat4& matrix)
+{
+	// glm is column major, so row i is matrix[0][i], matrix[1][i], ...
+	glm::vec4 row0 = glm::vec4(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]);
+	glm::vec4 row1 = glm::vec4(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]);
+	glm::vec4 row2 = glm::vec4(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2]);
+	glm::vec4 row3 = glm::vec4(matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0; // Left
+	frustum.planes[1] = row3 - row0; // Right
+	frustum.planes[2] = row3 + row1; // Bottom
+	frustum.planes[3] = row3 - row1; // Top
+	frustum.planes[4] = row3 + row2; // Near
+	frustum.planes[5] = row3 - row2; // Far
+
+	for (int i = 0; i < 6; i++)
+	{
+		frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+	}
+
+	return frustum;
+}
+
+
+// False only when the box is entirely behind one of the planes
+bool isBoxInFrustum(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const glm::vec4& plane = frustum.planes[i];
+
+		// Corner furthest along the plane normal
+		glm::vec3 corner = glm::vec3(
+			plane.x >= 0 ? boxMax.x : boxMin.x,
+			plane.y >= 0 ? boxMax.y : boxMin.y,
+			plane.z >= 0 ? boxMax.z : boxMin.z);
+
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
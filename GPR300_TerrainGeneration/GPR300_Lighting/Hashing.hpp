@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+
+
+// FNV-1a, only has to tell settings apart, not stand up to anyone picking collisions
+class Hasher
+{
+public:
+	void add(const void* data, size_t bytes)
+	{
+		const unsigned char* byte = (const unsigned char*)data;
+
+		for (size_t i = 0; i < bytes; i++)
+		{
+			mHash = (mHash ^ byte[i]) * 1099511628211ull;
+		}
+	}
+
+	template<typename T>
+	void add(T value)
+	{
+		add(&value, sizeof(value));
+	}
+
+	void add(const std::string& value)
+	{
+		add(value.size());
+		add(value.data(), value.size());
+	}
+
+	uint64_t get() const { return mHash; }
+
+private:
+	uint64_t mHash = 14695981039346656037ull;
+};
@@ -0,0 +1,308 @@
+#pragma once
+#include "HeightMapLoader.hpp"
+#include "ThreadPool.hpp"
+#include <glm/glm.hpp>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HEIGHT_MAP_BLUR_SSE
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+const int HEIGHT_MAP_BLUR_BOX_PASSES = 3; // Three box blurs in a row land within a few percent of a gaussian
+
+
+// Box widths that together blur about as much as a gaussian with this sigma, see "Fast almost-gaussian filtering" by Kovesi
+void getGaussianBoxRadii(float sigma, int radii[HEIGHT_MAP_BLUR_BOX_PASSES])
+{
+	const int n = HEIGHT_MAP_BLUR_BOX_PASSES;
+
+	float idealWidth = std::sqrt(12.0f * sigma * sigma / n + 1);
+
+	int lowerWidth = (int)std::floor(idealWidth);
+	if (lowerWidth % 2 == 0) lowerWidth--;
+
+	int upperWidth = lowerWidth + 2;
+
+	// How many of the passes use the smaller width
+	float idealLower = (12 * sigma * sigma - n * lowerWidth * lowerWidth - 4 * n * lowerWidth - 3 * n) / (-4.0f * lowerWidth - 4);
+	int numLower = (int)std::round(idealLower);
+
+	for (int i = 0; i < n; i++)
+	{
+		int width = i < numLower ? lowerWidth : upperWidth;
+		radii[i] = glm::max(0, (width - 1) / 2);
+	}
+}
+
+
+#ifdef HEIGHT_MAP_BLUR_SSE
+
+// Box blur along count entries of lanes vectors each (so entries are lanes * 4 floats apart), edges clamp like CImg's blur
+void boxBlurVectors(const float* src, float* dst, int count, int lanes, int radius)
+{
+	__m128 scale = _mm_set1_ps(1.0f / (2 * radius + 1));
+	size_t stride = (size_t)lanes * 4;
+
+	for (int lane = 0; lane < lanes; lane++)
+	{
+		const float* in = src + lane * 4;
+		float* out = dst + lane * 4;
+
+		__m128 sum = _mm_mul_ps(_mm_loadu_ps(in), _mm_set1_ps((float)(radius + 1)));
+
+		for (int i = 1; i <= radius; i++)
+		{
+			sum = _mm_add_ps(sum, _mm_loadu_ps(&in[glm::min(i, count - 1) * stride]));
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			_mm_storeu_ps(&out[i * stride], _mm_mul_ps(sum, scale));
+
+			__m128 entering = _mm_loadu_ps(&in[glm::min(i + radius + 1, count - 1) * stride]);
+			__m128 leaving = _mm_loadu_ps(&in[glm::max(i - radius, 0) * stride]);
+
+			sum = _mm_add_ps(sum, _mm_sub_ps(entering, leaving));
+		}
+	}
+}
+
+
+// Runs every pass back and forth between a and b, returns whichever one holds the result
+float* boxBlurVectorPasses(float* a, float* b, int count, int lanes, const int radii[HEIGHT_MAP_BLUR_BOX_PASSES])
+{
+	for (int pass = 0; pass < HEIGHT_MAP_BLUR_BOX_PASSES; pass++)
+	{
+		boxBlurVectors(a, b, count, lanes, radii[pass]);
+		std::swap(a, b);
+	}
+
+	return a;
+}
+
+
+// Single channel gaussian (approximated by box blurs) blur with edges clamped. Columns are blurred in strips of 16
+// and rows in bands of 4 that are transposed so both directions blur whole vectors at once. Strips and bands are split
+// across the thread pool, and the only full size buffer is one float plane between the two directions
+void blurHeightMap(Image& heightMap, float sigma, unsigned int maxThreads = 0)
+{
+	if (heightMap.is_empty() || sigma <= 0) return;
+
+	int radii[HEIGHT_MAP_BLUR_BOX_PASSES];
+	getGaussianBoxRadii(sigma, radii);
+
+	int width = heightMap.width();
+	int height = heightMap.height();
+
+	unsigned short* pixels = heightMap.data(); // Only the first channel is blurred, it's the only one getHeight reads
+	std::vector<float> columnBlurred((size_t)width * height);
+
+	// Columns, 16 at a time as 4 vectors
+	const int stripWidth = 16;
+	int numStrips = (width + stripWidth - 1) / stripWidth;
+
+	getThreadPool().parallelFor(numStrips, [&](int startStrip, int endStrip)
+	{
+		std::vector<float> a((size_t)height * stripWidth);
+		std::vector<float> b((size_t)height * stripWidth);
+
+		for (int strip = startStrip; strip < endStrip; strip++)
+		{
+			int x = strip * stripWidth;
+			int stripColumns = glm::min(stripWidth, width - x);
+
+			for (int y = 0; y < height; y++)
+			{
+				const unsigned short* row = &pixels[(size_t)y * width + x];
+				__m128i low, high;
+
+				if (stripColumns == stripWidth)
+				{
+					low = _mm_loadu_si128((const __m128i*)row);
+					high = _mm_loadu_si128((const __m128i*)(row + 8));
+				}
+				else
+				{
+					// Last strip, the missing columns repeat the edge so they can't pull anything in
+					alignas(16) unsigned short padded[stripWidth];
+
+					for (int i = 0; i < stripWidth; i++)
+					{
+						padded[i] = row[glm::min(i, stripColumns - 1)];
+					}
+
+					low = _mm_load_si128((const __m128i*)padded);
+					high = _mm_load_si128((const __m128i*)(padded + 8));
+				}
+
+				__m128i zero = _mm_setzero_si128();
+
+				float* entry = &a[(size_t)y * stripWidth];
+				_mm_storeu_ps(entry + 0, _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)));
+				_mm_storeu_ps(entry + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)));
+				_mm_storeu_ps(entry + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)));
+				_mm_storeu_ps(entry + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)));
+			}
+
+			const float* result = boxBlurVectorPasses(a.data(), b.data(), height, stripWidth / 4, radii);
+
+			for (int y = 0; y < height; y++)
+			{
+				memcpy(&columnBlurred[(size_t)y * width + x], &result[(size_t)y * stripWidth], stripColumns * sizeof(float));
+			}
+		}
+	}, maxThreads);
+
+	// Rows, 4 at a time. Transposing a band turns each column into one vector, so the same blur works along the row
+	int numBands = (height + 3) / 4;
+
+	getThreadPool().parallelFor(numBands, [&](int startBand, int endBand)
+	{
+		std::vector<float> a((size_t)width * 4);
+		std::vector<float> b((size_t)width * 4);
+
+		for (int band = startBand; band < endBand; band++)
+		{
+			int y = band * 4;
+			int bandRows = glm::min(4, height - y);
+
+			// Rows past the bottom repeat the last one, they're just never written back
+			const float* rows[4];
+
+			for (int i = 0; i < 4; i++)
+			{
+				rows[i] = &columnBlurred[(size_t)(y + glm::min(i, bandRows - 1)) * width];
+			}
+
+			int x = 0;
+
+			for (; x + 4 <= width; x += 4)
+			{
+				__m128 row0 = _mm_loadu_ps(&rows[0][x]);
+				__m128 row1 = _mm_loadu_ps(&rows[1][x]);
+				__m128 row2 = _mm_loadu_ps(&rows[2][x]);
+				__m128 row3 = _mm_loadu_ps(&rows[3][x]);
+
+				_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+
+				_mm_storeu_ps(&a[(size_t)x * 4 + 0], row0);
+				_mm_storeu_ps(&a[(size_t)x * 4 + 4], row1);
+				_mm_storeu_ps(&a[(size_t)x * 4 + 8], row2);
+				_mm_storeu_ps(&a[(size_t)x * 4 + 12], row3);
+			}
+
+			for (; x < width; x++)
+			{
+				_mm_storeu_ps(&a[(size_t)x * 4], _mm_setr_ps(rows[0][x], rows[1][x], rows[2][x], rows[3][x]));
+			}
+
+			const float* result = boxBlurVectorPasses(a.data(), b.data(), width, 1, radii);
+
+			// Transpose back 4 columns at a time and round to 16 bits, the last block might be narrower
+			alignas(16) float values[4][4];
+
+			for (x = 0; x < width; x += 4)
+			{
+				int blockColumns = glm::min(4, width - x);
+
+				const float* columns = &result[(size_t)x * 4];
+
+				__m128 column0 = _mm_loadu_ps(columns);
+				__m128 column1 = blockColumns > 1 ? _mm_loadu_ps(columns + 4) : column0;
+				__m128 column2 = blockColumns > 2 ? _mm_loadu_ps(columns + 8) : column0;
+				__m128 column3 = blockColumns > 3 ? _mm_loadu_ps(columns + 12) : column0;
+
+				_MM_TRANSPOSE4_PS(column0, column1, column2, column3);
+
+				if (blockColumns == 4)
+				{
+					__m128 rowValues[4] = { column0, column1, column2, column3 };
+
+					// SSE2 can only pack to signed 16 bits, so shift down by 32768 before packing and flip the sign bit back after
+					__m128i bias = _mm_set1_epi32(32768);
+					__m128i signBit = _mm_set1_epi16((short)0x8000);
+
+					for (int i = 0; i < bandRows; i++)
+					{
+						__m128 rounded = _mm_min_ps(_mm_max_ps(_mm_add_ps(rowValues[i], _mm_set1_ps(.5f)), _mm_setzero_ps()), _mm_set1_ps((float)HEIGHT_MAP_MAX_VALUE));
+						__m128i words = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(_mm_cvttps_epi32(rounded), bias), _mm_setzero_si128()), signBit);
+
+						_mm_storel_epi64((__m128i*)&pixels[(size_t)(y + i) * width + x], words);
+					}
+
+					continue;
+				}
+
+				_mm_store_ps(values[0], column0);
+				_mm_store_ps(values[1], column1);
+				_mm_store_ps(values[2], column2);
+				_mm_store_ps(values[3], column3);
+
+				for (int i = 0; i < bandRows; i++)
+				{
+					unsigned short* row = &pixels[(size_t)(y + i) * width + x];
+
+					for (int j = 0; j < blockColumns; j++)
+					{
+						row[j] = (unsigned short)glm::clamp(values[i][j] + .5f, 0.0f, (float)HEIGHT_MAP_MAX_VALUE);
+					}
+				}
+			}
+		}
+	}, maxThreads);
+}
+
+#else
+
+// No SSE2 on this target, fall back to CImg's blur of the first channel
+void blurHeightMap(Image& heightMap, float sigma, unsigned int maxThreads = 0)
+{
+	heightMap.blur(sigma);
+}
+
+#endif
+
+
+// Times blurHeightMap against CImg's blur at 1K, 4K and 8K, and how far apart their results are
+void benchmarkHeightMapBlur(float sigma)
+{
+	std::cout << "Heightmap blur, sigma " << sigma << ", " << getThreadPool().getNumThreads() << " threads" << std::endl;
+
+	int sizes[] = { 1024, 4096, 8192 };
+
+	for (int size : sizes)
+	{
+		Image source(size, size, 1, 1);
+		source.rand(0, HEIGHT_MAP_MAX_VALUE); // Noise is the worst case for any difference between the two
+
+		Image cimgBlurred = source;
+		Image ours = source;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		cimgBlurred.blur(sigma);
+		auto middle = std::chrono::high_resolution_clock::now();
+		blurHeightMap(ours, sigma);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double cimgTime = std::chrono::duration<double, std::milli>(middle - start).count();
+		double ourTime = std::chrono::duration<double, std::milli>(end - middle).count();
+
+		int maxDifference = 0;
+		double differenceSum = 0;
+
+		for (size_t i = 0; i < ours.size(); i++)
+		{
+			int difference = std::abs((int)ours[i] - (int)cimgBlurred[i]);
+			maxDifference = glm::max(maxDifference, difference);
+			differenceSum += difference;
+		}
+
+		std::cout << size << "x" << size << ": CImg " << cimgTime << "ms, blurHeightMap " << ourTime << "ms, " << cimgTime / ourTime << "x, " <<
+			"difference avg " << differenceSum / ours.size() << " max " << maxDifference << std::endl;
+	}
+}
@@ -0,0 +1,212 @@
+#pragma once
+#include "HeightMapLoader.hpp"
+#include "HeightMapBlur.hpp"
+#include "HeightMapErosion.hpp"
+#include <sys/stat.h>
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+const size_t DEFAULT_HEIGHT_MAP_CACHE_BYTES = 256 * 1024 * 1024;
+
+
+// Keeps decoded heightmaps and their blurred and eroded versions in memory, so regenerating with the same path, blur
+// and erosion skips reading the file, blurring and eroding. Entries are keyed by the file's modification time too, so editing the
+// image on disk still gets picked up. Least recently used entries go first once the byte limit is passed
+class HeightMapCache
+{
+public:
+	HeightMapCache(size_t maxBytes = DEFAULT_HEIGHT_MAP_CACHE_BYTES) : mMaxBytes(maxBytes) {}
+
+	// Safe to call from any thread. Erosion runs on the blurred heightmap, onStep gets its progress (see erodeHeightMap)
+	std::shared_ptr<const Image> get(const HeightMapSource& heightMapSource, float blur, const ErosionInfo& erosionInfo = ErosionInfo(),
+		const std::function<void(const HeightMapErosion&)>& onStep = nullptr)
+	{
+		long long modifiedTime = getModifiedTime(heightMapSource.path);
+
+		// Reading the same file as a different format or size is a different heightmap
+		Key sourceKey(heightMapSource.path, modifiedTime, getHeightMapFormat(heightMapSource), heightMapSource.rawWidth, heightMapSource.rawHeight, SOURCE_BLUR, 0);
+		Key key = sourceKey;
+
+		uint64_t erosionKey = erosionInfo.getKey();
+
+		if (erosionKey != 0)
+		{
+			if (blur > 0) std::get<5>(key) = blur;
+			std::get<6>(key) = erosionKey;
+
+			std::shared_ptr<const Image> image = find(key);
+
+			if (image)
+			{
+				mHits++;
+				return image;
+			}
+
+			mMisses++;
+
+			// Blurred heightmap is cached on its own (and counts its own hit or miss), so changing the erosion only erodes again
+			std::shared_ptr<const Image> blurred = get(heightMapSource, blur);
+
+			if (blurred->is_empty()) return blurred;
+
+			std::shared_ptr<Image> eroded = std::make_shared<Image>(*blurred);
+			erodeHeightMap(*eroded, erosionInfo, EROSION_PREVIEW_INTERVAL, onStep);
+
+			insert(key, eroded);
+			return eroded;
+		}
+
+		// A blur of 0 does nothing, so that's just the source
+		if (blur > 0) std::get<5>(key) = blur;
+
+		std::shared_ptr<const Image> image = find(key);
+
+		if (image)
+		{
+			mHits++;
+			return image;
+		}
+
+		mMisses++;
+
+		// Unblurred source is cached on its own so changing the blur only has to blur again
+		std::shared_ptr<const Image> source = blur > 0 ? find(sourceKey) : nullptr;
+
+		// Decoding and blurring happen outside the lock, two threads asking for the same image at once just both do the work
+		if (!source)
+		{
+			source = std::make_shared<const Image>(loadHeightMap(heightMapSource));
+
+			if (source->is_empty()) return source; // Failed to load, try again next time
+
+			insert(sourceKey, source);
+		}
+
+		if (blur <= 0) return source;
+
+		std::shared_ptr<Image> blurred = std::make_shared<Image>(*source);
+		blurHeightMap(*blurred, blur);
+
+		insert(key, blurred);
+		return blurred;
+	}
+
+	void setMaxBytes(size_t maxBytes)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		mMaxBytes = maxBytes;
+		evict();
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		mEntries.clear();
+		mLookup.clear();
+		mBytes = 0;
+		mNumEntries = 0;
+	}
+
+	size_t getMaxBytes() const { return mMaxBytes; }
+	size_t getBytes() const { return mBytes; }
+	size_t getNumEntries() const { return mNumEntries; }
+	int getHits() const { return mHits; }
+	int getMisses() const { return mMisses; }
+
+private:
+	typedef std::tuple<std::string, long long, int, int, int, float, uint64_t> Key; // Path, modification time, format, raw width and height, blur, erosion key
+
+	const float SOURCE_BLUR = -1;
+
+	struct Entry
+	{
+		Key key;
+		std::shared_ptr<const Image> image;
+		size_t bytes;
+	};
+
+	static long long getModifiedTime(const std::string& path)
+	{
+		struct stat info;
+
+		if (stat(path.c_str(), &info) != 0) return 0; // Loading will report the missing file
+
+		return (long long)info.st_mtime;
+	}
+
+	std::shared_ptr<const Image> find(const Key& key)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		auto found = mLookup.find(key);
+
+		if (found == mLookup.end()) return nullptr;
+
+		// Most recently used stays at the front
+		mEntries.splice(mEntries.begin(), mEntries, found->second);
+
+		return found->second->image;
+	}
+
+	void insert(const Key& key, const std::shared_ptr<const Image>& image)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		if (mLookup.count(key) > 0) return;
+
+		Entry entry;
+		entry.key = key;
+		entry.image = image;
+		entry.bytes = image->size() * sizeof(Image::value_type);
+
+		mEntries.push_front(entry);
+		mLookup[key] = mEntries.begin();
+		mBytes += entry.bytes;
+		mNumEntries = mEntries.size();
+
+		evict();
+	}
+
+	// Expects mMutex to be held. Images still in use elsewhere stay alive through their shared_ptr
+	void evict()
+	{
+		while (mBytes > mMaxBytes && !mEntries.empty())
+		{
+			const Entry& oldest = mEntries.back();
+
+			mBytes -= oldest.bytes;
+			mLookup.erase(oldest.key);
+			mEntries.pop_back();
+		}
+
+		mNumEntries = mEntries.size();
+	}
+
+	std::mutex mMutex;
+
+	std::list<Entry> mEntries;
+	std::map<Key, std::list<Entry>::iterator> mLookup;
+
+	// Atomic so the UI can show them while a background build is using the cache
+	std::atomic<size_t> mMaxBytes;
+	std::atomic<size_t> mBytes{ 0 };
+	std::atomic<size_t> mNumEntries{ 0 };
+
+	std::atomic<int> mHits{ 0 };
+	std::atomic<int> mMisses{ 0 };
+};
+
+
+// Cache shared by everything that reads heightmaps
+HeightMapCache& getHeightMapCache()
+{
+	static HeightMapCache heightMapCache;
+	return heightMapCache;
+}
@@ -0,0 +1,489 @@
+#pragma once
+#include "HeightMapLoader.hpp"
+#include "Hashing.hpp"
+#include "ThreadPool.hpp"
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+
+struct ErosionInfo
+{
+	bool enabled;
+	int iterations;
+
+	float relief; // How tall the heightmap's full range is compared to its width, slopes and so everything else follow from it
+
+	// Hydraulic, the virtual pipe model from "Fast Hydraulic Erosion Simulation and Visualization on GPU" (Mei et al.)
+	float rain; // Water depth added everywhere each iteration, in pixels
+	float sedimentCapacity; // How much sediment fast water on a steep slope can carry
+	float dissolving; // How quickly water picks up sediment it has room for
+	float deposition; // How quickly water drops sediment it has too much of
+	float evaporation; // Fraction of the water gone each iteration
+
+	// Thermal, material slides down anything steeper than the talus angle
+	float talusAngle; // Degrees
+	float thermalRate; // Fraction of the excess moved each iteration, 0.5 or less keeps it stable
+
+	ErosionInfo(bool _enabled = false, int _iterations = 100) :
+		enabled(_enabled), iterations(_iterations), relief(.15f), rain(.01f), sedimentCapacity(1), dissolving(.1f), deposition(.02f),
+		evaporation(.05f), talusAngle(35), thermalRate(.25f) {}
+
+	// Same for the same results, so the heightmap cache can tell eroded heightmaps apart. 0 when erosion is off
+	uint64_t getKey() const
+	{
+		if (!enabled || iterations <= 0) return 0;
+
+		Hasher hasher;
+
+		hasher.add(iterations);
+		hasher.add(relief);
+		hasher.add(rain);
+		hasher.add(sedimentCapacity);
+		hasher.add(dissolving);
+		hasher.add(deposition);
+		hasher.add(evaporation);
+		hasher.add(talusAngle);
+		hasher.add(thermalRate);
+
+		return hasher.get();
+	}
+};
+
+
+// Grid erosion on a heightmap, one float per pixel for each quantity. Every pass only writes its own pixels and reads
+// the last pass's results around them, so the rows of each pass are split across the thread pool and every thread
+// sweeps its band of rows front to back. Neighbor reads only ever reach one row up or down, which is still in cache.
+// The grids have a one pixel border around the map so every pixel has all 8 neighbors and the inner loops have no
+// edge checks (and vectorize). The border's ground copies the edge of the map and it never holds water or sediment,
+// so water and material that flow over the edge are gone. Sediment still in the water at the end gets dropped where it is
+class HeightMapErosion
+{
+public:
+	HeightMapErosion(const Image& heightMap, const ErosionInfo& erosionInfo) :
+		mInfo(erosionInfo), mWidth(heightMap.width()), mHeight(heightMap.height()), mStride(heightMap.width() + 2)
+	{
+		size_t size = (size_t)mStride * (mHeight + 2);
+
+		mTerrain.assign(size, 0.0f);
+		mNextTerrain.assign(size, 0.0f);
+		mWater.assign(size, 0.0f);
+		mSediment.assign(size, 0.0f);
+		mNextSediment.assign(size, 0.0f);
+
+		for (int i = 0; i < 4; i++)
+		{
+			mFlux[i].assign(size, 0.0f);
+		}
+
+		mVelocityX.assign(size, 0.0f);
+		mVelocityY.assign(size, 0.0f);
+		mThermalScale.assign(size, 0.0f);
+
+		mHeightScale = erosionInfo.relief * mWidth / HEIGHT_MAP_MAX_VALUE;
+
+		const unsigned short* pixels = heightMap.data();
+
+		getThreadPool().parallelFor(mHeight, [&](int startRow, int endRow)
+		{
+			for (int y = startRow; y < endRow; y++)
+			{
+				for (int x = 0; x < mWidth; x++)
+				{
+					size_t i = getIndex(x, y);
+
+					mTerrain[i] = pixels[(size_t)y * mWidth + x] * mHeightScale;
+					mWater[i] = erosionInfo.rain;
+				}
+			}
+		});
+
+		updateBorder(mTerrain);
+	}
+
+	void step(int iterations)
+	{
+		for (int i = 0; i < iterations; i++)
+		{
+			updateFlux();
+			updateWater();
+			transportSediment();
+			slump();
+
+			mIteration++;
+		}
+	}
+
+	// Terrain with the sediment still in the water settled onto it, back in heightmap values
+	void writeHeightMap(Image& heightMap) const
+	{
+		heightMap.assign(mWidth, mHeight, 1, 1);
+		unsigned short* pixels = heightMap.data();
+
+		float scale = 1.0f / mHeightScale;
+
+		getThreadPool().parallelFor(mHeight, [&](int startRow, int endRow)
+		{
+			for (int y = startRow; y < endRow; y++)
+			{
+				for (int x = 0; x < mWidth; x++)
+				{
+					size_t i = getIndex(x, y);
+					float value = (mTerrain[i] + mSediment[i]) * scale;
+
+					pixels[(size_t)y * mWidth + x] = (unsigned short)glm::clamp(value + .5f, 0.0f, (float)HEIGHT_MAP_MAX_VALUE);
+				}
+			}
+		});
+	}
+
+	// Shaded relief lit from the top left, scaled down to fit in maxSize on its longest side. Ground only, sediment in the
+	// water doesn't show until it settles
+	void writePreview(std::vector<unsigned char>& pixels, int& width, int& height, int maxSize) const
+	{
+		int step = glm::max((glm::max(mWidth, mHeight) + maxSize - 1) / maxSize, 1);
+
+		width = (mWidth + step - 1) / step;
+		height = (mHeight + step - 1) / step;
+		pixels.resize((size_t)width * height);
+
+		glm::vec3 light = glm::normalize(glm::vec3(-1, 1.5f, -1));
+
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				// Border copies the edge, so the slope at the edge comes out as half the inside one rather than garbage
+				size_t i = getIndex(x * step, y * step);
+
+				float slopeX = (mTerrain[i + 1] - mTerrain[i - 1]) * .5f;
+				float slopeY = (mTerrain[i + mStride] - mTerrain[i - mStride]) * .5f;
+
+				float brightness = glm::dot(glm::normalize(glm::vec3(-slopeX, 1, -slopeY)), light);
+
+				pixels[(size_t)y * width + x] = (unsigned char)glm::clamp(brightness * 255, 0.0f, 255.0f);
+			}
+		}
+	}
+
+	int getIteration() const { return mIteration; }
+	int getWidth() const { return mWidth; }
+	int getHeight() const { return mHeight; }
+
+private:
+	enum Direction { LEFT, RIGHT, UP, DOWN }; // Up is towards row 0
+
+	size_t getIndex(int x, int y) const
+	{
+		return (size_t)(y + 1) * mStride + (x + 1);
+	}
+
+	// Copies the map's edge pixels out into the border around it
+	void updateBorder(std::vector<float>& grid)
+	{
+		float* data = grid.data();
+
+		for (int y = 0; y < mHeight; y++)
+		{
+			data[getIndex(-1, y)] = data[getIndex(0, y)];
+			data[getIndex(mWidth, y)] = data[getIndex(mWidth - 1, y)];
+		}
+
+		std::copy(&data[mStride], &data[2 * mStride], &data[0]);
+		std::copy(&data[(size_t)mHeight * mStride], &data[(size_t)(mHeight + 1) * mStride], &data[(size_t)(mHeight + 1) * mStride]);
+	}
+
+	// Water outflow towards each neighbor speeds up with the difference in water surface, then gets scaled down if it
+	// would take more water than the pixel has
+	void updateFlux()
+	{
+		const float* terrain = mTerrain.data();
+		const float* water = mWater.data();
+
+		float* left = mFlux[LEFT].data();
+		float* right = mFlux[RIGHT].data();
+		float* up = mFlux[UP].data();
+		float* down = mFlux[DOWN].data();
+
+		int width = mWidth;
+		size_t stride = mStride;
+
+		getThreadPool().parallelFor(mHeight, [&](int startRow, int endRow)
+		{
+			for (int y = startRow; y < endRow; y++)
+			{
+				size_t rowStart = getIndex(0, y);
+
+				for (size_t i = rowStart; i < rowStart + width; i++)
+				{
+					float surface = terrain[i] + water[i];
+
+					float toLeft = glm::max(0.0f, left[i] + PIPE_ACCELERATION * (surface - terrain[i - 1] - water[i - 1]));
+					float toRight = glm::max(0.0f, right[i] + PIPE_ACCELERATION * (surface - terrain[i + 1] - water[i + 1]));
+					float toUp = glm::max(0.0f, up[i] + PIPE_ACCELERATION * (surface - terrain[i - stride] - water[i - stride]));
+					float toDown = glm::max(0.0f, down[i] + PIPE_ACCELERATION * (surface - terrain[i + stride] - water[i + stride]));
+
+					float outflow = toLeft + toRight + toUp + toDown;
+					float scale = outflow > water[i] ? water[i] / outflow : 1.0f;
+
+					left[i] = toLeft * scale;
+					right[i] = toRight * scale;
+					up[i] = toUp * scale;
+					down[i] = toDown * scale;
+				}
+			}
+		});
+	}
+
+	// Moves the water the flux says, works out how fast it's going, and trades sediment with the ground depending on
+	// whether the water can carry more or less than it has. Ground goes to the other buffer since neighbors read its slope
+	void updateWater()
+	{
+		const float* terrain = mTerrain.data();
+		float* nextTerrain = mNextTerrain.data();
+		float* water = mWater.data();
+		float* sediment = mSediment.data();
+		float* velocityX = mVelocityX.data();
+		float* velocityY = mVelocityY.data();
+
+		const float* left = mFlux[LEFT].data();
+		const float* right = mFlux[RIGHT].data();
+		const float* up = mFlux[UP].data();
+		const float* down = mFlux[DOWN].data();
+
+		int width = mWidth;
+		size_t stride = mStride;
+
+		float sedimentCapacity = mInfo.sedimentCapacity;
+		float dissolving = mInfo.dissolving;
+		float deposition = mInfo.deposition;
+
+		getThreadPool().parallelFor(mHeight, [&](int startRow, int endRow)
+		{
+			for (int y = startRow; y < endRow; y++)
+			{
+				size_t rowStart = getIndex(0, y);
+
+				for (size_t i = rowStart; i < rowStart + width; i++)
+				{
+					// The border's flux is always 0, so nothing flows back in over the edge
+					float fromLeft = right[i - 1];
+					float fromRight = left[i + 1];
+					float fromUp = down[i - stride];
+					float fromDown = up[i + stride];
+
+					float depth = water[i];
+					float newDepth = glm::max(0.0f, depth + fromLeft + fromRight + fromUp + fromDown - left[i] - right[i] - up[i] - down[i]);
+					float averageDepth = glm::max((depth + newDepth) * .5f, MIN_DEPTH);
+
+					// Water passing through in each direction, over the depth it passes through
+					float vx = (fromLeft - left[i] + right[i] - fromRight) * .5f / averageDepth;
+					float vy = (fromUp - up[i] + down[i] - fromDown) * .5f / averageDepth;
+
+					// Sine of the ground's slope, with a floor so flat ground still erodes a little under moving water
+					float slopeX = (terrain[i + 1] - terrain[i - 1]) * .5f;
+					float slopeY = (terrain[i + stride] - terrain[i - stride]) * .5f;
+					float slopeSquared = slopeX * slopeX + slopeY * slopeY;
+					float sine = glm::max(std::sqrt(slopeSquared / (1 + slopeSquared)), MIN_SINE);
+
+					// Shallow water can't carry as much, so puddles don't dig holes
+					float depthLimit = glm::min(newDepth * (1 / MAX_EROSION_DEPTH), 1.0f);
+					float capacity = sedimentCapacity * sine * std::sqrt(vx * vx + vy * vy) * depthLimit;
+
+					// Picks up a share of what it has room for, or drops a share of what it can't carry
+					float carried = sediment[i];
+					float exchange = capacity > carried ? dissolving * (capacity - carried) : deposition * (capacity - carried);
+
+					nextTerrain[i] = terrain[i] - exchange;
+					sediment[i] = carried + exchange;
+					water[i] = newDepth;
+					velocityX[i] = vx;
+					velocityY[i] = vy;
+				}
+			}
+		});
+
+		mTerrain.swap(mNextTerrain);
+		updateBorder(mTerrain);
+	}
+
+	// Sediment moves with the water, each pixel takes what was upstream of it (semi-Lagrangian, bilinear). Then the
+	// water evaporates a bit and it rains again for the next iteration
+	void transportSediment()
+	{
+		const float* sediment = mSediment.data();
+		float* nextSediment = mNextSediment.data();
+		float* water = mWater.data();
+		const float* velocityX = mVelocityX.data();
+		const float* velocityY = mVelocityY.data();
+
+		float keep = 1 - mInfo.evaporation;
+		float rain = mInfo.rain;
+
+		// Sampling stays on the map, the corner the bilinear lookup starts from one short of its far edge
+		float maxX = (float)(mWidth - 1);
+		float maxY = (float)(mHeight - 1);
+		int lastX = glm::max(mWidth - 2, 0);
+		int lastY = glm::max(mHeight - 2, 0);
+
+		getThreadPool().parallelFor(mHeight, [&](int startRow, int endRow)
+		{
+			for (int y = startRow; y < endRow; y++)
+			{
+				for (int x = 0; x < mWidth; x++)
+				{
+					size_t i = getIndex(x, y);
+
+					float sourceX = glm::clamp(x - velocityX[i], 0.0f, maxX);
+					float sourceY = glm::clamp(y - velocityY[i], 0.0f, maxY);
+
+					int x0 = glm::min((int)sourceX, lastX);
+					int y0 = glm::min((int)sourceY, lastY);
+
+					float fx = sourceX - x0;
+					float fy = sourceY - y0;
+
+					// Past the edge on a map 1 pixel wide, but the border is 0 and fx / fy are too there
+					const float* corner = &sediment[getIndex(x0, y0)];
+
+					float top = corner[0] + (corner[1] - corner[0]) * fx;
+					float bottom = corner[mStride] + (corner[mStride + 1] - corner[mStride]) * fx;
+
+					nextSediment[i] = top + (bottom - top) * fy;
+					water[i] = water[i] * keep + rain;
+				}
+			}
+		});
+
+		mSediment.swap(mNextSediment);
+	}
+
+	// Thermal erosion in two passes so no pixel writes another's ground. First every pixel works out how much of
+	// itself slides off, as a scale on how far each lower neighbor is past the talus height. Then every pixel loses
+	// its own and gathers what its higher neighbors send it. The border never sends anything (its scale stays 0)
+	void slump()
+	{
+		if (mInfo.thermalRate <= 0) return;
+
+		const float* terrain = mTerrain.data();
+		float* nextTerrain = mNextTerrain.data();
+		float* thermalScale = mThermalScale.data();
+
+		int width = mWidth;
+		size_t stride = mStride;
+
+		float rate = mInfo.thermalRate * .5f; // Half the largest excess would level the steepest pair
+		float talus = std::tan(glm::radians(mInfo.talusAngle));
+		float diagonalTalus = talus * 1.41421356f;
+
+		getThreadPool().parallelFor(mHeight, [&](int startRow, int endRow)
+		{
+			for (int y = startRow; y < endRow; y++)
+			{
+				size_t rowStart = getIndex(0, y);
+
+				for (size_t i = rowStart; i < rowStart + width; i++)
+				{
+					float ground = terrain[i];
+
+					float e0 = glm::max(0.0f, ground - terrain[i - stride - 1] - diagonalTalus);
+					float e1 = glm::max(0.0f, ground - terrain[i - stride] - talus);
+					float e2 = glm::max(0.0f, ground - terrain[i - stride + 1] - diagonalTalus);
+					float e3 = glm::max(0.0f, ground - terrain[i - 1] - talus);
+					float e4 = glm::max(0.0f, ground - terrain[i + 1] - talus);
+					float e5 = glm::max(0.0f, ground - terrain[i + stride - 1] - diagonalTalus);
+					float e6 = glm::max(0.0f, ground - terrain[i + stride] - talus);
+					float e7 = glm::max(0.0f, ground - terrain[i + stride + 1] - diagonalTalus);
+
+					float total = e0 + e1 + e2 + e3 + e4 + e5 + e6 + e7;
+					float largest = glm::max(glm::max(glm::max(e0, e1), glm::max(e2, e3)), glm::max(glm::max(e4, e5), glm::max(e6, e7)));
+
+					thermalScale[i] = total > 0 ? rate * largest / total : 0;
+				}
+			}
+		});
+
+		getThreadPool().parallelFor(mHeight, [&](int startRow, int endRow)
+		{
+			for (int y = startRow; y < endRow; y++)
+			{
+				size_t rowStart = getIndex(0, y);
+
+				for (size_t i = rowStart; i < rowStart + width; i++)
+				{
+					float ground = terrain[i];
+					float scale = thermalScale[i];
+
+					// Loses its share towards every lower neighbor, gains each higher neighbor's share towards it
+					auto exchange = [&](size_t neighbor, float talusHeight)
+					{
+						float difference = ground - terrain[neighbor];
+
+						return glm::max(0.0f, -difference - talusHeight) * thermalScale[neighbor] - glm::max(0.0f, difference - talusHeight) * scale;
+					};
+
+					float change = exchange(i - stride - 1, diagonalTalus) + exchange(i - stride, talus) + exchange(i - stride + 1, diagonalTalus) +
+						exchange(i - 1, talus) + exchange(i + 1, talus) +
+						exchange(i + stride - 1, diagonalTalus) + exchange(i + stride, talus) + exchange(i + stride + 1, diagonalTalus);
+
+					nextTerrain[i] = ground + change;
+				}
+			}
+		});
+
+		mTerrain.swap(mNextTerrain);
+		updateBorder(mTerrain);
+	}
+
+	// Gravity times pipe cross section over pipe length times the time step, in one. Larger is faster but less stable
+	const float PIPE_ACCELERATION = .2f;
+	const float MIN_DEPTH = 1e-4f;
+	const float MIN_SINE = .05f;
+	const float MAX_EROSION_DEPTH = .05f;
+
+	ErosionInfo mInfo;
+	int mWidth;
+	int mHeight;
+	int mStride; // Floats from one row to the next, the width plus the border on both sides
+	int mIteration = 0;
+
+	float mHeightScale; // Heightmap value to height in pixels
+
+	std::vector<float> mTerrain;
+	std::vector<float> mNextTerrain;
+	std::vector<float> mWater;
+	std::vector<float> mSediment;
+	std::vector<float> mNextSediment;
+	std::vector<float> mFlux[4];
+	std::vector<float> mVelocityX;
+	std::vector<float> mVelocityY;
+	std::vector<float> mThermalScale;
+};
+
+
+// How many erosion iterations run between onStep calls, often enough for a smooth preview without slowing it down
+const int EROSION_PREVIEW_INTERVAL = 10;
+
+
+// Erodes the heightmap in place. onStep (if set) is called every stepInterval iterations and after the last one,
+// with the simulation as it is then, for progress and previews
+void erodeHeightMap(Image& heightMap, const ErosionInfo& erosionInfo, int stepInterval = EROSION_PREVIEW_INTERVAL,
+	const std::function<void(const HeightMapErosion&)>& onStep = nullptr)
+{
+	if (heightMap.is_empty() || !erosionInfo.enabled || erosionInfo.iterations <= 0) return;
+
+	HeightMapErosion erosion(heightMap, erosionInfo);
+
+	stepInterval = glm::max(stepInterval, 1);
+
+	while (erosion.getIteration() < erosionInfo.iterations)
+	{
+		erosion.step(glm::min(stepInterval, erosionInfo.iterations - erosion.getIteration()));
+
+		if (onStep) onStep(erosion);
+	}
+
+	erosion.writeHeightMap(heightMap);
+}
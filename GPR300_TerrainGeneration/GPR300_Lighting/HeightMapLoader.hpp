@@ -0,0 +1,355 @@
+#pragma once
+#include "CImg-v.3.2.3/CImg.h"
+#include "stb_image.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+// Heightmaps are kept at 16 bits whatever they were stored as, so 8-bit images don't terrace any worse than before
+// and 16-bit / float DEMs keep 65536 levels instead of 256
+typedef cimg_library::CImg<unsigned short> Image;
+
+const int HEIGHT_MAP_LEVELS = 65536;
+const int HEIGHT_MAP_MAX_VALUE = HEIGHT_MAP_LEVELS - 1;
+
+const size_t HEIGHT_MAP_STREAM_SAMPLES = 64 * 1024; // Raw files are read this many samples at a time
+
+
+enum HeightMapFormat
+{
+	HEIGHT_MAP_AUTO, // Picked from the file extension
+	HEIGHT_MAP_IMAGE, // Anything stb_image reads, 16-bit PNGs keep all 16 bits
+	HEIGHT_MAP_RAW_UINT16, // Headerless little-endian uint16
+	HEIGHT_MAP_RAW_FLOAT32, // Headerless little-endian float32, normalized from its own min / max
+};
+
+
+// Where a heightmap comes from. Raw files have no header, so their size has to be given, or left at 0 for a square
+// one worked out from the file size
+struct HeightMapSource
+{
+	std::string path;
+	HeightMapFormat format;
+
+	int rawWidth;
+	int rawHeight;
+
+	HeightMapSource(std::string _path = "", HeightMapFormat _format = HEIGHT_MAP_AUTO, int _rawWidth = 0, int _rawHeight = 0) :
+		path(_path), format(_format), rawWidth(_rawWidth), rawHeight(_rawHeight) {}
+};
+
+
+HeightMapFormat getHeightMapFormat(const HeightMapSource& source)
+{
+	if (source.format != HEIGHT_MAP_AUTO) return source.format;
+
+	size_t dot = source.path.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : source.path.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	if (extension == "r16" || extension == "raw") return HEIGHT_MAP_RAW_UINT16;
+	if (extension == "r32" || extension == "f32") return HEIGHT_MAP_RAW_FLOAT32;
+
+	return HEIGHT_MAP_IMAGE;
+}
+
+
+bool isLittleEndian()
+{
+	uint16_t one = 1;
+	return *(unsigned char*)&one == 1;
+}
+
+
+// Decodes with stb_image in this process instead of CImg, which hands PNGs to an external converter unless it was
+// built with libpng. Only the first component (red, or grey) is kept since getHeight never reads the others.
+// 8-bit values are scaled by 257 so value / 65535 is exactly the old value / 255
+Image loadHeightMapImage(const std::string& path)
+{
+	int width, height, numComponents;
+
+	if (stbi_is_16_bit(path.c_str()))
+	{
+		unsigned short* pixels = stbi_load_16(path.c_str(), &width, &height, &numComponents, 0);
+
+		if (pixels == nullptr)
+		{
+			printf("Failed to load heightmap %s: %s\n", path.c_str(), stbi_failure_reason());
+			return Image();
+		}
+
+		Image heightMap(width, height, 1, 1);
+		unsigned short* red = heightMap.data();
+		size_t numPixels = (size_t)width * height;
+
+		for (size_t i = 0; i < numPixels; i++)
+		{
+			red[i] = pixels[i * numComponents];
+		}
+
+		stbi_image_free(pixels);
+
+		return heightMap;
+	}
+
+	unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &numComponents, 0);
+
+	if (pixels == nullptr)
+	{
+		printf("Failed to load heightmap %s: %s\n", path.c_str(), stbi_failure_reason());
+		return Image();
+	}
+
+	Image heightMap(width, height, 1, 1);
+	unsigned short* red = heightMap.data();
+	size_t numPixels = (size_t)width * height;
+
+	// Grey + alpha keeps grey, RGB(A) keeps red. Either way it's the first component of every pixel
+	for (size_t i = 0; i < numPixels; i++)
+	{
+		red[i] = (unsigned short)(pixels[i * numComponents] * 257);
+	}
+
+	stbi_image_free(pixels);
+
+	return heightMap;
+}
+
+
+// Plain fseek / ftell are 32-bit on Windows, DEMs can be bigger than that
+int seekHeightMapFile(FILE* file, long long offset, int origin)
+{
+#ifdef _MSC_VER
+	return _fseeki64(file, offset, origin);
+#else
+	return fseeko(file, (off_t)offset, origin);
+#endif
+}
+
+
+long long tellHeightMapFile(FILE* file)
+{
+#ifdef _MSC_VER
+	return _ftelli64(file);
+#else
+	return (long long)ftello(file);
+#endif
+}
+
+
+// Fills in width and height for a raw file, a missing size means a square one. Returns false and prints why if the
+// file doesn't have the right number of samples
+bool getRawHeightMapSize(FILE* file, const HeightMapSource& source, size_t sampleSize, int& width, int& height)
+{
+	seekHeightMapFile(file, 0, SEEK_END);
+	long long fileBytes = tellHeightMapFile(file);
+	seekHeightMapFile(file, 0, SEEK_SET);
+
+	long long numSamples = fileBytes / (long long)sampleSize;
+
+	width = source.rawWidth;
+	height = source.rawHeight;
+
+	if (width <= 0 || height <= 0)
+	{
+		width = height = (int)std::llround(std::sqrt((double)numSamples));
+	}
+
+	if (width <= 0 || (long long)width * height != numSamples || fileBytes % sampleSize != 0)
+	{
+		printf("Failed to load heightmap %s: %lld bytes isn't %d x %d samples of %d bytes\n", source.path.c_str(), fileBytes, width, height, (int)sampleSize);
+		return false;
+	}
+
+	return true;
+}
+
+
+// Read straight into the image, so even a huge DEM is only ever in memory once
+Image loadRawUInt16HeightMap(const HeightMapSource& source)
+{
+	FILE* file = fopen(source.path.c_str(), "rb");
+
+	if (file == nullptr)
+	{
+		printf("Failed to load heightmap %s: can't open file\n", source.path.c_str());
+		return Image();
+	}
+
+	int width, height;
+
+	if (!getRawHeightMapSize(file, source, sizeof(uint16_t), width, height))
+	{
+		fclose(file);
+		return Image();
+	}
+
+	Image heightMap(width, height, 1, 1);
+	size_t numSamples = (size_t)width * height;
+
+	if (fread(heightMap.data(), sizeof(uint16_t), numSamples, file) != numSamples)
+	{
+		printf("Failed to load heightmap %s: file ended early\n", source.path.c_str());
+		fclose(file);
+		return Image();
+	}
+
+	fclose(file);
+
+	if (!isLittleEndian())
+	{
+		unsigned short* values = heightMap.data();
+
+		for (size_t i = 0; i < numSamples; i++)
+		{
+			values[i] = (unsigned short)((values[i] >> 8) | (values[i] << 8));
+		}
+	}
+
+	return heightMap;
+}
+
+
+// Reads count little-endian floats, swapping them on big-endian machines
+size_t readRawFloats(FILE* file, float* values, size_t count)
+{
+	size_t numRead = fread(values, sizeof(float), count, file);
+
+	if (!isLittleEndian())
+	{
+		for (size_t i = 0; i < numRead; i++)
+		{
+			unsigned char* bytes = (unsigned char*)&values[i];
+			std::swap(bytes[0], bytes[3]);
+			std::swap(bytes[1], bytes[2]);
+		}
+	}
+
+	return numRead;
+}
+
+
+// Streams through numSamples floats from the start of the file with a small buffer, the file is left back at the start.
+// Returns false and prints why if the file is too short
+bool getRawFloat32Range(FILE* file, const HeightMapSource& source, size_t numSamples, float& minValue, float& maxValue)
+{
+	std::vector<float> buffer(HEIGHT_MAP_STREAM_SAMPLES);
+
+	minValue = INFINITY;
+	maxValue = -INFINITY;
+
+	for (size_t i = 0; i < numSamples;)
+	{
+		size_t numRead = readRawFloats(file, buffer.data(), std::min(buffer.size(), numSamples - i));
+
+		if (numRead == 0)
+		{
+			printf("Failed to load heightmap %s: file ended early\n", source.path.c_str());
+			return false;
+		}
+
+		for (size_t j = 0; j < numRead; j++)
+		{
+			// NaN is used as no-data in some DEMs, it's skipped here and ends up at the bottom
+			if (buffer[j] == buffer[j])
+			{
+				minValue = std::min(minValue, buffer[j]);
+				maxValue = std::max(maxValue, buffer[j]);
+			}
+		}
+
+		i += numRead;
+	}
+
+	seekHeightMapFile(file, 0, SEEK_SET);
+
+	return true;
+}
+
+
+// Maps floats from the range getRawFloat32Range found onto 0 to 65535, NaN goes to the bottom
+void normalizeRawFloats(const float* values, size_t count, float minValue, float maxValue, unsigned short* heights)
+{
+	float scale = maxValue > minValue ? HEIGHT_MAP_MAX_VALUE / (maxValue - minValue) : 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		float value = values[i] == values[i] ? (values[i] - minValue) * scale + .5f : 0;
+		heights[i] = (unsigned short)std::min(std::max(value, 0.0f), (float)HEIGHT_MAP_MAX_VALUE);
+	}
+}
+
+
+// Float DEMs are in whatever units they were made in, so this streams through the file twice with a small buffer,
+// once for the min / max and once to map that range onto 0 to 65535. The float samples are never all in memory
+Image loadRawFloat32HeightMap(const HeightMapSource& source)
+{
+	FILE* file = fopen(source.path.c_str(), "rb");
+
+	if (file == nullptr)
+	{
+		printf("Failed to load heightmap %s: can't open file\n", source.path.c_str());
+		return Image();
+	}
+
+	int width, height;
+
+	if (!getRawHeightMapSize(file, source, sizeof(float), width, height))
+	{
+		fclose(file);
+		return Image();
+	}
+
+	size_t numSamples = (size_t)width * height;
+	float minValue, maxValue;
+
+	if (!getRawFloat32Range(file, source, numSamples, minValue, maxValue))
+	{
+		fclose(file);
+		return Image();
+	}
+
+	Image heightMap(width, height, 1, 1);
+	unsigned short* values = heightMap.data();
+
+	std::vector<float> buffer(HEIGHT_MAP_STREAM_SAMPLES);
+
+	for (size_t i = 0; i < numSamples;)
+	{
+		size_t numRead = readRawFloats(file, buffer.data(), std::min(buffer.size(), numSamples - i));
+
+		// Only if the file got shorter since the first pass
+		if (numRead == 0)
+		{
+			printf("Failed to load heightmap %s: file ended early\n", source.path.c_str());
+			fclose(file);
+			return Image();
+		}
+
+		normalizeRawFloats(buffer.data(), numRead, minValue, maxValue, &values[i]);
+
+		i += numRead;
+	}
+
+	fclose(file);
+
+	return heightMap;
+}
+
+
+// Single width * height plane of 16-bit heights. Prints why and returns an empty image if the file can't be read
+Image loadHeightMap(const HeightMapSource& source)
+{
+	switch (getHeightMapFormat(source))
+	{
+	case HEIGHT_MAP_RAW_UINT16:
+		return loadRawUInt16HeightMap(source);
+	case HEIGHT_MAP_RAW_FLOAT32:
+		return loadRawFloat32HeightMap(source);
+	default:
+		return loadHeightMapImage(source.path);
+	}
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// Read-only view of a whole file. Pages are only read from disk when they're first touched, so mapping a huge file
+// costs address space rather than memory, and the OS can drop pages again when it needs the memory
+class MappedFile
+{
+public:
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	// randomAccess tells the OS not to bother reading ahead, for files that are read in scattered pieces
+	bool open(const std::string& path, bool randomAccess = false)
+	{
+		close();
+
+#ifdef _WIN32
+		mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, randomAccess ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+		if (mFile == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER fileSize;
+
+		if (!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+
+		mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		mData = mMapping != NULL ? (const unsigned char*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+		if (mData == nullptr)
+		{
+			close();
+			return false;
+		}
+
+		mSize = (size_t)fileSize.QuadPart;
+#else
+		int file = ::open(path.c_str(), O_RDONLY);
+
+		if (file < 0) return false;
+
+		struct stat info;
+
+		if (fstat(file, &info) != 0 || info.st_size == 0)
+		{
+			::close(file);
+			return false;
+		}
+
+		void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		::close(file); // The mapping keeps the file open
+
+		if (data == MAP_FAILED) return false;
+
+		madvise(data, (size_t)info.st_size, randomAccess ? MADV_RANDOM : MADV_SEQUENTIAL);
+
+		mData = (const unsigned char*)data;
+		mSize = (size_t)info.st_size;
+#endif
+
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (mData != nullptr) UnmapViewOfFile(mData);
+		if (mMapping != NULL) CloseHandle(mMapping);
+		if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+
+		mMapping = NULL;
+		mFile = INVALID_HANDLE_VALUE;
+#else
+		if (mData != nullptr) munmap((void*)mData, mSize);
+#endif
+
+		mData = nullptr;
+		mSize = 0;
+	}
+
+	const unsigned char* getData() const { return mData; }
+	size_t getSize() const { return mSize; }
+
+private:
+#ifdef _WIN32
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = NULL;
+#endif
+
+	const unsigned char* mData = nullptr;
+	size_t mSize = 0;
+};
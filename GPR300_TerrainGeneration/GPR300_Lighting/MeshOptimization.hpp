@@ -0,0 +1,467 @@
+#pragma once
+#include "TerrainGeneration.hpp"
+#include "EW/ShapeGen.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Size of the FIFO post-transform cache the miss ratios are measured against, a common size for GPUs that still have
+// one. Ordering for a smaller cache than the real one costs almost nothing, ordering for a larger one can thrash it
+const int VERTEX_CACHE_SIZE = 16;
+
+// Forsyth's scoring keeps its own LRU cache model, larger than the FIFO it targets works best
+const int FORSYTH_CACHE_SIZE = 32;
+
+
+// Average cache miss ratio, vertices the GPU has to transform per triangle when the last cacheSize vertices it
+// transformed are kept (first in first out). 0.5 is the best a big grid can do, 3 means nothing ever gets reused
+float getACMR(const std::vector<unsigned int>& indices, size_t numVertices, int cacheSize = VERTEX_CACHE_SIZE)
+{
+	if (indices.size() < 3) return 0;
+
+	// When each vertex last went in, it's still cached while fewer than cacheSize others have gone in since
+	std::vector<size_t> cachedAt(numVertices, 0);
+	size_t timestamp = cacheSize + 1;
+	size_t misses = 0;
+
+	for (unsigned int index : indices)
+	{
+		if (timestamp - cachedAt[index] > (size_t)cacheSize)
+		{
+			cachedAt[index] = timestamp++;
+			misses++;
+		}
+	}
+
+	return (float)misses / (indices.size() / 3);
+}
+
+
+// Average transformed to vertex ratio, how many times each vertex gets transformed. 1 is the best there is, and it's
+// what ACMR can't show for meshes (like the sphere) whose triangle to vertex ratio isn't 2
+float getATVR(const std::vector<unsigned int>& indices, size_t numVertices, int cacheSize = VERTEX_CACHE_SIZE)
+{
+	std::vector<bool> used(numVertices, false);
+	size_t numUsed = 0;
+
+	for (unsigned int index : indices)
+	{
+		if (!used[index])
+		{
+			used[index] = true;
+			numUsed++;
+		}
+	}
+
+	return numUsed > 0 ? getACMR(indices, numVertices, cacheSize) * (indices.size() / 3) / numUsed : 0;
+}
+
+
+// Reorders the triangles so vertices get reused while they're still in the post-transform cache, from Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation". Vertices score higher the more recently they were used and the fewer
+// triangles they have left, then the triangle with the highest score among the ones using cached vertices goes next.
+// Works on any triangle list, the triangles and their winding stay the same
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t numVertices)
+{
+	const float CACHE_DECAY_POWER = 1.5f;
+	const float LAST_TRIANGLE_SCORE = .75f;
+	const float VALENCE_BOOST_SCALE = 2;
+	const float VALENCE_BOOST_POWER = .5f;
+
+	size_t numTriangles = indices.size() / 3;
+
+	if (numTriangles == 0) return;
+
+	// Scores for every cache position and remaining triangle count only have to be worked out once
+	float cacheScores[FORSYTH_CACHE_SIZE];
+	float valenceScores[64];
+
+	for (int i = 0; i < FORSYTH_CACHE_SIZE; i++)
+	{
+		// The triangle just added has to go anyway, so its vertices get a flat score rather than the highest
+		cacheScores[i] = i < 3 ? LAST_TRIANGLE_SCORE : std::pow(1 - (i - 3) / (float)(FORSYTH_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+	}
+
+	for (int i = 1; i < 64; i++)
+	{
+		valenceScores[i] = VALENCE_BOOST_SCALE * std::pow((float)i, -VALENCE_BOOST_POWER);
+	}
+
+	valenceScores[0] = 0;
+
+	auto getVertexScore = [&](int cachePosition, unsigned int remaining)
+	{
+		if (remaining == 0) return -1.0f; // Nothing left to draw with it
+
+		float score = cachePosition >= 0 ? cacheScores[cachePosition] : 0;
+		return score + (remaining < 64 ? valenceScores[remaining] : VALENCE_BOOST_SCALE * std::pow((float)remaining, -VALENCE_BOOST_POWER));
+	};
+
+	// Triangles using each vertex, the ones still to be drawn are kept at the front of each vertex's range
+	std::vector<unsigned int> remaining(numVertices, 0);
+
+	for (unsigned int index : indices)
+	{
+		remaining[index]++;
+	}
+
+	std::vector<size_t> triangleStart(numVertices + 1, 0);
+
+	for (size_t i = 0; i < numVertices; i++)
+	{
+		triangleStart[i + 1] = triangleStart[i] + remaining[i];
+	}
+
+	std::vector<unsigned int> vertexTriangles(indices.size());
+	std::vector<size_t> filled(triangleStart.begin(), triangleStart.end() - 1);
+
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		vertexTriangles[filled[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	std::vector<float> vertexScores(numVertices);
+
+	for (size_t i = 0; i < numVertices; i++)
+	{
+		vertexScores[i] = getVertexScore(-1, remaining[i]);
+	}
+
+	std::vector<float> triangleScores(numTriangles);
+	std::vector<bool> drawn(numTriangles, false);
+
+	for (size_t i = 0; i < numTriangles; i++)
+	{
+		triangleScores[i] = vertexScores[indices[i * 3]] + vertexScores[indices[i * 3 + 1]] + vertexScores[indices[i * 3 + 2]];
+	}
+
+	std::vector<unsigned int> ordered;
+	ordered.reserve(indices.size());
+
+	// Extra room for the 3 vertices pushed in before the oldest ones are dropped
+	unsigned int cache[FORSYTH_CACHE_SIZE + 3];
+	unsigned int nextCache[FORSYTH_CACHE_SIZE + 3];
+	int cacheCount = 0;
+
+	size_t bestTriangle = 0;
+	size_t nextUndrawn = 0; // Nothing before it is left to draw
+
+	for (size_t count = 0; count < numTriangles; count++)
+	{
+		// Nothing in the cache has triangles left, start again from the first triangle not drawn yet
+		if (bestTriangle == numTriangles)
+		{
+			while (drawn[nextUndrawn])
+			{
+				nextUndrawn++;
+			}
+
+			bestTriangle = nextUndrawn;
+		}
+
+		const unsigned int* triangle = &indices[bestTriangle * 3];
+		ordered.insert(ordered.end(), triangle, triangle + 3);
+		drawn[bestTriangle] = true;
+
+		// Takes the triangle out of its vertices' remaining ranges
+		for (int corner = 0; corner < 3; corner++)
+		{
+			unsigned int vertex = triangle[corner];
+			unsigned int* triangles = &vertexTriangles[triangleStart[vertex]];
+
+			unsigned int* found = std::find(triangles, triangles + remaining[vertex], (unsigned int)bestTriangle);
+			std::swap(*found, triangles[remaining[vertex] - 1]);
+
+			remaining[vertex]--;
+		}
+
+		// Triangle's vertices go to the front, everything else in the cache moves back
+		int nextCount = 0;
+
+		for (int corner = 0; corner < 3; corner++)
+		{
+			nextCache[nextCount++] = triangle[corner];
+		}
+
+		for (int i = 0; i < cacheCount; i++)
+		{
+			unsigned int vertex = cache[i];
+
+			if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2])
+			{
+				nextCache[nextCount++] = vertex;
+			}
+		}
+
+		std::copy(nextCache, nextCache + nextCount, cache);
+		cacheCount = glm::min(nextCount, FORSYTH_CACHE_SIZE);
+
+		// Only the vertices that were or are in the cache changed score
+		for (int i = 0; i < nextCount; i++)
+		{
+			unsigned int vertex = cache[i];
+			int position = i < FORSYTH_CACHE_SIZE ? i : -1; // Just pushed out
+
+			float score = getVertexScore(position, remaining[vertex]);
+			float change = score - vertexScores[vertex];
+			vertexScores[vertex] = score;
+
+			const unsigned int* triangles = &vertexTriangles[triangleStart[vertex]];
+
+			for (unsigned int t = 0; t < remaining[vertex]; t++)
+			{
+				triangleScores[triangles[t]] += change;
+			}
+		}
+
+		// Once every change is in, the next triangle is the best one left on a cached vertex
+		float bestScore = -1;
+		bestTriangle = numTriangles;
+
+		for (int i = 0; i < cacheCount; i++)
+		{
+			unsigned int vertex = cache[i];
+			const unsigned int* triangles = &vertexTriangles[triangleStart[vertex]];
+
+			for (unsigned int t = 0; t < remaining[vertex]; t++)
+			{
+				if (triangleScores[triangles[t]] > bestScore)
+				{
+					bestScore = triangleScores[triangles[t]];
+					bestTriangle = triangles[t];
+				}
+			}
+		}
+	}
+
+	indices.swap(ordered);
+}
+
+
+// Overdraw aware version of the vertex cache order, after Sander, Nehab and Barczak's "Fast Triangle Reordering for
+// Vertex Locality and Reduced Overdraw". The cache order is cut into clusters, each ending as soon as its own miss
+// ratio (starting from an empty cache) gets down to threshold times the whole mesh's, so no cluster costs much more
+// than the order it came from. Then the clusters are drawn in order of how far out they face from the mesh's centre.
+// Those are the ones in front from most directions, so they fill the depth buffer first and the rest gets rejected
+// before shading. Cluster order only, every cluster keeps its triangles
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f, int cacheSize = VERTEX_CACHE_SIZE)
+{
+	size_t numTriangles = indices.size() / 3;
+
+	if (numTriangles == 0) return;
+
+	struct Cluster
+	{
+		size_t start; // First triangle
+		size_t end;
+		float sortKey;
+	};
+
+	std::vector<Cluster> clusters;
+
+	float targetACMR = getACMR(indices, vertices.size(), cacheSize) * threshold;
+
+	// Same FIFO as getACMR, emptied at the start of every cluster since it could end up drawn after any other
+	std::vector<size_t> cachedAt(vertices.size(), 0);
+	size_t timestamp = cacheSize + 1;
+
+	size_t clusterStart = 0;
+	size_t clusterMisses = 0;
+
+	for (size_t i = 0; i < numTriangles; i++)
+	{
+		for (int corner = 0; corner < 3; corner++)
+		{
+			unsigned int index = indices[i * 3 + corner];
+
+			if (timestamp - cachedAt[index] > (size_t)cacheSize)
+			{
+				cachedAt[index] = timestamp++;
+				clusterMisses++;
+			}
+		}
+
+		if (clusterMisses <= targetACMR * (i + 1 - clusterStart) || i == numTriangles - 1)
+		{
+			clusters.push_back({ clusterStart, i + 1, 0 });
+
+			clusterStart = i + 1;
+			clusterMisses = 0;
+			timestamp += cacheSize + 1;
+		}
+	}
+
+	if (clusters.size() < 2) return;
+
+	// Area weighted, a cross product is twice the triangle's area along its normal
+	auto getTriangle = [&](size_t triangle, glm::vec3& center, glm::vec3& areaNormal)
+	{
+		const glm::vec3& a = vertices[indices[triangle * 3]].position;
+		const glm::vec3& b = vertices[indices[triangle * 3 + 1]].position;
+		const glm::vec3& c = vertices[indices[triangle * 3 + 2]].position;
+
+		center = (a + b + c) / 3.0f;
+		areaNormal = glm::cross(b - a, c - a);
+	};
+
+	glm::vec3 meshCenter(0);
+	float meshArea = 0;
+
+	std::vector<glm::vec3> clusterCenters(clusters.size(), glm::vec3(0));
+	std::vector<glm::vec3> clusterNormals(clusters.size(), glm::vec3(0));
+
+	for (size_t i = 0; i < clusters.size(); i++)
+	{
+		float clusterArea = 0;
+
+		for (size_t triangle = clusters[i].start; triangle < clusters[i].end; triangle++)
+		{
+			glm::vec3 center, areaNormal;
+			getTriangle(triangle, center, areaNormal);
+
+			float area = glm::length(areaNormal);
+
+			clusterCenters[i] += center * area;
+			clusterNormals[i] += areaNormal;
+			clusterArea += area;
+		}
+
+		meshCenter += clusterCenters[i];
+		meshArea += clusterArea;
+
+		if (clusterArea > 0) clusterCenters[i] /= clusterArea;
+	}
+
+	if (meshArea > 0) meshCenter /= meshArea;
+
+	for (size_t i = 0; i < clusters.size(); i++)
+	{
+		float normalLength = glm::length(clusterNormals[i]);
+
+		clusters[i].sortKey = normalLength > 0 ? glm::dot(clusterCenters[i] - meshCenter, clusterNormals[i] / normalLength) : 0;
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+	std::vector<unsigned int> ordered;
+	ordered.reserve(indices.size());
+
+	for (const Cluster& cluster : clusters)
+	{
+		ordered.insert(ordered.end(), indices.begin() + cluster.start * 3, indices.begin() + cluster.end * 3);
+	}
+
+	indices.swap(ordered);
+}
+
+
+// Renumbers the vertices in the order the indices first use them and moves them to match, so vertex fetches walk
+// through the buffer front to back. Vertices no index uses are dropped
+void optimizeVertexFetch(MeshData& meshData)
+{
+	const unsigned int UNUSED = ~0u;
+
+	std::vector<unsigned int> remap(meshData.vertices.size(), UNUSED);
+	std::vector<Vertex> vertices;
+	vertices.reserve(meshData.vertices.size());
+
+	for (unsigned int& index : meshData.indices)
+	{
+		if (remap[index] == UNUSED)
+		{
+			remap[index] = (unsigned int)vertices.size();
+			vertices.push_back(meshData.vertices[index]);
+		}
+
+		index = remap[index];
+	}
+
+	meshData.vertices.swap(vertices);
+}
+
+
+// Cache order, then overdraw order on top of it, then the vertices to match. For meshes built once and drawn every
+// frame, the terrain grid gets its order straight from generateGridIndices instead
+void optimizeMesh(MeshData& meshData)
+{
+	optimizeVertexCache(meshData.indices, meshData.vertices.size());
+	optimizeOverdraw(meshData.indices, meshData.vertices);
+	optimizeVertexFetch(meshData);
+}
+
+
+// Prints the miss ratios of the terrain grid and the shapes before and after reordering to the console
+void benchmarkVertexCache(int terrainResolution)
+{
+	std::cout << "Vertex cache, " << VERTEX_CACHE_SIZE << " entry FIFO (ACMR: vertices transformed per triangle, ATVR: per vertex)" << std::endl;
+
+	auto print = [](const char* name, const char* order, const MeshData& meshData)
+	{
+		std::cout << "  " << name << ", " << order << ": ACMR " << getACMR(meshData.indices, meshData.vertices.size()) <<
+			", ATVR " << getATVR(meshData.indices, meshData.vertices.size()) << std::endl;
+	};
+
+	// Row by row, the order generateGridIndices used before it went to strips
+	auto generateRowMajorIndices = [](int resolution, MeshData& meshData)
+	{
+		meshData.indices.clear();
+		meshData.indices.reserve(6 * (size_t)resolution * resolution);
+
+		for (int y = 0; y < resolution; y++)
+		{
+			for (int x = 0; x < resolution; x++)
+			{
+				unsigned int v0 = y * (resolution + 1) + x;
+				unsigned int v1 = v0 + resolution + 1;
+
+				unsigned int quad[] = { v0, v1, v1 + 1, v0, v1 + 1, v0 + 1 };
+				meshData.indices.insert(meshData.indices.end(), quad, quad + 6);
+			}
+		}
+	};
+
+	MeshData grid;
+	grid.vertices.resize((size_t)(terrainResolution + 1) * (terrainResolution + 1));
+
+	std::string gridName = "Terrain grid " + std::to_string(terrainResolution);
+
+	generateRowMajorIndices(terrainResolution, grid);
+	print(gridName.c_str(), "rows", grid);
+
+	generateGridIndices(terrainResolution, grid);
+	print(gridName.c_str(), "strips", grid);
+
+	// Forsyth on the whole grid would take a while at full resolution, a smaller one shows how the strips compare
+	int forsythResolution = glm::min(terrainResolution, 256);
+	std::string forsythName = "Terrain grid " + std::to_string(forsythResolution);
+
+	grid.vertices.resize((size_t)(forsythResolution + 1) * (forsythResolution + 1));
+	generateRowMajorIndices(forsythResolution, grid);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	optimizeVertexCache(grid.indices, grid.vertices.size());
+	auto end = std::chrono::high_resolution_clock::now();
+
+	print(forsythName.c_str(), "Forsyth", grid);
+	std::cout << "    " << grid.indices.size() / 3 << " triangles in " << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+
+	MeshData shapes[2];
+	const char* shapeNames[] = { "Sphere", "Cylinder" };
+
+	ew::createSphere(.5f, 64, shapes[0]);
+	ew::createCylinder(1, .5f, 64, shapes[1]);
+
+	for (int i = 0; i < 2; i++)
+	{
+		print(shapeNames[i], "as made", shapes[i]);
+
+		MeshData cacheOnly = shapes[i];
+		optimizeVertexCache(cacheOnly.indices, cacheOnly.vertices.size());
+		print(shapeNames[i], "Forsyth", cacheOnly);
+
+		optimizeMesh(shapes[i]);
+		print(shapeNames[i], "Forsyth + overdraw + fetch", shapes[i]);
+	}
+}
@@ -0,0 +1,308 @@
+#pragma once
+#include "TerrainGeneration.hpp"
+
+
+// Right-triangulated irregular network (RTIN), the same scheme as Mapbox's Martini. The terrain is covered by two big
+// right triangles that get split in half along their hypotenuse until every triangle is within maxError of the full
+// height field. Flat areas stay as a few big triangles while mountains get the full grid. Splits always happen on a
+// hypotenuse both neighbors share, and errors are carried up to parents, so neighbors always split together and the
+// mesh has no cracks. RTIN needs a 2^n grid, so it runs on the smallest power of two at least as fine as the terrain's
+// resolution. Unlike Martini, which only measures the points a split would add, the error carried up adds each split's
+// own error to its children's, so it's an upper bound for every sample a triangle covers and maxError always holds
+
+
+// Smallest power of two grid at least as fine as resolution, and at least 2 so the two starting triangles can split
+int getAdaptiveGridResolution(int resolution)
+{
+	int gridResolution = 2;
+
+	while (gridResolution < resolution)
+	{
+		gridResolution *= 2;
+	}
+
+	return gridResolution;
+}
+
+
+// Upper bound on the error that would be left by not splitting at each grid point, 0 for points that are never a
+// midpoint. Splitting moves the surface by at most the midpoint's own error (the change is a plane through the other
+// corners), so a triangle is never further off than that plus the worst of its children. Triangles come in two kinds
+// that alternate as they get split: ones whose hypotenuse is an axis aligned edge of length 2 * step, and ones whose
+// hypotenuse is the diagonal of a 2 * step square. Every split point is the middle of one of those, shared by the
+// triangle on each side. Each level only reads the finer level before it, so the levels go from finest
+// to coarsest and every level's rows are split across the thread pool
+void computeAdaptiveErrors(const HeightField& heightField, std::vector<float>& errors)
+{
+	int size = heightField.resolution;
+	int rowSize = heightField.getRowSize();
+	const float* heights = heightField.heights.data();
+
+	errors.assign(heightField.heights.size(), 0.0f);
+	float* error = errors.data();
+
+	auto at = [&](int x, int y) { return (size_t)y * rowSize + x; };
+
+	auto splitError = [&](int ax, int ay, int bx, int by, int mx, int my)
+	{
+		return std::abs((heights[at(ax, ay)] + heights[at(bx, by)]) * .5f - heights[at(mx, my)]);
+	};
+
+	for (int step = 1; step < size; step *= 2)
+	{
+		// Axis aligned hypotenuses, their triangles' right angles are step away on either side. Children (split along
+		// those triangles' legs) are the diagonal splits of the step sized squares from the last level
+		getThreadPool().parallelFor(size / step + 1, [&](int startRow, int endRow)
+		{
+			for (int row = startRow; row < endRow; row++)
+			{
+				int y = row * step;
+
+				// Rows on the 2 * step lines hold horizontal hypotenuses, the ones between hold vertical ones
+				bool horizontal = (y / step) % 2 == 0;
+
+				for (int x = horizontal ? step : 0; x <= size; x += 2 * step)
+				{
+					int dx = horizontal ? step : 0;
+					int dy = horizontal ? 0 : step;
+
+					float childError = 0;
+
+					if (step > 1)
+					{
+						int half = step / 2;
+
+						// Right angle corner on each side that exists, its two children's midpoints are half a step along and across
+						for (int side = -1; side <= 1; side += 2)
+						{
+							int cx = x + dy * side;
+							int cy = y + dx * side;
+
+							if (cx < 0 || cy < 0 || cx > size || cy > size) continue;
+
+							int acrossX = (cx - x) / 2;
+							int acrossY = (cy - y) / 2;
+
+							childError = glm::max(childError, error[at(x + acrossX - (dx ? half : 0), y + acrossY - (dy ? half : 0))]);
+							childError = glm::max(childError, error[at(x + acrossX + (dx ? half : 0), y + acrossY + (dy ? half : 0))]);
+						}
+					}
+
+					error[at(x, y)] = splitError(x - dx, y - dy, x + dx, y + dy, x, y) + childError;
+				}
+			}
+		});
+
+		// Square diagonals, which way they go flips like a checkerboard. Both triangles' children are the square's 4 edges
+		int squareSize = 2 * step;
+		int squares = size / squareSize;
+
+		getThreadPool().parallelFor(squares, [&](int startRow, int endRow)
+		{
+			for (int squareY = startRow; squareY < endRow; squareY++)
+			{
+				for (int squareX = 0; squareX < squares; squareX++)
+				{
+					int left = squareX * squareSize;
+					int bottom = squareY * squareSize;
+
+					int x = left + step;
+					int y = bottom + step;
+
+					float ownError = (squareX + squareY) % 2 == 0 ?
+						splitError(left, bottom, left + squareSize, bottom + squareSize, x, y) :
+						splitError(left, bottom + squareSize, left + squareSize, bottom, x, y);
+
+					float childError = glm::max(glm::max(error[at(x - step, y)], error[at(x + step, y)]),
+						glm::max(error[at(x, y - step)], error[at(x, y + step)]));
+
+					error[at(x, y)] = ownError + childError;
+				}
+			}
+		});
+	}
+}
+
+
+void addAdaptiveTriangles(const std::vector<float>& errors, int rowSize, float maxError, int ax, int ay, int bx, int by, int cx, int cy, std::vector<glm::ivec2>& corners)
+{
+	int mx = (ax + bx) >> 1;
+	int my = (ay + by) >> 1;
+
+	if (std::abs(ax - cx) + std::abs(ay - cy) > 1 && errors[my * rowSize + mx] > maxError)
+	{
+		addAdaptiveTriangles(errors, rowSize, maxError, cx, cy, ax, ay, mx, my, corners);
+		addAdaptiveTriangles(errors, rowSize, maxError, bx, by, cx, cy, mx, my, corners);
+		return;
+	}
+
+	glm::ivec2 a(ax, ay);
+	glm::ivec2 b(bx, by);
+	glm::ivec2 c(cx, cy);
+
+	// Same winding as generateGridIndices' 0-1-2, which goes this way round in grid coordinates
+	glm::ivec2 ab = b - a;
+	glm::ivec2 ac = c - a;
+
+	if (ab.x * ac.y - ab.y * ac.x > 0)
+	{
+		std::swap(b, c);
+	}
+
+	corners.push_back(a);
+	corners.push_back(b);
+	corners.push_back(c);
+}
+
+
+// Adaptive version of generateSharedTerrainFromHeightmap, triangles are split until leaving them whole would be off by
+// no more than maxError (in world units) from the full resolution grid. Uvs are in the terrain resolution's grid units so
+// textures tile the same as the other meshes
+void generateAdaptiveTerrainFromHeightmap(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, float maxError, MeshData& meshData)
+{
+	TerrainInfo gridInfo = terrainInfo;
+	gridInfo.resolution = getAdaptiveGridResolution(terrainInfo.resolution);
+
+	int gridResolution = gridInfo.resolution;
+	int rowSize = gridResolution + 1;
+
+	HeightField heightField;
+	generateHeightField(gridInfo, noiseInfo, heightMap, heightField);
+
+	std::vector<float> errors;
+	computeAdaptiveErrors(heightField, errors);
+
+	std::vector<glm::ivec2> corners;
+	addAdaptiveTriangles(errors, rowSize, maxError, 0, 0, gridResolution, gridResolution, gridResolution, 0, corners);
+	addAdaptiveTriangles(errors, rowSize, maxError, gridResolution, gridResolution, 0, 0, 0, gridResolution, corners);
+
+	// Corners shared between triangles become one vertex, numbered in the order they're first used
+	std::vector<int> vertexIndices((size_t)rowSize * rowSize, -1);
+	std::vector<glm::ivec2> gridPoints;
+
+	meshData.indices.resize(corners.size());
+
+	for (size_t i = 0; i < corners.size(); i++)
+	{
+		int& index = vertexIndices[(size_t)corners[i].y * rowSize + corners[i].x];
+
+		if (index < 0)
+		{
+			index = (int)gridPoints.size();
+			gridPoints.push_back(corners[i]);
+		}
+
+		meshData.indices[i] = (unsigned int)index;
+	}
+
+	float cellWidth = terrainInfo.width / gridResolution;
+	float cellLength = terrainInfo.length / gridResolution;
+	float uvScale = (float)terrainInfo.resolution / gridResolution;
+
+	meshData.vertices.resize(gridPoints.size());
+	Vertex* vertices = meshData.vertices.data();
+
+	getThreadPool().parallelFor((int)gridPoints.size(), [&](int start, int end)
+	{
+		for (int i = start; i < end; i++)
+		{
+			int x = gridPoints[i].x;
+			int y = gridPoints[i].y;
+
+			// Smooth normals from the full resolution heights, so lighting doesn't show where the triangles are big
+			float dx = (heightField.at(x - 1, y) - heightField.at(x + 1, y)) / (2.0f * cellWidth);
+			float dz = (heightField.at(x, y - 1) - heightField.at(x, y + 1)) / (2.0f * cellLength);
+
+			vertices[i].position = glm::vec3(-terrainInfo.width / 2 + cellWidth * x, heightField.at(x, y), -terrainInfo.length / 2 + cellLength * y);
+			vertices[i].normal = glm::normalize(glm::vec3(dx, 1, dz));
+			vertices[i].uv = glm::vec2(x, y) * uvScale;
+		}
+	});
+}
+
+
+// Adaptive mesh with the same prepare / upload split as the other terrains, so it can be built in the background
+class AdaptiveTerrain
+{
+public:
+	AdaptiveTerrain() {}
+
+	void prepare(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, float maxError)
+	{
+		generateAdaptiveTerrainFromHeightmap(terrainInfo, noiseInfo, heightMap, maxError, mPendingMeshData);
+	}
+
+	void upload()
+	{
+		mMesh.initialize(&mPendingMeshData);
+
+		mNumVertices = mPendingMeshData.vertices.size();
+		mNumTriangles = mPendingMeshData.indices.size() / 3;
+
+		mPendingMeshData = MeshData();
+	}
+
+	// Uploads a mesh built elsewhere (the mesh cache)
+	void upload(const Vertex* vertices, size_t numVertices, const unsigned int* indices, size_t numIndices)
+	{
+		mMesh.initialize(vertices, numVertices, indices, numIndices);
+
+		mNumVertices = numVertices;
+		mNumTriangles = numIndices / 3;
+	}
+
+	void draw()
+	{
+		if (mNumTriangles == 0) return;
+
+		mMesh.draw();
+	}
+
+	size_t getNumVertices() const { return mNumVertices; }
+	size_t getNumTriangles() const { return mNumTriangles; }
+
+	// What prepare built, only safe to read on the thread that ran it until upload
+	const MeshData& getPendingMeshData() const { return mPendingMeshData; }
+
+private:
+	Mesh mMesh;
+	MeshData mPendingMeshData;
+
+	size_t mNumVertices = 0;
+	size_t mNumTriangles = 0;
+};
+
+
+// Triangle count and build time of the adaptive mesh at a few error bounds against the uniform shared grid
+void benchmarkAdaptiveTerrain(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap)
+{
+	TerrainInfo uniformInfo = terrainInfo;
+	uniformInfo.sharedVertices = true;
+
+	MeshData meshData;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	generateTerrainFromHeightmap(uniformInfo, noiseInfo, heightMap, meshData);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	double uniformTime = std::chrono::duration<double, std::milli>(end - start).count();
+	size_t uniformTriangles = meshData.indices.size() / 3;
+
+	std::cout << "Uniform grid, resolution " << terrainInfo.resolution << ": " << uniformTriangles << " triangles, " << uniformTime << "ms" << std::endl;
+	std::cout << "Adaptive, grid " << getAdaptiveGridResolution(terrainInfo.resolution) << ", height range " << terrainInfo.maxHeight - terrainInfo.minHeight << std::endl;
+
+	float maxErrors[] = { .05f, .25f, 1, 2, 5 };
+
+	for (float maxError : maxErrors)
+	{
+		start = std::chrono::high_resolution_clock::now();
+		generateAdaptiveTerrainFromHeightmap(terrainInfo, noiseInfo, heightMap, maxError, meshData);
+		end = std::chrono::high_resolution_clock::now();
+
+		double time = std::chrono::duration<double, std::milli>(end - start).count();
+		size_t triangles = meshData.indices.size() / 3;
+
+		std::cout << "Max error " << maxError << ": " << triangles << " triangles (" << 100.0 * triangles / uniformTriangles << "% of uniform), " <<
+			meshData.vertices.size() << " vertices, " << time << "ms" << std::endl;
+	}
+}
@@ -0,0 +1,245 @@
+#pragma once
+#include "TerrainGeneration.hpp"
+#include "Frustum.hpp"
+
+const int DEFAULT_TERRAIN_CHUNK_SIZE = 128; // Quads along each side of a chunk
+
+
+struct TerrainChunk
+{
+	// Local (model) space bounds, built from the chunk's min and max heights
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+
+	int baseVertex; // Where this chunk's vertices start in the shared vertex buffer
+};
+
+
+// Every chunk has the same (chunkSize + 1)^2 vertex layout, so meshData.indices only holds one chunk's
+// worth of indices and each chunk is drawn with those indices offset by its baseVertex
+struct ChunkedTerrainData
+{
+	int chunkSize = DEFAULT_TERRAIN_CHUNK_SIZE;
+	int chunksX = 0;
+	int chunksY = 0;
+
+	MeshData meshData;
+	std::vector<TerrainChunk> chunks;
+};
+
+
+// Clamps chunkSize to the terrain and then shrinks it to spread the resolution evenly, so the last row and column of
+// chunks aren't mostly padding. Returns the final chunk size
+int getTerrainChunkSize(int resolution, int chunkSize, int& chunksPerSide)
+{
+	chunkSize = glm::max(1, glm::min(chunkSize, resolution));
+
+	chunksPerSide = (resolution + chunkSize - 1) / chunkSize;
+	return (resolution + chunksPerSide - 1) / chunksPerSide;
+}
+
+
+// How many vertices and (one chunk's worth of) indices a chunked terrain has
+void getChunkedTerrainMeshSize(int resolution, int chunkSize, size_t& numVertices, size_t& numIndices)
+{
+	int chunksPerSide;
+	chunkSize = getTerrainChunkSize(resolution, chunkSize, chunksPerSide);
+
+	numVertices = (size_t)chunksPerSide * chunksPerSide * (chunkSize + 1) * (chunkSize + 1);
+	numIndices = 6 * (size_t)chunkSize * chunkSize;
+}
+
+
+// Fills in chunkedData's layout and chunks, the vertices and indices go to the given pointers (getChunkedTerrainMeshSize
+// of each) instead of chunkedData.meshData. They're written once and never read back, so they can be a mapped GPU buffer
+void generateChunkedTerrainFromHeightmap(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, ChunkedTerrainData& chunkedData,
+	Vertex* vertices, unsigned int* indices, int chunkSize = DEFAULT_TERRAIN_CHUNK_SIZE)
+{
+	int resolution = terrainInfo.resolution;
+	float width = terrainInfo.width;
+	float length = terrainInfo.length;
+	float minHeight = terrainInfo.minHeight;
+	float maxHeight = terrainInfo.maxHeight;
+
+	float halfWidth = width / 2.0f;
+	float halfHeight = length / 2.0f;
+
+	float triangleWidth = width / resolution;
+	float triangleHeight = length / resolution;
+
+	int chunksPerSide;
+	chunkSize = getTerrainChunkSize(resolution, chunkSize, chunksPerSide);
+
+	int chunkRowVertices = chunkSize + 1;
+	int chunkVertices = chunkRowVertices * chunkRowVertices;
+
+	chunkedData.chunkSize = chunkSize;
+	chunkedData.chunksX = chunksPerSide;
+	chunkedData.chunksY = chunksPerSide;
+
+	int numChunks = chunkedData.chunksX * chunkedData.chunksY;
+
+	chunkedData.chunks.resize(numChunks);
+
+	TerrainChunk* chunks = chunkedData.chunks.data();
+
+	HeightRowSampler sampler(heightMap, noiseInfo, resolution, minHeight, maxHeight);
+
+	getThreadPool().parallelFor(numChunks, [&](int startChunk, int endChunk)
+	{
+		std::vector<glm::vec3> normals(chunkRowVertices + 2);
+
+		for (int chunkIndex = startChunk; chunkIndex < endChunk; chunkIndex++)
+		{
+			int chunkX = chunkIndex % chunkedData.chunksX;
+			int chunkY = chunkIndex / chunkedData.chunksX;
+
+			// Rows cover the chunk plus a column on either side (where the grid has one) so edge normals match the neighbor chunk's
+			int startX = chunkX * chunkSize;
+			int cacheStartX = glm::max(startX - 1, 0);
+			int cacheEndX = glm::min(startX + chunkRowVertices + 1, resolution + 1);
+
+			HeightRowCache rows(sampler, cacheStartX, cacheEndX - cacheStartX);
+
+			TerrainChunk& chunk = chunks[chunkIndex];
+			chunk.baseVertex = chunkIndex * chunkVertices;
+
+			float chunkMinHeight = maxHeight;
+			float chunkMaxHeight = minHeight;
+
+			Vertex* chunkVerts = &vertices[chunk.baseVertex];
+
+			for (int localY = 0; localY <= chunkSize; localY++)
+			{
+				// Chunks hanging off the far edge clamp onto it, which collapses their extra quads into degenerate triangles
+				int y = glm::min(chunkY * chunkSize + localY, resolution);
+
+				const float* heights = rows.getRow(y);
+				computeNormalRow(rows.getRow(y - 1), heights, rows.getRow(y + 1), rows.getCount(), triangleWidth, triangleHeight, normals.data());
+
+				for (int localX = 0; localX <= chunkSize; localX++)
+				{
+					int x = glm::min(startX + localX, resolution);
+
+					float height = heights[x - cacheStartX];
+
+					Vertex& vertex = chunkVerts[localY * chunkRowVertices + localX];
+					vertex.position = glm::vec3(-halfWidth + (triangleWidth * x), height, -halfHeight + (triangleHeight * y));
+					vertex.normal = normals[x - cacheStartX];
+					vertex.uv = glm::vec2(x, y);
+
+					chunkMinHeight = glm::min(chunkMinHeight, height);
+					chunkMaxHeight = glm::max(chunkMaxHeight, height);
+				}
+			}
+
+			// Worked out again rather than read back from the vertices, which might be in GPU memory
+			int startY = chunkY * chunkSize;
+			int endX = glm::min(startX + chunkSize, resolution);
+			int endY = glm::min(startY + chunkSize, resolution);
+
+			chunk.boundsMin = glm::vec3(-halfWidth + (triangleWidth * startX), chunkMinHeight, -halfHeight + (triangleHeight * startY));
+			chunk.boundsMax = glm::vec3(-halfWidth + (triangleWidth * endX), chunkMaxHeight, -halfHeight + (triangleHeight * endY));
+		}
+	});
+
+	// One set of indices shared by every chunk, same order and winding as the full grid
+	generateGridIndices(chunkSize, indices);
+}
+
+
+void generateChunkedTerrainFromHeightmap(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, ChunkedTerrainData& chunkedData, int chunkSize = DEFAULT_TERRAIN_CHUNK_SIZE)
+{
+	size_t numVertices, numIndices;
+	getChunkedTerrainMeshSize(terrainInfo.resolution, chunkSize, numVertices, numIndices);
+
+	MeshData& meshData = chunkedData.meshData;
+	meshData.vertices.resize(numVertices);
+	meshData.indices.resize(numIndices);
+
+	generateChunkedTerrainFromHeightmap(terrainInfo, noiseInfo, heightMap, chunkedData, meshData.vertices.data(), meshData.indices.data(), chunkSize);
+}
+
+
+void createChunkedTerrain(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, ChunkedTerrainData& chunkedData)
+{
+	std::shared_ptr<const Image> heightMap = readHeightMap(terrainInfo, noiseInfo);
+	generateChunkedTerrainFromHeightmap(terrainInfo, noiseInfo, *heightMap, chunkedData);
+}
+
+
+// Holds the OpenGL buffers for a chunked terrain and draws only the chunks inside a frustum
+class ChunkedTerrainMesh
+{
+public:
+	ChunkedTerrainMesh() {}
+
+	void initialize(const ChunkedTerrainData* chunkedData)
+	{
+		const MeshData& meshData = chunkedData->meshData;
+		initialize(meshData.vertices.data(), meshData.vertices.size(), meshData.indices.data(), meshData.indices.size(), chunkedData->chunks);
+	}
+
+	// Same as above for data that isn't in a ChunkedTerrainData, like a memory mapped file. indices is one chunk's worth
+	void initialize(const Vertex* vertices, size_t numVertices, const unsigned int* indices, size_t numIndices, const std::vector<TerrainChunk>& chunks)
+	{
+		mMesh.initialize(vertices, numVertices, indices, numIndices);
+		mChunks = chunks;
+	}
+
+	// Like TerrainMesh::map, makes and maps the buffers for the next terrain so generateChunkedTerrainFromHeightmap can
+	// write straight into them while this one keeps drawing. False if mapping isn't supported
+	bool map(const TerrainInfo& terrainInfo, Vertex*& vertices, unsigned int*& indices, int chunkSize = DEFAULT_TERRAIN_CHUNK_SIZE)
+	{
+		size_t numVertices, numIndices;
+		getChunkedTerrainMeshSize(terrainInfo.resolution, chunkSize, numVertices, numIndices);
+
+		return mMappedMesh.map(numVertices, numIndices, vertices, indices);
+	}
+
+	// Swaps in what map's buffers were filled with, chunks come from the ChunkedTerrainData generation filled in.
+	// False if the driver lost the mapped contents, the old terrain stays then
+	bool uploadMapped(const std::vector<TerrainChunk>& chunks)
+	{
+		if (!mMappedMesh.unmap()) return false;
+
+		mMesh.swap(mMappedMesh);
+		mMappedMesh.release();
+		mChunks = chunks;
+
+		return true;
+	}
+
+	// Drops map's buffers when generation didn't fill them, the current chunks keep drawing
+	void cancelMapped()
+	{
+		mMappedMesh.release();
+	}
+
+	// Frustum has to be in the terrain's local space (projection * view * model), returns how many chunks were drawn
+	int draw(const Frustum& frustum)
+	{
+		if (mMesh.getVAO() == 0) return 0;
+
+		glBindVertexArray(mMesh.getVAO());
+
+		int numDrawn = 0;
+
+		for (const TerrainChunk& chunk : mChunks)
+		{
+			if (!isBoxInFrustum(frustum, chunk.boundsMin, chunk.boundsMax)) continue;
+
+			glDrawElementsBaseVertex(GL_TRIANGLES, mMesh.getNumIndices(), GL_UNSIGNED_INT, 0, chunk.baseVertex);
+			numDrawn++;
+		}
+
+		return numDrawn;
+	}
+
+	int getNumChunks() const { return (int)mChunks.size(); }
+
+private:
+	Mesh mMesh;
+	Mesh mMappedMesh; // Being filled by generation on another thread
+	std::vector<TerrainChunk> mChunks;
+};
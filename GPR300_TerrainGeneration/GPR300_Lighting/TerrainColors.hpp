@@ -0,0 +1,83 @@
+#pragma once
+#include "GL/glew.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <vector>
+
+const int TERRAIN_COLOR_TEXTURE_SIZE = 1024;
+
+
+// Color terrainShader.frag gives a height portion (0 at the min height, 1 at the max). Each color runs up to its
+// threshold, and the last blendThreshold below a threshold fades into the next color. Heights past the last
+// threshold are gray
+glm::vec3 getTerrainColor(const std::vector<glm::vec3>& colors, const std::vector<float>& thresholds, float blendThreshold, float portion)
+{
+	int numColors = (int)glm::min(colors.size(), thresholds.size());
+
+	int i = 0;
+
+	while (i < numColors && portion > thresholds[i])
+	{
+		i++;
+	}
+
+	if (i == numColors) return glm::vec3(portion);
+
+	if (i == numColors - 1 || thresholds[i] - portion > blendThreshold) return colors[i];
+
+	// With no blend distance this is only reached right on the threshold, which then goes to the next color
+	float blend = blendThreshold > 0 ? (portion - (thresholds[i] - blendThreshold)) / blendThreshold : 1;
+
+	return glm::mix(colors[i], colors[i + 1], glm::clamp(blend, 0.0f, 1.0f));
+}
+
+
+// getTerrainColor baked into a 1D texture, so a fragment does one lookup instead of searching the thresholds. Texel i
+// holds the color at portion i / (size - 1), linear filtering fills in between. A hard edge between two colors gets
+// spread over one texel, a thousandth of the height range
+class TerrainColorTexture
+{
+public:
+	TerrainColorTexture() {}
+
+	~TerrainColorTexture()
+	{
+		if (mTexture != 0)
+		{
+			glDeleteTextures(1, &mTexture);
+		}
+	}
+
+	// Rebakes and uploads every texel, only needs calling when the colors, thresholds or blend change. The texture
+	// stays bound to unit, which nothing else uses
+	void update(const std::vector<glm::vec3>& colors, const std::vector<float>& thresholds, float blendThreshold, int unit)
+	{
+		std::vector<glm::u8vec4> texels(TERRAIN_COLOR_TEXTURE_SIZE);
+
+		for (int i = 0; i < TERRAIN_COLOR_TEXTURE_SIZE; i++)
+		{
+			glm::vec3 color = getTerrainColor(colors, thresholds, blendThreshold, (float)i / (TERRAIN_COLOR_TEXTURE_SIZE - 1));
+			texels[i] = glm::u8vec4(glm::clamp(color, 0.0f, 1.0f) * 255.0f + .5f, 255);
+		}
+
+		glActiveTexture(GL_TEXTURE0 + unit);
+
+		if (mTexture == 0)
+		{
+			glGenTextures(1, &mTexture);
+			glBindTexture(GL_TEXTURE_1D, mTexture);
+
+			glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		}
+
+		glBindTexture(GL_TEXTURE_1D, mTexture);
+		glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, TERRAIN_COLOR_TEXTURE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+private:
+	GLuint mTexture = 0;
+};
@@ -0,0 +1,263 @@
+#pragma once
+#include "TerrainChunks.hpp"
+#include "EW/Shader.h"
+
+
+// Octahedral encoding, the normal is folded onto a diamond in xz and each coordinate is stored in 8 bits.
+// Off by a degree or two at most, which lighting can't show
+unsigned short packTerrainNormal(const glm::vec3& normal)
+{
+	glm::vec3 n = normal / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+	glm::vec2 p = glm::vec2(n.x, n.z);
+
+	// Lower half folds over the diagonals, terrain never faces down but this keeps it a proper encoding
+	if (n.y < 0)
+	{
+		p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0 ? 1 : -1, p.y >= 0 ? 1 : -1);
+	}
+
+	unsigned int x = (unsigned int)glm::round(glm::clamp(p.x * .5f + .5f, 0.0f, 1.0f) * 255);
+	unsigned int z = (unsigned int)glm::round(glm::clamp(p.y * .5f + .5f, 0.0f, 1.0f) * 255);
+
+	return (unsigned short)(x | (z << 8));
+}
+
+
+// Terrain drawn by vertex pulling. The whole grid is one storage buffer of 16-bit heights (plus a 16-bit packed normal
+// if packed normals are on), 2 or 4 bytes a vertex instead of a 32 byte Vertex. There are no vertex attributes, terrainShader.vert
+// works out x / z and uv from gl_VertexID and the chunk's origin and reads the height itself. Chunks share one index buffer
+// and get frustum culled like ChunkedTerrainMesh's
+class CompactTerrain
+{
+public:
+	CompactTerrain() {}
+
+	~CompactTerrain()
+	{
+		release();
+	}
+
+	// CPU half, doesn't touch OpenGL so it can run on another thread while the current terrain keeps drawing.
+	// Without packed normals the shader works them out from the neighboring heights instead
+	void prepare(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, bool packNormals, int chunkSize = DEFAULT_TERRAIN_CHUNK_SIZE)
+	{
+		int resolution = terrainInfo.resolution;
+		int rowVertices = resolution + 1;
+
+		float minHeight = terrainInfo.minHeight;
+		float maxHeight = terrainInfo.maxHeight;
+
+		float cellWidth = terrainInfo.width / resolution;
+		float cellLength = terrainInfo.length / resolution;
+
+		mPending.resolution = resolution;
+		mPending.minHeight = minHeight;
+		mPending.heightScale = (maxHeight - minHeight) / HEIGHT_MAP_MAX_VALUE;
+		mPending.shortsPerVertex = packNormals ? 2 : 1;
+
+		int shortsPerVertex = mPending.shortsPerVertex;
+
+		// Rounded up to whole 32-bit words, which is what the shader reads
+		size_t numShorts = (size_t)rowVertices * rowVertices * shortsPerVertex;
+		mPending.data.resize(numShorts + (numShorts & 1));
+		mPending.data.back() = 0;
+
+		unsigned short* data = mPending.data.data();
+		float quantizeScale = maxHeight > minHeight ? HEIGHT_MAP_MAX_VALUE / (maxHeight - minHeight) : 0;
+
+		HeightRowSampler sampler(heightMap, noiseInfo, resolution, minHeight, maxHeight);
+
+		getThreadPool().parallelFor(rowVertices, [&](int startRow, int endRow)
+		{
+			HeightRowCache rows(sampler);
+			std::vector<glm::vec3> normals(rowVertices);
+
+			for (int y = startRow; y < endRow; y++)
+			{
+				const float* heights = rows.getRow(y);
+
+				if (packNormals)
+				{
+					computeNormalRow(rows.getRow(y - 1), heights, rows.getRow(y + 1), rowVertices, cellWidth, cellLength, normals.data());
+				}
+
+				unsigned short* row = &data[(size_t)y * rowVertices * shortsPerVertex];
+
+				for (int x = 0; x <= resolution; x++)
+				{
+					float quantized = glm::clamp((heights[x] - minHeight) * quantizeScale + .5f, 0.0f, (float)HEIGHT_MAP_MAX_VALUE);
+					row[x * shortsPerVertex] = (unsigned short)quantized;
+
+					if (packNormals)
+					{
+						row[x * shortsPerVertex + 1] = packTerrainNormal(normals[x]);
+					}
+				}
+			}
+		});
+
+		// Same chunk layout and winding as the chunked terrain, all chunks draw the same local indices
+		int chunksPerSide;
+		chunkSize = getTerrainChunkSize(resolution, chunkSize, chunksPerSide);
+
+		mPending.chunkSize = chunkSize;
+
+		MeshData chunkGrid;
+		generateGridIndices(chunkSize, chunkGrid);
+		mPending.indices.swap(chunkGrid.indices);
+
+		// Bounds come from the quantized heights, which are exactly what gets drawn
+		mPending.chunks.resize((size_t)chunksPerSide * chunksPerSide);
+		std::vector<CompactChunk>& chunks = mPending.chunks;
+
+		getThreadPool().parallelFor((int)chunks.size(), [&](int startChunk, int endChunk)
+		{
+			for (int chunkIndex = startChunk; chunkIndex < endChunk; chunkIndex++)
+			{
+				int startX = (chunkIndex % chunksPerSide) * chunkSize;
+				int startY = (chunkIndex / chunksPerSide) * chunkSize;
+
+				int endX = glm::min(startX + chunkSize, resolution);
+				int endY = glm::min(startY + chunkSize, resolution);
+
+				unsigned short lowest = HEIGHT_MAP_MAX_VALUE;
+				unsigned short highest = 0;
+
+				for (int y = startY; y <= endY; y++)
+				{
+					const unsigned short* row = &data[(size_t)y * rowVertices * shortsPerVertex];
+
+					for (int x = startX; x <= endX; x++)
+					{
+						lowest = glm::min(lowest, row[x * shortsPerVertex]);
+						highest = glm::max(highest, row[x * shortsPerVertex]);
+					}
+				}
+
+				CompactChunk& chunk = chunks[chunkIndex];
+				chunk.origin = glm::ivec2(startX, startY);
+
+				chunk.boundsMin = glm::vec3(-terrainInfo.width / 2 + cellWidth * startX, minHeight + lowest * mPending.heightScale, -terrainInfo.length / 2 + cellLength * startY);
+				chunk.boundsMax = glm::vec3(-terrainInfo.width / 2 + cellWidth * endX, minHeight + highest * mPending.heightScale, -terrainInfo.length / 2 + cellLength * endY);
+			}
+		});
+	}
+
+	// GL half, the old buffers are replaced only now so they keep drawing until the new ones are ready
+	void upload()
+	{
+		if (mVAO == 0)
+		{
+			// Nothing is read through it, but core profile won't draw without one
+			glGenVertexArrays(1, &mVAO);
+			glGenBuffers(1, &mSSBO);
+			glGenBuffers(1, &mEBO);
+		}
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, mPending.data.size() * sizeof(unsigned short), mPending.data.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glBindVertexArray(mVAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, mPending.indices.size() * sizeof(unsigned int), mPending.indices.data(), GL_STATIC_DRAW);
+		glBindVertexArray(0);
+
+		mNumIndices = (GLsizei)mPending.indices.size();
+		mDataBytes = mPending.data.size() * sizeof(unsigned short);
+
+		// Only the layout and chunks are needed for drawing, the data lives on the GPU now
+		mDrawn = std::move(mPending);
+		mDrawn.data = std::vector<unsigned short>();
+		mDrawn.indices = std::vector<unsigned int>();
+
+		mPending = CompactData();
+	}
+
+	// Frustum has to be in the terrain's local space (projection * view * model), returns how many chunks were drawn
+	int draw(Shader& shader, const Frustum& frustum)
+	{
+		if (mVAO == 0) return 0;
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMPACT_TERRAIN_BINDING, mSSBO);
+
+		shader.setInt("_TerrainResolution", mDrawn.resolution);
+		shader.setInt("_CompactShortsPerVertex", mDrawn.shortsPerVertex);
+		shader.setFloat("_CompactMinHeight", mDrawn.minHeight);
+		shader.setFloat("_CompactHeightScale", mDrawn.heightScale);
+		shader.setInt("_ChunkRowVertices", mDrawn.chunkSize + 1);
+
+		glBindVertexArray(mVAO);
+
+		int numDrawn = 0;
+
+		for (const CompactChunk& chunk : mDrawn.chunks)
+		{
+			if (!isBoxInFrustum(frustum, chunk.boundsMin, chunk.boundsMax)) continue;
+
+			shader.setVec2("_ChunkOrigin", glm::vec2(chunk.origin));
+			glDrawElements(GL_TRIANGLES, mNumIndices, GL_UNSIGNED_INT, 0);
+			numDrawn++;
+		}
+
+		glBindVertexArray(0);
+
+		return numDrawn;
+	}
+
+	void release()
+	{
+		if (mVAO == 0) return;
+
+		glDeleteVertexArrays(1, &mVAO);
+		glDeleteBuffers(1, &mSSBO);
+		glDeleteBuffers(1, &mEBO);
+
+		mVAO = mSSBO = mEBO = 0;
+		mNumIndices = 0;
+		mDataBytes = 0;
+	}
+
+	// What the same grid costs on the GPU in this format against a single shared-vertex mesh
+	size_t getGPUBytes() const { return mDataBytes + mNumIndices * sizeof(unsigned int); }
+	size_t getMeshGPUBytes() const
+	{
+		size_t rowVertices = (size_t)mDrawn.resolution + 1;
+		return rowVertices * rowVertices * sizeof(Vertex) + 6 * (size_t)mDrawn.resolution * mDrawn.resolution * sizeof(unsigned int);
+	}
+
+	int getNumChunks() const { return (int)mDrawn.chunks.size(); }
+
+	static const GLuint COMPACT_TERRAIN_BINDING = 0; // Matches the binding of CompactTerrainVertices in terrainShader.vert
+
+private:
+	struct CompactChunk
+	{
+		glm::ivec2 origin; // Grid coordinate of the chunk's first vertex
+
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+	};
+
+	struct CompactData
+	{
+		int resolution = 0;
+		int chunkSize = 0;
+		int shortsPerVertex = 1;
+
+		// Stored height h means minHeight + h * heightScale
+		float minHeight = 0;
+		float heightScale = 0;
+
+		std::vector<unsigned short> data;
+		std::vector<unsigned int> indices; // One chunk's worth
+		std::vector<CompactChunk> chunks;
+	};
+
+	CompactData mPending;
+	CompactData mDrawn;
+
+	GLuint mVAO = 0, mSSBO = 0, mEBO = 0;
+	GLsizei mNumIndices = 0;
+	size_t mDataBytes = 0;
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include "TerrainGeneration.hpp"
+#include "EW/Shader.h"
+
+
+// Flat grid that terrainShader.vert pushes up by sampling the heightmap as a texture. The grid is only rebuilt
+// when its shape changes, redistribution and min / max height are uniforms, so changing them costs nothing
+class DisplacedTerrain
+{
+public:
+	DisplacedTerrain() {}
+
+	~DisplacedTerrain()
+	{
+		if (mHeightmapTexture != 0)
+		{
+			glDeleteTextures(1, &mHeightmapTexture);
+		}
+	}
+
+	// CPU half, builds a new grid only if resolution, width or length changed. Doesn't touch OpenGL so it
+	// can run on another thread while the current grid keeps drawing
+	void prepare(const TerrainInfo& terrainInfo, const std::shared_ptr<const Image>& heightMap)
+	{
+		mPendingHeightmap = heightMap;
+
+		if (terrainInfo.resolution == mResolution && terrainInfo.width == mWidth && terrainInfo.length == mLength) return;
+
+		mResolution = terrainInfo.resolution;
+		mWidth = terrainInfo.width;
+		mLength = terrainInfo.length;
+
+		generateFlatTerrainGrid(terrainInfo, mPendingGrid);
+		mGridChanged = true;
+	}
+
+	// GL half, returns whether the grid had to be rebuilt
+	bool upload()
+	{
+		bool gridChanged = mGridChanged;
+
+		if (mGridChanged)
+		{
+			mGrid.initialize(&mPendingGrid);
+			mDrawResolution = mResolution;
+
+			mPendingGrid = MeshData();
+			mGridChanged = false;
+		}
+
+		// Same cached image as last time means the texture is already up to date
+		if (mPendingHeightmap && mPendingHeightmap != mUploadedHeightmap)
+		{
+			setHeightmap(*mPendingHeightmap);
+			mUploadedHeightmap = mPendingHeightmap;
+		}
+
+		mPendingHeightmap = nullptr;
+
+		return gridChanged;
+	}
+
+	// Min and max height come from _LocalMinHeight and _LocalMaxHeight, which the terrain shader already has
+	void draw(Shader& shader, float redistribution)
+	{
+		if (mDrawResolution < 0 || mHeightmapTexture == 0) return;
+
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, mHeightmapTexture);
+		glActiveTexture(GL_TEXTURE0);
+
+		shader.setInt("_HeightmapTexture", 3);
+		shader.setInt("_TerrainResolution", mDrawResolution);
+		shader.setFloat("_Redistribution", redistribution);
+
+		mGrid.draw();
+	}
+
+private:
+	// Uploads the (already blurred) heightmap
+	void setHeightmap(const Image& heightMap)
+	{
+		// On the unit draw samples it from, so the terrain texture on unit 0 isn't replaced
+		glActiveTexture(GL_TEXTURE3);
+
+		if (mHeightmapTexture == 0)
+		{
+			glGenTextures(1, &mHeightmapTexture);
+		}
+
+		glBindTexture(GL_TEXTURE_2D, mHeightmapTexture);
+
+		// 16-bit so the shader sees the same 65536 levels getHeight does, texelFetch still returns 0 to 1
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, heightMap.width(), heightMap.height(), 0, GL_RED, GL_UNSIGNED_SHORT, heightMap.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		// Sampled with texelFetch to match getHeight, so no filtering
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	Mesh mGrid;
+	int mDrawResolution = -1; // Resolution of the uploaded grid
+
+	// Shape of the last grid prepare built
+	int mResolution = -1;
+	float mWidth = 0;
+	float mLength = 0;
+
+	MeshData mPendingGrid;
+	bool mGridChanged = false;
+	std::shared_ptr<const Image> mPendingHeightmap;
+	std::shared_ptr<const Image> mUploadedHeightmap;
+
+	GLuint mHeightmapTexture = 0;
+};
@@ -1,14 +1,26 @@
 #pragma once
 #include "EW/Mesh.h"
 #include "SimplexNoise.h"
-#include "CImg-v.3.2.3/CImg.h"
+#include "ThreadPool.hpp"
+#include "HeightMapCache.hpp"
 #include <iostream>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <random>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TERRAIN_NORMALS_SSE
+#include <emmintrin.h>
+#endif
 
 using namespace ew;
 using namespace cimg_library;
 
-typedef CImg<unsigned char> Image;
-
 
 struct TerrainInfo
 {
@@ -20,50 +32,502 @@ struct TerrainInfo
 	float minHeight;
 	float maxHeight;
 
+	bool sharedVertices; // Grid vertices are shared between neighboring quads and reused through the index buffer
+
+
+	TerrainInfo(int _resolution, float _width, float _length, float _minHeight, float _maxHeight, bool _sharedVertices = true) :
+		resolution(_resolution), width(_width), length(_length), minHeight(_minHeight), maxHeight(_maxHeight), sharedVertices(_sharedVertices) {}
+};
+
+
+// Settings for SimplexNoise::fractal, used instead of the heightmap file when enabled
+struct ProceduralInfo
+{
+	bool enabled;
+
+	int seed;
+	int octaves;
+	float frequency; // Noise features across the whole terrain for the first octave
+	float persistence; // How much each octave's amplitude shrinks
 
-	TerrainInfo(int _resolution, float _width, float _length, float _minHeight, float _maxHeight) :
-		resolution(_resolution), width(_width), length(_length), minHeight(_minHeight), maxHeight(_maxHeight) {}
+	ProceduralInfo(bool _enabled = false, int _seed = 0, int _octaves = 6, float _frequency = 4, float _persistence = .5f) :
+		enabled(_enabled), seed(_seed), octaves(_octaves), frequency(_frequency), persistence(_persistence) {}
 };
 
 
 struct NoiseInfo
 {
-	std::string path;
+	HeightMapSource source;
+	ProceduralInfo procedural;
 	
 	float blur;
 	float redistribution; // To make flat valleys, we can raise the elevation to a power
 
-	NoiseInfo(std::string _path, float _blur, float _redistribution) :
-		path(_path), blur(_blur), redistribution(_redistribution) {}
+	ErosionInfo erosion; // Runs on the heightmap after the blur
+
+	NoiseInfo(HeightMapSource _source, float _blur, float _redistribution, ProceduralInfo _procedural = ProceduralInfo(), ErosionInfo _erosion = ErosionInfo()) :
+		source(_source), procedural(_procedural), blur(_blur), redistribution(_redistribution), erosion(_erosion) {}
 };
 
 
+// Pixel a uv between 0 and 1 lands on, clamped so uv of 1 (far edge of the terrain) still lands on the last pixel
+int getHeightMapPixel(float uv, int size)
+{
+	return glm::min((int)(uv * size), size - 1);
+}
+
+
+// Height for a 16-bit heightmap value
+float getRedistributedHeight(int value, float redistribution, float minHeight, float maxHeight)
+{
+	float portion = (float) value / (double) HEIGHT_MAP_MAX_VALUE; // Value between 0 and 1 representing height
+
+	portion = glm::pow(portion, redistribution); // Using redistribution to create steeper mountains
+
+	return (portion * (maxHeight - minHeight)) + minHeight;
+}
+
+
 float getHeight(const Image& heightMap, const NoiseInfo& noiseInfo, float uvX, float uvY, float minHeight, float maxHeight)
 {
-	int rValue = heightMap((int)(uvX * heightMap.width()), (int)(uvY * heightMap.height()), 0); // Red component at uv
+	int pixelX = getHeightMapPixel(uvX, heightMap.width());
+	int pixelY = getHeightMapPixel(uvY, heightMap.height());
+
+	int rValue = heightMap(pixelX, pixelY, 0); // Red component at uv
+
+	return getRedistributedHeight(rValue, noiseInfo.redistribution, minHeight, maxHeight); // Return height for this particular uv
+}
+
+
+// Heights for all 65536 heightmap values, so sampling is a table lookup instead of a pow
+struct HeightLUT
+{
+	float redistribution;
+	float minHeight;
+	float maxHeight;
+
+	std::vector<float> heights;
+
+	HeightLUT(float _redistribution, float _minHeight, float _maxHeight) :
+		redistribution(_redistribution), minHeight(_minHeight), maxHeight(_maxHeight), heights(HEIGHT_MAP_LEVELS)
+	{
+		for (int value = 0; value < HEIGHT_MAP_LEVELS; value++)
+		{
+			heights[value] = getRedistributedHeight(value, redistribution, minHeight, maxHeight);
+		}
+	}
+
+	bool matches(float _redistribution, float _minHeight, float _maxHeight) const
+	{
+		return _redistribution == redistribution && _minHeight == minHeight && _maxHeight == maxHeight;
+	}
+};
+
+
+// The table is 256KB, so there's one shared by every thread instead of one each. It's only rebuilt when
+// redistribution or min / max height actually change, samplers still using the old one keep it alive
+std::shared_ptr<const HeightLUT> getHeightLUT(const NoiseInfo& noiseInfo, float minHeight, float maxHeight)
+{
+	static std::mutex mutex;
+	static std::shared_ptr<const HeightLUT> heightLUT;
 
-	float portion = (float) rValue / 255.0; // Value between 0 and 1 representing height
+	std::lock_guard<std::mutex> lock(mutex);
 
-	portion = glm::pow(portion, noiseInfo.redistribution); // Using redistribution to create steeper mountains
+	if (!heightLUT || !heightLUT->matches(noiseInfo.redistribution, minHeight, maxHeight))
+	{
+		heightLUT = std::make_shared<const HeightLUT>(noiseInfo.redistribution, minHeight, maxHeight);
+	}
 
-	return (portion * (maxHeight - minHeight)) + minHeight; // Return height for this particular uv
+	return heightLUT;
 }
 
 
-// Resolution is how many double sets of triangles are in width and height
-void generateTerrainFromHeightmap(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, MeshData& meshData)
+// Samples the same grid getHeight does but a row at a time. Which pixel column every grid x lands on is worked out
+// once up front, and heights come from the LUT, so each height is two loads instead of a pow and two float to int
+// conversions. Matches getHeight exactly
+class HeightRowSampler
+{
+public:
+	HeightRowSampler(const Image& heightMap, const NoiseInfo& noiseInfo, int resolution, float minHeight, float maxHeight) :
+		mHeightMap(heightMap), mLUT(getHeightLUT(noiseInfo, minHeight, maxHeight)), mResolution(resolution)
+	{
+		mPixelColumns.resize(resolution + 1);
+
+		for (int x = 0; x <= resolution; x++)
+		{
+			mPixelColumns[x] = getHeightMapPixel((float) x / resolution, heightMap.width());
+		}
+
+		// Gathers read 4 bytes at each pixel, so the last column would read one pixel past the image on the last row
+		mGatherSafeEnd = resolution + 1;
+
+		while (mGatherSafeEnd > 0 && mPixelColumns[mGatherSafeEnd - 1] + 2 > heightMap.width())
+		{
+			mGatherSafeEnd--;
+		}
+	}
+
+	// Heights for grid x in [startX, startX + count) along grid row y
+	void sampleRow(int y, int startX, int count, float* heights) const
+	{
+		const unsigned short* row = mHeightMap.data(0, getHeightMapPixel((float) y / mResolution, mHeightMap.height()));
+		const int* columns = &mPixelColumns[startX];
+		const float* lut = mLUT->heights.data();
+
+		int i = 0;
+
+#ifdef __AVX2__
+		// 8 at a time, gather the pixels (4 bytes each, only the low 16 bits are kept) and then gather their heights
+		int gatherEnd = glm::min(count, mGatherSafeEnd - startX);
+		__m256i lowWord = _mm256_set1_epi32(0xFFFF);
+
+		for (; i + 8 <= gatherEnd; i += 8)
+		{
+			__m256i columnIndices = _mm256_loadu_si256((const __m256i*)&columns[i]);
+			__m256i values = _mm256_and_si256(_mm256_i32gather_epi32((const int*)row, columnIndices, 2), lowWord);
+
+			_mm256_storeu_ps(&heights[i], _mm256_i32gather_ps(lut, values, 4));
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			heights[i] = lut[row[columns[i]]];
+		}
+	}
+
+	int getResolution() const { return mResolution; }
+
+private:
+	const Image& mHeightMap;
+	std::shared_ptr<const HeightLUT> mLUT;
+	int mResolution;
+
+	std::vector<int> mPixelColumns;
+	int mGatherSafeEnd;
+};
+
+
+// Keeps the last few rows a sampler produced, so walking down the grid still samples each row about once even
+// though normals need the rows on either side too. Rows hold grid columns [startX, startX + count) and are clamped
+// onto the grid, so asking for row -1 gives row 0
+class HeightRowCache
+{
+public:
+	HeightRowCache(const HeightRowSampler& sampler, int startX = 0, int count = -1) :
+		mSampler(sampler), mStartX(startX), mCount(count < 0 ? sampler.getResolution() + 1 - startX : count)
+	{
+		for (int i = 0; i < NUM_ROWS; i++)
+		{
+			mRows[i].resize(mCount);
+			mRowIndices[i] = -1;
+		}
+	}
+
+	// Only the last NUM_ROWS different rows asked for stay valid
+	const float* getRow(int y)
+	{
+		y = glm::clamp(y, 0, mSampler.getResolution());
+
+		int slot = y % NUM_ROWS;
+
+		if (mRowIndices[slot] != y)
+		{
+			mSampler.sampleRow(y, mStartX, mCount, mRows[slot].data());
+			mRowIndices[slot] = y;
+		}
+
+		return mRows[slot].data();
+	}
+
+	int getStartX() const { return mStartX; }
+	int getCount() const { return mCount; }
+
+private:
+	static const int NUM_ROWS = 4; // Enough for an unshared row of quads, which needs rows y - 1 to y + 2
+
+	const HeightRowSampler& mSampler;
+	int mStartX;
+	int mCount;
+
+	std::vector<float> mRows[NUM_ROWS];
+	int mRowIndices[NUM_ROWS];
+};
+
+
+// Smooth normals for count vertices along a row from central differences of the heights around them, the same
+// way terrainShader.vert does it for LOD patches and displacement. above and below are the neighboring rows, and
+// the first and last vertex use themselves as their missing neighbor just like the grid's edges do
+void computeNormalRow(const float* above, const float* row, const float* below, int count, float cellWidth, float cellLength, glm::vec3* normals)
+{
+	float xScale = 1.0f / (2.0f * cellWidth);
+	float zScale = 1.0f / (2.0f * cellLength);
+
+	auto computeNormal = [&](int x)
+	{
+		float left = row[glm::max(x - 1, 0)];
+		float right = row[glm::min(x + 1, count - 1)];
+
+		float dx = (left - right) * xScale;
+		float dz = (above[x] - below[x]) * zScale;
+
+		float inverseLength = 1.0f / std::sqrt(dx * dx + 1.0f + dz * dz);
+
+		normals[x] = glm::vec3(dx * inverseLength, inverseLength, dz * inverseLength);
+	};
+
+	if (count <= 0) return;
+
+	computeNormal(0);
+
+	int x = 1;
+
+#ifdef TERRAIN_NORMALS_SSE
+	// 4 at a time through the middle of the row, where both horizontal neighbors exist. Same operations in the
+	// same order as computeNormal, so the results match it exactly
+	__m128 xScales = _mm_set1_ps(xScale);
+	__m128 zScales = _mm_set1_ps(zScale);
+	__m128 one = _mm_set1_ps(1.0f);
+
+	alignas(16) float normalX[4];
+	alignas(16) float normalY[4];
+	alignas(16) float normalZ[4];
+
+	for (; x + 4 < count; x += 4)
+	{
+		__m128 dx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&row[x - 1]), _mm_loadu_ps(&row[x + 1])), xScales);
+		__m128 dz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&above[x]), _mm_loadu_ps(&below[x])), zScales);
+
+		__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), one), _mm_mul_ps(dz, dz));
+		__m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+
+		_mm_store_ps(normalX, _mm_mul_ps(dx, inverseLength));
+		_mm_store_ps(normalY, inverseLength);
+		_mm_store_ps(normalZ, _mm_mul_ps(dz, inverseLength));
+
+		for (int i = 0; i < 4; i++)
+		{
+			normals[x + i] = glm::vec3(normalX[i], normalY[i], normalZ[i]);
+		}
+	}
+#endif
+
+	for (; x < count; x++)
+	{
+		computeNormal(x);
+	}
+}
+
+
+// Final terrain heights, one per grid vertex, row by row
+struct HeightField
+{
+	int resolution = 0; // Quads per side, so each row holds resolution + 1 heights
+	std::vector<float> heights;
+
+	int getRowSize() const { return resolution + 1; }
+
+	// Clamps onto the edge so neighbors of border vertices can be read without checks
+	float at(int x, int y) const
+	{
+		x = glm::clamp(x, 0, resolution);
+		y = glm::clamp(y, 0, resolution);
+		return heights[(size_t)y * getRowSize() + x];
+	}
+};
+
+
+void generateHeightField(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, HeightField& heightField)
 {
-	meshData.vertices.clear();
-	meshData.indices.clear();
+	int resolution = terrainInfo.resolution;
+	int rowSize = resolution + 1;
+
+	heightField.resolution = resolution;
+	heightField.heights.resize((size_t)rowSize * rowSize);
+
+	float* heights = heightField.heights.data();
+
+	HeightRowSampler sampler(heightMap, noiseInfo, resolution, terrainInfo.minHeight, terrainInfo.maxHeight);
+
+	getThreadPool().parallelFor(rowSize, [&](int startRow, int endRow)
+	{
+		for (int y = startRow; y < endRow; y++)
+		{
+			sampler.sampleRow(y, 0, rowSize, &heights[(size_t)y * rowSize]);
+		}
+	});
+}
+
+
+// Quads across each strip generateGridIndices walks. A row of the strip reuses the row of vertices before it, so both
+// rows have to fit in the post-transform cache (16 entries on older GPUs) for all but the new row to be cache hits
+const int GRID_STRIP_WIDTH = 6;
+
+
+// Writes two triangles for every quad of a shared (resolution + 1)^2 vertex grid, 6 * resolution^2 indices. Quads go
+// in strips GRID_STRIP_WIDTH wide, each strip top to bottom, so every vertex is transformed about once instead of
+// twice (once per row it touches) when whole rows are too long for the vertex cache
+void generateGridIndices(int resolution, unsigned int* indices, unsigned int maxThreads = 0)
+{
+	int rowVertices = resolution + 1;
+	int numStrips = (resolution + GRID_STRIP_WIDTH - 1) / GRID_STRIP_WIDTH;
+
+	getThreadPool().parallelFor(numStrips, [&](int startStrip, int endStrip)
+	{
+		for (int strip = startStrip; strip < endStrip; strip++)
+		{
+			int startX = strip * GRID_STRIP_WIDTH;
+			int endX = glm::min(startX + GRID_STRIP_WIDTH, resolution);
+
+			// Every strip before this one is full width
+			unsigned int* quad = &indices[(size_t)startX * resolution * 6];
+
+			for (int y = 0; y < resolution; y++)
+			{
+				for (int x = startX; x < endX; x++)
+				{
+					// Same winding as the unshared grid
+					/*
+					   1 ____ 2
+						|   /|
+						|  / |
+						| /  |
+						|/   |
+					   0 ---- 3
+					*/
+
+					unsigned int v0 = y * rowVertices + x;
+					unsigned int v1 = v0 + rowVertices;
+					unsigned int v2 = v1 + 1;
+					unsigned int v3 = v0 + 1;
+
+					// 0-1-2
+					quad[0] = v0;
+					quad[1] = v1;
+					quad[2] = v2;
+
+					// 0-2-3
+					quad[3] = v0;
+					quad[4] = v2;
+					quad[5] = v3;
+
+					quad += 6;
+				}
+			}
+		}
+	}, maxThreads);
+}
+
+
+void generateGridIndices(int resolution, MeshData& meshData, unsigned int maxThreads = 0)
+{
+	meshData.indices.resize(6 * (size_t)resolution * resolution); // * 6 for two triangles each unit
+	generateGridIndices(resolution, meshData.indices.data(), maxThreads);
+}
+
+
+// How many vertices and indices generateTerrainFromHeightmap makes, so they can be written somewhere sized up front
+void getTerrainMeshSize(const TerrainInfo& terrainInfo, size_t& numVertices, size_t& numIndices)
+{
+	size_t resolution = (size_t)terrainInfo.resolution;
+
+	numVertices = terrainInfo.sharedVertices ? (resolution + 1) * (resolution + 1) : 4 * resolution * resolution;
+	numIndices = 6 * resolution * resolution;
+}
+
 
+// Resolution is how many double sets of triangles are in width and height
+// Every grid point is one vertex, so (resolution + 1)^2 vertices are shared by the quads around them
+// Rows are independent, so they are split across the thread pool (maxThreads of 0 uses every thread)
+// Every vertex and index is written once and never read back, so they can point straight into a mapped GPU buffer
+void generateSharedTerrainFromHeightmap(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, Vertex* vertices, unsigned int* indices, unsigned int maxThreads = 0)
+{
 	int resolution = terrainInfo.resolution;
 	float width = terrainInfo.width;
 	float length = terrainInfo.length;
 	float minHeight = terrainInfo.minHeight;
 	float maxHeight = terrainInfo.maxHeight;
 
-	int numVertices = 4 * resolution * resolution; // * 4 for two triangles each unit
-	int numIndeces = 6 * resolution * resolution; // * 6 for two sets of vertices each unit
+	int rowVertices = resolution + 1;
+
+	float halfWidth = width / 2.0f;
+	float halfHeight = length / 2.0f;
+
+	float triangleWidth = width / resolution;
+	float triangleHeight = length / resolution;
+
+	HeightRowSampler sampler(heightMap, noiseInfo, resolution, minHeight, maxHeight);
+
+	// Each height is sampled once, plus the row on either side of every thread's block for normals
+	getThreadPool().parallelFor(rowVertices, [&](int startRow, int endRow)
+	{
+		HeightRowCache rows(sampler);
+		std::vector<glm::vec3> normals(rowVertices);
+
+		for (int y = startRow; y < endRow; y++)
+		{
+			Vertex* row = &vertices[(size_t)y * rowVertices];
+
+			const float* heights = rows.getRow(y);
+			computeNormalRow(rows.getRow(y - 1), heights, rows.getRow(y + 1), rowVertices, triangleWidth, triangleHeight, normals.data());
+
+			for (int x = 0; x <= resolution; x++)
+			{
+				float height = heights[x];
+
+				row[x].position = glm::vec3(-halfWidth + (triangleWidth * x), height, -halfHeight + (triangleHeight * y));
+				row[x].normal = normals[x];
+				row[x].uv = glm::vec2(x, y); // Texture repeats, so whole numbers tile it once per quad like the unshared grid
+			}
+		}
+	}, maxThreads);
+
+	generateGridIndices(resolution, indices, maxThreads);
+}
+
+
+// Same grid as generateSharedTerrainFromHeightmap but every height is 0, for heights that get applied on the GPU
+void generateFlatTerrainGrid(const TerrainInfo& terrainInfo, MeshData& meshData)
+{
+	int resolution = terrainInfo.resolution;
+	int rowVertices = resolution + 1;
+
+	float halfWidth = terrainInfo.width / 2.0f;
+	float halfHeight = terrainInfo.length / 2.0f;
+
+	float triangleWidth = terrainInfo.width / resolution;
+	float triangleHeight = terrainInfo.length / resolution;
+
+	meshData.vertices.resize((size_t)rowVertices * rowVertices);
+
+	Vertex* vertices = meshData.vertices.data();
+
+	getThreadPool().parallelFor(rowVertices, [&](int startRow, int endRow)
+	{
+		for (int y = startRow; y < endRow; y++)
+		{
+			Vertex* row = &vertices[(size_t)y * rowVertices];
+
+			for (int x = 0; x <= resolution; x++)
+			{
+				row[x] = Vertex(glm::vec3(-halfWidth + (triangleWidth * x), 0, -halfHeight + (triangleHeight * y)), glm::vec3(0, 1, 0), glm::vec2(x, y));
+			}
+		}
+	});
+
+	generateGridIndices(resolution, meshData);
+}
+
+
+// Resolution is how many double sets of triangles are in width and height
+// Every quad gets its own 4 vertices. Like the shared version, nothing written is read back
+void generateUnsharedTerrainFromHeightmap(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, Vertex* vertices, unsigned int* indices, unsigned int maxThreads = 0)
+{
+	int resolution = terrainInfo.resolution;
+	float width = terrainInfo.width;
+	float length = terrainInfo.length;
+	float minHeight = terrainInfo.minHeight;
+	float maxHeight = terrainInfo.maxHeight;
 
 	float halfWidth = width / 2.0f;
 	float halfHeight = length / 2.0f;
@@ -71,93 +535,387 @@ void generateTerrainFromHeightmap(const TerrainInfo& terrainInfo, const NoiseInf
 	float triangleWidth = width / resolution;
 	float triangleHeight = length / resolution;
 
-	Vertex* vertices = new Vertex[numVertices];
-	unsigned int* indices = new unsigned int[numIndeces];
+	HeightRowSampler sampler(heightMap, noiseInfo, resolution, minHeight, maxHeight);
+
+	getThreadPool().parallelFor(resolution, [&](int startRow, int endRow)
+	{
+		HeightRowCache rows(sampler);
+
+		// Normals along this row of quads' bottom and top edges, the corners of neighboring quads share them so it's still smooth
+		std::vector<glm::vec3> normals(resolution + 1);
+		std::vector<glm::vec3> nextNormals(resolution + 1);
+
+		for (int y = startRow; y < endRow; y++)
+		{
+			const float* heights = rows.getRow(y);
+			const float* nextHeights = rows.getRow(y + 1);
+
+			// The last row's top edge is this row's bottom edge
+			if (y == startRow)
+			{
+				computeNormalRow(rows.getRow(y - 1), heights, nextHeights, resolution + 1, triangleWidth, triangleHeight, normals.data());
+			}
+			else
+			{
+				std::swap(normals, nextNormals);
+			}
+
+			computeNormalRow(heights, nextHeights, rows.getRow(y + 2), resolution + 1, triangleWidth, triangleHeight, nextNormals.data());
+
+			int yVertOffset = y * resolution * 4; // How much needs to be added from y when indexing vertices 
+			// to make it line up properly with vertices array
+
+			int yIndexOffset = y * resolution * 6;
+
+			for (int x = 0; x < resolution; x++)
+			{
+				// Needs to go clockwise
+				/*
+				   1 ____ 2
+					|   /|
+					|  / |
+					| /  |
+					|/   |
+				   0 ---- 3
+				*/
+
+
+				int vertOffset = yVertOffset + (x * 4);
+				int indexOffset = yIndexOffset + (x * 6);
+
+				// 0,1,2,3
+				float height = heights[x];
+				vertices[vertOffset + 0].position = glm::vec3(-halfWidth + (triangleWidth * x), height, -halfHeight + (triangleHeight * y));
+
+				height = nextHeights[x];
+				vertices[vertOffset + 1].position = glm::vec3(-halfWidth + (triangleWidth * x), height, -halfHeight + (triangleHeight * (y + 1)));
+
+				height = nextHeights[x + 1];
+				vertices[vertOffset + 2].position = glm::vec3(-halfWidth + (triangleWidth * (x + 1)), height, -halfHeight + (triangleHeight * (y + 1)));
+
+				height = heights[x + 1];
+				vertices[vertOffset + 3].position = glm::vec3(-halfWidth + (triangleWidth * (x + 1)), height, -halfHeight + (triangleHeight * y));
+
+				vertices[vertOffset + 0].normal = normals[x];
+				vertices[vertOffset + 1].normal = nextNormals[x];
+				vertices[vertOffset + 2].normal = nextNormals[x + 1];
+				vertices[vertOffset + 3].normal = normals[x + 1];
+
+				/*if (height > maxHeight * .8 || height < maxHeight * .2)
+				{
+					std::cout << height << std::endl;
+				}*/
+
+				// Debug
+				vertices[vertOffset + 0].uv = glm::vec2(0, 0);
+				vertices[vertOffset + 1].uv = glm::vec2(0, 1);
+				vertices[vertOffset + 2].uv = glm::vec2(1, 1);
+				vertices[vertOffset + 3].uv = glm::vec2(1, 0);
+
+				// 0-1-2
+				indices[indexOffset + 0] = vertOffset + 0;
+				indices[indexOffset + 1] = vertOffset + 1;
+				indices[indexOffset + 2] = vertOffset + 2;
+
+				// 0-2-3
+				indices[indexOffset + 3] = vertOffset + 0;
+				indices[indexOffset + 4] = vertOffset + 2;
+				indices[indexOffset + 5] = vertOffset + 3;
+			}
+		}
+	}, maxThreads);
+}
+
+
+// Writes getTerrainMeshSize's worth of vertices and indices, which can be a mapped GPU buffer
+void generateTerrainFromHeightmap(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, Vertex* vertices, unsigned int* indices, unsigned int maxThreads = 0)
+{
+	if (terrainInfo.sharedVertices)
+	{
+		generateSharedTerrainFromHeightmap(terrainInfo, noiseInfo, heightMap, vertices, indices, maxThreads);
+	}
+	else
+	{
+		generateUnsharedTerrainFromHeightmap(terrainInfo, noiseInfo, heightMap, vertices, indices, maxThreads);
+	}
+}
+
+
+void generateTerrainFromHeightmap(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, MeshData& meshData, unsigned int maxThreads = 0)
+{
+	size_t numVertices, numIndices;
+	getTerrainMeshSize(terrainInfo, numVertices, numIndices);
+
+	meshData.vertices.resize(numVertices);
+	meshData.indices.resize(numIndices);
+
+	generateTerrainFromHeightmap(terrainInfo, noiseInfo, heightMap, meshData.vertices.data(), meshData.indices.data(), maxThreads);
+}
+
+
+// Vertices [first, first + count) of a mesh
+struct VertexRange
+{
+	size_t first = 0;
+	size_t count = 0;
+};
+
+
+// Rewrites the heights and normals of a mesh that generateTerrainFromHeightmap already built with the same resolution, width,
+// length and vertex sharing, x / z, uvs and indices are left alone
+// Returns the smallest range of vertices holding everything that actually changed, so only that part has to be uploaded
+VertexRange updateTerrainHeights(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap, MeshData& meshData, unsigned int maxThreads = 0)
+{
+	int resolution = terrainInfo.resolution;
+	float minHeight = terrainInfo.minHeight;
+	float maxHeight = terrainInfo.maxHeight;
+
+	// Shared grids are (resolution + 1) rows of (resolution + 1) vertices, unshared ones are resolution rows of 4 per quad
+	int numRows = terrainInfo.sharedVertices ? resolution + 1 : resolution;
+	size_t rowSize = terrainInfo.sharedVertices ? (size_t)resolution + 1 : (size_t)resolution * 4;
+
+	VertexRange changed;
 
-	for (int y = 0; y < resolution - 1; y++)
+	if (meshData.vertices.size() != numRows * rowSize) return changed;
+
+	Vertex* vertices = meshData.vertices.data();
+
+	// First and last changed vertex of every row, -1 if nothing in the row moved
+	std::vector<long long> rowFirst(numRows, -1);
+	std::vector<long long> rowLast(numRows, -1);
+
+	float cellWidth = terrainInfo.width / resolution;
+	float cellLength = terrainInfo.length / resolution;
+
+	HeightRowSampler sampler(heightMap, noiseInfo, resolution, minHeight, maxHeight);
+
+	auto setHeight = [&](Vertex& vertex, size_t index, int row, float height, const glm::vec3& normal)
 	{
-		int yVertOffset = y * resolution * 4; // How much needs to be added from y when indexing vertices 
-		// to make it line up properly with vertices array
+		if (vertex.position.y == height && vertex.normal == normal) return;
 
-		int yIndexOffset = y * resolution * 6;
+		vertex.position.y = height;
+		vertex.normal = normal;
 
-		for (int x = 0; x < resolution - 1; x++)
+		if (rowFirst[row] < 0)
 		{
-			// Needs to go clockwise
-			/*
-			   1 ____ 2
-				|   /|
-				|  / |
-				| /  |
-				|/   |
-			   0 ---- 3
-			*/
+			rowFirst[row] = (long long)index;
+		}
+
+		rowLast[row] = (long long)index;
+	};
+
+	getThreadPool().parallelFor(numRows, [&](int startRow, int endRow)
+	{
+		HeightRowCache rows(sampler);
+
+		std::vector<glm::vec3> normals(resolution + 1);
+		std::vector<glm::vec3> nextNormals(resolution + 1);
 
+		for (int y = startRow; y < endRow; y++)
+		{
+			size_t rowStart = y * rowSize;
+
+			const float* heights = rows.getRow(y);
+			computeNormalRow(rows.getRow(y - 1), heights, rows.getRow(y + 1), resolution + 1, cellWidth, cellLength, normals.data());
+
+			if (terrainInfo.sharedVertices)
+			{
+				for (int x = 0; x <= resolution; x++)
+				{
+					setHeight(vertices[rowStart + x], rowStart + x, y, heights[x], normals[x]);
+				}
+			}
+			else
+			{
+				const float* nextHeights = rows.getRow(y + 1);
+				computeNormalRow(heights, nextHeights, rows.getRow(y + 2), resolution + 1, cellWidth, cellLength, nextNormals.data());
+
+				// Same corner order as generateUnsharedTerrainFromHeightmap
+				for (int x = 0; x < resolution; x++)
+				{
+					size_t vertOffset = rowStart + (size_t)x * 4;
+
+					setHeight(vertices[vertOffset + 0], vertOffset + 0, y, heights[x], normals[x]);
+					setHeight(vertices[vertOffset + 1], vertOffset + 1, y, nextHeights[x], nextNormals[x]);
+					setHeight(vertices[vertOffset + 2], vertOffset + 2, y, nextHeights[x + 1], nextNormals[x + 1]);
+					setHeight(vertices[vertOffset + 3], vertOffset + 3, y, heights[x + 1], normals[x + 1]);
+				}
+			}
+		}
+	}, maxThreads);
+
+	long long first = -1;
+	long long last = -1;
+
+	for (int row = 0; row < numRows; row++)
+	{
+		if (rowFirst[row] < 0) continue;
+
+		if (first < 0)
+		{
+			first = rowFirst[row];
+		}
+
+		last = rowLast[row];
+	}
+
+	if (first >= 0)
+	{
+		changed.first = (size_t)first;
+		changed.count = (size_t)(last - first + 1);
+	}
+
+	return changed;
+}
 
-			glm::vec2 heightMapUV = glm::vec2((float) x / resolution, (float) y / resolution);
 
-			glm::vec2 nextHeightMapUV = glm::vec2((float) (x + 1) / resolution, (float) (y + 1) / resolution);
-			int nextRValue = heightMap((int)(nextHeightMapUV.x * heightMap.width()), (int)(nextHeightMapUV.y * heightMap.height()), 0); // Red component at uv
+// Times generation with 1 to N threads and checks every result matches the single threaded one
+void benchmarkTerrainGeneration(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap)
+{
+	unsigned int maxThreads = getThreadPool().getNumThreads();
 
-			int vertOffset = yVertOffset + (x * 4);
-			int indexOffset = yIndexOffset + (x * 6);
+	MeshData serialMeshData;
+	MeshData meshData;
 
-			// 0,1,2,3
-			float height = getHeight(heightMap, noiseInfo, heightMapUV.x, heightMapUV.y, minHeight, maxHeight);
-			vertices[vertOffset + 0].position = glm::vec3(-halfWidth + (triangleWidth * x), height, -halfHeight + (triangleHeight * y));
+	double serialTime = 0;
 
-			height = getHeight(heightMap, noiseInfo, heightMapUV.x, nextHeightMapUV.y, minHeight, maxHeight);
-			vertices[vertOffset + 1].position = glm::vec3(-halfWidth + (triangleWidth * x), height, -halfHeight + (triangleHeight * (y + 1)));
+	// Height evaluation alone, getHeight for every vertex against the row sampler the generators use
+	{
+		int resolution = terrainInfo.resolution;
+		int rowSize = resolution + 1;
 
-			height = getHeight(heightMap, noiseInfo, nextHeightMapUV.x, nextHeightMapUV.y, minHeight, maxHeight);
-			vertices[vertOffset + 2].position = glm::vec3(-halfWidth + (triangleWidth * (x + 1)), height, -halfHeight + (triangleHeight * (y + 1)));
+		std::vector<float> slowHeights((size_t)rowSize * rowSize);
+		std::vector<float> fastHeights(slowHeights.size());
 
-			height = getHeight(heightMap, noiseInfo, nextHeightMapUV.x, heightMapUV.y, minHeight, maxHeight);
-			vertices[vertOffset + 3].position = glm::vec3(-halfWidth + (triangleWidth * (x + 1)), height, -halfHeight + (triangleHeight * y));
+		auto start = std::chrono::high_resolution_clock::now();
 
-			/*if (height > maxHeight * .8 || height < maxHeight * .2)
+		for (int y = 0; y <= resolution; y++)
+		{
+			for (int x = 0; x <= resolution; x++)
 			{
-				std::cout << height << std::endl;
-			}*/
+				slowHeights[(size_t)y * rowSize + x] = getHeight(heightMap, noiseInfo, (float) x / resolution, (float) y / resolution, terrainInfo.minHeight, terrainInfo.maxHeight);
+			}
+		}
 
-			// Debug
-			vertices[vertOffset + 0].uv = glm::vec2(0, 0);
-			vertices[vertOffset + 1].uv = glm::vec2(0, 1);
-			vertices[vertOffset + 2].uv = glm::vec2(1, 1);
-			vertices[vertOffset + 3].uv = glm::vec2(1, 0);
+		auto middle = std::chrono::high_resolution_clock::now();
 
-			// 0-1-2
-			indices[indexOffset + 0] = vertOffset + 0;
-			indices[indexOffset + 1] = vertOffset + 1;
-			indices[indexOffset + 2] = vertOffset + 2;
+		HeightRowSampler sampler(heightMap, noiseInfo, resolution, terrainInfo.minHeight, terrainInfo.maxHeight);
 
-			// 0-2-3
-			indices[indexOffset + 3] = vertOffset + 0;
-			indices[indexOffset + 4] = vertOffset + 2;
-			indices[indexOffset + 5] = vertOffset + 3;
+		for (int y = 0; y <= resolution; y++)
+		{
+			sampler.sampleRow(y, 0, rowSize, &fastHeights[(size_t)y * rowSize]);
 		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double slowTime = std::chrono::duration<double, std::milli>(middle - start).count();
+		double fastTime = std::chrono::duration<double, std::milli>(end - middle).count();
+
+		std::cout << "Height sampling, 1 thread: getHeight " << slowTime << "ms, row sampler " << fastTime << "ms, " << slowTime / fastTime << "x" <<
+			(slowHeights == fastHeights ? "" : " (DOES NOT MATCH)") << std::endl;
 	}
 
-	// Load meshData
-	meshData.vertices.assign(&vertices[0], &vertices[numVertices]);
-	meshData.indices.assign(&indices[0], &indices[numIndeces]);
+	std::cout << "Terrain generation scaling, resolution " << terrainInfo.resolution << std::endl;
+
+	// Untimed run first so every timed run reuses already allocated memory
+	generateTerrainFromHeightmap(terrainInfo, noiseInfo, heightMap, serialMeshData);
+	meshData = serialMeshData;
+
+	for (unsigned int numThreads = 1; numThreads <= maxThreads; numThreads++)
+	{
+		MeshData& target = numThreads == 1 ? serialMeshData : meshData;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		generateTerrainFromHeightmap(terrainInfo, noiseInfo, heightMap, target, numThreads);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double time = std::chrono::duration<double, std::milli>(end - start).count();
+
+		if (numThreads == 1)
+		{
+			serialTime = time;
+		}
+
+		bool identical = numThreads == 1 ||
+			(target.vertices.size() == serialMeshData.vertices.size() && target.indices == serialMeshData.indices &&
+			memcmp(target.vertices.data(), serialMeshData.vertices.data(), target.vertices.size() * sizeof(Vertex)) == 0);
+
+		std::cout << numThreads << " threads: " << time << "ms, " << serialTime / time << "x" << (identical ? "" : " (DOES NOT MATCH SERIAL)") << std::endl;
+	}
 }
 
 
-Image readHeightMap(const NoiseInfo& noiseInfo)
+const int PROCEDURAL_TILE_SIZE = 64;
+
+
+// Evaluates SimplexNoise::fractal into a size x size heightmap, in tiles split across the thread pool. The noise has
+// no seed of its own, so the seed just moves where in the (endless) noise the terrain is cut out from
+Image generateProceduralHeightMap(const ProceduralInfo& proceduralInfo, int size, unsigned int maxThreads = 0)
 {
-	Image heightMapImage(noiseInfo.path.c_str());
+	Image heightMap(size, size, 1, 1);
+	unsigned short* pixels = heightMap.data();
+
+	SimplexNoise noise(proceduralInfo.frequency, 1, 2, proceduralInfo.persistence);
+	size_t octaves = (size_t)glm::max(proceduralInfo.octaves, 1);
+
+	// Kept under a few thousand so the coordinates don't lose float precision
+	std::minstd_rand random((unsigned int)proceduralInfo.seed + 1);
+	float offsetX = (random() % 100000) / 100.0f;
+	float offsetY = (random() % 100000) / 100.0f;
+
+	int tilesPerRow = (size + PROCEDURAL_TILE_SIZE - 1) / PROCEDURAL_TILE_SIZE;
+	float pixelToUV = size > 1 ? 1.0f / (size - 1) : 0;
+
+	getThreadPool().parallelFor(tilesPerRow * tilesPerRow, [&](int startTile, int endTile)
+	{
+		for (int tile = startTile; tile < endTile; tile++)
+		{
+			int startX = (tile % tilesPerRow) * PROCEDURAL_TILE_SIZE;
+			int startY = (tile / tilesPerRow) * PROCEDURAL_TILE_SIZE;
+
+			int endX = glm::min(startX + PROCEDURAL_TILE_SIZE, size);
+			int endY = glm::min(startY + PROCEDURAL_TILE_SIZE, size);
+
+			for (int y = startY; y < endY; y++)
+			{
+				unsigned short* row = &pixels[(size_t)y * size];
 
-	heightMapImage.blur(noiseInfo.blur);
+				for (int x = startX; x < endX; x++)
+				{
+					float value = noise.fractal(octaves, x * pixelToUV + offsetX, y * pixelToUV + offsetY); // Roughly -1 to 1
 
-	//heightMapImage.display();
+					float portion = glm::clamp(value * .5f + .5f, 0.0f, 1.0f);
+					row[x] = (unsigned short)(portion * HEIGHT_MAP_MAX_VALUE + .5f);
+				}
+			}
+		}
+	}, maxThreads);
+
+	return heightMap;
+}
+
+
+// Decoded, blurred and eroded images come from the heightmap cache, so only the first read of a path, blur and erosion
+// touches the file. Procedural heightmaps get one pixel per grid vertex, so every vertex is its own noise sample.
+// onStep follows the erosion when it has to run (see erodeHeightMap)
+std::shared_ptr<const Image> readHeightMap(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo,
+	const std::function<void(const HeightMapErosion&)>& onStep = nullptr)
+{
+	if (noiseInfo.procedural.enabled)
+	{
+		std::shared_ptr<Image> heightMap = std::make_shared<Image>(generateProceduralHeightMap(noiseInfo.procedural, terrainInfo.resolution + 1));
+		blurHeightMap(*heightMap, noiseInfo.blur);
+		erodeHeightMap(*heightMap, noiseInfo.erosion, EROSION_PREVIEW_INTERVAL, onStep);
+
+		return heightMap;
+	}
 
-	return heightMapImage;
+	return getHeightMapCache().get(noiseInfo.source, noiseInfo.blur, noiseInfo.erosion, onStep);
 }
 
 
 void createTerrain(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, MeshData& meshData)
 {
-	Image heightMap = readHeightMap(noiseInfo);
-	generateTerrainFromHeightmap(terrainInfo, noiseInfo, heightMap, meshData);
+	std::shared_ptr<const Image> heightMap = readHeightMap(terrainInfo, noiseInfo);
+	generateTerrainFromHeightmap(terrainInfo, noiseInfo, *heightMap, meshData);
 }
\ No newline at end of file
@@ -0,0 +1,481 @@
+#pragma once
+#include "TerrainGeneration.hpp"
+#include "Frustum.hpp"
+#include "EW/Shader.h"
+#include <cfloat>
+
+const int TERRAIN_LOD_PATCH_SIZE = 32; // Quads along each side of the grid every node is drawn with, must be even
+
+const float TERRAIN_LOD_MORPH_START = .66f; // Portion of a level's distance range before it starts morphing into the next level
+
+const float TERRAIN_LOD_MIN_QUAD_PIXELS = 4; // Quads smaller than this on screen switch to the next level even if they are still needed for pixelError
+
+
+// One level of the quadtree. Level 0 is full resolution and each level above doubles the quad size
+struct TerrainLODLevel
+{
+	int nodeSize; // Grid cells covered by each node along one side
+	int nodesPerSide;
+
+	std::vector<glm::vec2> heightRanges; // Min and max height of each node, row by row
+	std::vector<float> errors; // Worst height difference inside each node between this level's grid and full resolution
+
+	float error; // Largest of errors, what the level's distance range is based on
+
+	float range; // Furthest distance this level is drawn at
+};
+
+
+// A node picked for drawing this frame, quadrantMask says which quarters of it to draw at its level
+struct TerrainLODSelection
+{
+	int level;
+	int nodeX;
+	int nodeY;
+	int quadrantMask;
+};
+
+
+// Continuous distance-based LOD (CDLOD). A quadtree over the height field picks nodes whose grid density
+// keeps the projected error under pixelError, every node is drawn with the same patch grid and
+// terrainShader.vert reads heights from a texture and morphs vertices into the next level so there are no cracks
+class TerrainLOD
+{
+public:
+	TerrainLOD() {}
+
+	~TerrainLOD()
+	{
+		release();
+	}
+
+	void initialize(const TerrainInfo& terrainInfo, const HeightField& heightField)
+	{
+		prepare(terrainInfo, heightField);
+		upload(heightField);
+	}
+
+	// CPU half of initialize, doesn't touch OpenGL or the levels being drawn so it can run on another thread
+	void prepare(const TerrainInfo& terrainInfo, const HeightField& heightField)
+	{
+		mPendingDimensions = glm::vec2(terrainInfo.width, terrainInfo.length);
+		buildLevels(heightField, mPendingLevels);
+	}
+
+	// GL half, swaps in what prepare built. heightField has to be the one prepare was given
+	void upload(const HeightField& heightField)
+	{
+		release();
+
+		mResolution = heightField.resolution;
+		mDimensions = mPendingDimensions;
+
+		mLevels.swap(mPendingLevels);
+		mPendingLevels.clear();
+
+		createPatch();
+
+		// On the unit draw samples it from, so the terrain texture on unit 0 isn't replaced
+		glActiveTexture(GL_TEXTURE2);
+
+		glGenTextures(1, &mHeightTexture);
+		glBindTexture(GL_TEXTURE_2D, mHeightTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, heightField.getRowSize(), heightField.getRowSize(), 0, GL_RED, GL_FLOAT, heightField.heights.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// Returns how many triangles were drawn
+	int draw(Shader& shader, const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition, float fov, int viewportHeight, float pixelError)
+	{
+		if (mPatch.getVAO() == 0) return 0;
+
+		glm::vec3 localCameraPosition = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1));
+
+		updateRanges(fov, viewportHeight, pixelError);
+
+		mSelection.clear();
+		Frustum frustum = extractFrustum(projection * view * model);
+		selectNode((int)mLevels.size() - 1, 0, 0, localCameraPosition, frustum);
+
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, mHeightTexture);
+		glActiveTexture(GL_TEXTURE0);
+
+		shader.setInt("_HeightTexture", 2);
+		shader.setVec3("_LODViewerPosition", localCameraPosition);
+
+		glBindVertexArray(mPatch.getVAO());
+
+		int numIndices = mPatch.getNumIndices();
+		int quadrantIndices = numIndices / 4;
+		int numTriangles = 0;
+
+		for (const TerrainLODSelection& selected : mSelection)
+		{
+			const TerrainLODLevel& level = mLevels[selected.level];
+
+			float morphEnd = level.range;
+			float morphStart = glm::mix(selected.level > 0 ? mLevels[selected.level - 1].range : 0.0f, morphEnd, TERRAIN_LOD_MORPH_START);
+
+			if (selected.level == (int)mLevels.size() - 1)
+			{
+				// Nothing coarser to morph into
+				morphStart = 1e30f;
+				morphEnd = 2e30f;
+			}
+
+			float patchScale = (float)(level.nodeSize / TERRAIN_LOD_PATCH_SIZE);
+
+			shader.setVec2("_NodeOrigin", glm::vec2(selected.nodeX, selected.nodeY) * (float)level.nodeSize);
+			shader.setFloat("_NodeScale", patchScale);
+			shader.setVec2("_MorphRange", glm::vec2(morphStart, morphEnd));
+
+			if (selected.quadrantMask == 0xF)
+			{
+				glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
+				numTriangles += numIndices / 3;
+				continue;
+			}
+
+			for (int quadrant = 0; quadrant < 4; quadrant++)
+			{
+				if ((selected.quadrantMask & (1 << quadrant)) == 0) continue;
+
+				glDrawElements(GL_TRIANGLES, quadrantIndices, GL_UNSIGNED_INT, (const void*)(quadrant * quadrantIndices * sizeof(unsigned int)));
+				numTriangles += quadrantIndices / 3;
+			}
+		}
+
+		glBindVertexArray(0);
+
+		return numTriangles;
+	}
+
+	int getNumLevels() const { return (int)mLevels.size(); }
+	int getNumSelectedNodes() const { return (int)mSelection.size(); }
+
+private:
+	void buildLevels(const HeightField& heightField, std::vector<TerrainLODLevel>& levels)
+	{
+		int resolution = heightField.resolution;
+
+		levels.clear();
+
+		int nodeSize = TERRAIN_LOD_PATCH_SIZE;
+
+		while (true)
+		{
+			TerrainLODLevel level;
+			level.nodeSize = nodeSize;
+			level.nodesPerSide = (resolution + nodeSize - 1) / nodeSize;
+			level.heightRanges.resize((size_t)level.nodesPerSide * level.nodesPerSide);
+			level.errors.resize(level.heightRanges.size(), 0.0f);
+			level.error = 0;
+			level.range = 0;
+			levels.push_back(level);
+
+			if (nodeSize >= resolution) break;
+
+			nodeSize *= 2;
+		}
+
+		// Leaf bounds straight from the heights
+		TerrainLODLevel& leaves = levels[0];
+
+		getThreadPool().parallelFor(leaves.nodesPerSide, [&](int startRow, int endRow)
+		{
+			for (int nodeY = startRow; nodeY < endRow; nodeY++)
+			{
+				for (int nodeX = 0; nodeX < leaves.nodesPerSide; nodeX++)
+				{
+					glm::vec2 heightRange = glm::vec2(FLT_MAX, -FLT_MAX);
+
+					for (int y = nodeY * leaves.nodeSize; y <= glm::min((nodeY + 1) * leaves.nodeSize, resolution); y++)
+					{
+						for (int x = nodeX * leaves.nodeSize; x <= glm::min((nodeX + 1) * leaves.nodeSize, resolution); x++)
+						{
+							float height = heightField.at(x, y);
+							heightRange.x = glm::min(heightRange.x, height);
+							heightRange.y = glm::max(heightRange.y, height);
+						}
+					}
+
+					leaves.heightRanges[(size_t)nodeY * leaves.nodesPerSide + nodeX] = heightRange;
+				}
+			}
+		});
+
+		// Parents combine their children
+		for (size_t levelIndex = 1; levelIndex < levels.size(); levelIndex++)
+		{
+			TerrainLODLevel& level = levels[levelIndex];
+			const TerrainLODLevel& children = levels[levelIndex - 1];
+
+			getThreadPool().parallelFor(level.nodesPerSide, [&](int startRow, int endRow)
+			{
+				for (int nodeY = startRow; nodeY < endRow; nodeY++)
+				{
+					for (int nodeX = 0; nodeX < level.nodesPerSide; nodeX++)
+					{
+						glm::vec2 heightRange = glm::vec2(FLT_MAX, -FLT_MAX);
+						float childError = 0;
+
+						for (int child = 0; child < 4; child++)
+						{
+							int childX = nodeX * 2 + (child & 1);
+							int childY = nodeY * 2 + (child >> 1);
+
+							if (childX >= children.nodesPerSide || childY >= children.nodesPerSide) continue;
+
+							size_t childIndex = (size_t)childY * children.nodesPerSide + childX;
+
+							heightRange.x = glm::min(heightRange.x, children.heightRanges[childIndex].x);
+							heightRange.y = glm::max(heightRange.y, children.heightRanges[childIndex].y);
+							childError = glm::max(childError, children.errors[childIndex]);
+						}
+
+						size_t nodeIndex = (size_t)nodeY * level.nodesPerSide + nodeX;
+
+						// Error builds on the children's by how far their grid's vertices sit from this node's triangles
+						level.heightRanges[nodeIndex] = heightRange;
+						level.errors[nodeIndex] = childError + getCoarseningError(heightField, level, nodeX, nodeY);
+					}
+				}
+			});
+
+			// Ranges come from the worst node so every node stays under pixelError. They have to be the same across
+			// a level, neighbors morph over the same distances or their shared edges would crack
+			level.error = 0;
+
+			for (float error : level.errors)
+			{
+				level.error = glm::max(level.error, error);
+			}
+		}
+	}
+
+
+	// Largest height difference inside a node between the grid its children are drawn with and its own grid
+	float getCoarseningError(const HeightField& heightField, const TerrainLODLevel& level, int nodeX, int nodeY)
+	{
+		int coarseStep = level.nodeSize / TERRAIN_LOD_PATCH_SIZE;
+		int step = coarseStep / 2;
+
+		int startX = nodeX * level.nodeSize;
+		int startY = nodeY * level.nodeSize;
+		int endX = glm::min(startX + level.nodeSize, heightField.resolution);
+		int endY = glm::min(startY + level.nodeSize, heightField.resolution);
+
+		float error = 0;
+
+		for (int y = startY; y <= endY; y += step)
+		{
+			bool oddRow = ((y - startY) % coarseStep) != 0;
+
+			for (int x = startX; x <= endX; x += step)
+			{
+				bool oddColumn = ((x - startX) % coarseStep) != 0;
+
+				if (!oddRow && !oddColumn) continue; // Vertex exists in both grids
+
+				float coarseHeight;
+
+				if (oddRow && oddColumn)
+				{
+					// Middle of a coarse quad sits on its 0-2 diagonal
+					coarseHeight = (heightField.at(x - step, y - step) + heightField.at(x + step, y + step)) * .5f;
+				}
+				else if (oddColumn)
+				{
+					coarseHeight = (heightField.at(x - step, y) + heightField.at(x + step, y)) * .5f;
+				}
+				else
+				{
+					coarseHeight = (heightField.at(x, y - step) + heightField.at(x, y + step)) * .5f;
+				}
+
+				error = glm::max(error, glm::abs(heightField.at(x, y) - coarseHeight));
+			}
+		}
+
+		return error;
+	}
+
+
+	// Each level is used out to the distance where the next level's error shrinks below pixelError on screen,
+	// or where the next level's quads get so small on screen that finer ones would be sub-pixel detail
+	void updateRanges(float fov, int viewportHeight, float pixelError)
+	{
+		float pixelsPerUnitAtDistanceOne = viewportHeight / (2.0f * glm::tan(glm::radians(fov) * .5f));
+
+		float cellSize = glm::max(mDimensions.x, mDimensions.y) / mResolution;
+
+		for (size_t levelIndex = 0; levelIndex < mLevels.size(); levelIndex++)
+		{
+			TerrainLODLevel& level = mLevels[levelIndex];
+
+			if (levelIndex + 1 == mLevels.size())
+			{
+				level.range = 1e30f;
+				break;
+			}
+
+			float range = mLevels[levelIndex + 1].error * pixelsPerUnitAtDistanceOne / glm::max(pixelError, .01f);
+
+			float nextQuadSize = cellSize * (mLevels[levelIndex + 1].nodeSize / TERRAIN_LOD_PATCH_SIZE);
+			range = glm::min(range, nextQuadSize * pixelsPerUnitAtDistanceOne / TERRAIN_LOD_MIN_QUAD_PIXELS);
+
+			// Ranges at least double each level and cover a couple of node diagonals, which keeps neighbors
+			// within one level of each other so morphing always lines up with the coarser neighbor
+			float nodeDiagonal = level.nodeSize * cellSize * 1.4143f;
+
+			if (levelIndex == 0)
+			{
+				range = glm::max(range, nodeDiagonal * 2);
+			}
+			else
+			{
+				range = glm::max(range, mLevels[levelIndex - 1].range * 2);
+			}
+
+			level.range = range;
+		}
+	}
+
+
+	void getNodeBounds(int levelIndex, int nodeX, int nodeY, glm::vec3& boundsMin, glm::vec3& boundsMax)
+	{
+		const TerrainLODLevel& level = mLevels[levelIndex];
+		glm::vec2 heightRange = level.heightRanges[(size_t)nodeY * level.nodesPerSide + nodeX];
+
+		glm::vec2 cellSize = mDimensions / (float)mResolution;
+		glm::vec2 halfDimensions = mDimensions * .5f;
+
+		boundsMin = glm::vec3(nodeX * level.nodeSize * cellSize.x - halfDimensions.x, heightRange.x, nodeY * level.nodeSize * cellSize.y - halfDimensions.y);
+		boundsMax = glm::vec3(
+			glm::min((nodeX + 1) * level.nodeSize, mResolution) * cellSize.x - halfDimensions.x,
+			heightRange.y,
+			glm::min((nodeY + 1) * level.nodeSize, mResolution) * cellSize.y - halfDimensions.y);
+	}
+
+
+	bool isBoxInSphere(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& center, float radius)
+	{
+		glm::vec3 closest = glm::clamp(center, boundsMin, boundsMax);
+		glm::vec3 offset = closest - center;
+		return glm::dot(offset, offset) <= radius * radius;
+	}
+
+
+	// Returns false when the node is too far away for this level, so the parent has to cover its area
+	bool selectNode(int levelIndex, int nodeX, int nodeY, const glm::vec3& cameraPosition, const Frustum& frustum)
+	{
+		glm::vec3 boundsMin, boundsMax;
+		getNodeBounds(levelIndex, nodeX, nodeY, boundsMin, boundsMax);
+
+		if (!isBoxInSphere(boundsMin, boundsMax, cameraPosition, mLevels[levelIndex].range)) return false;
+
+		if (!isBoxInFrustum(frustum, boundsMin, boundsMax)) return true; // Handled by not drawing it
+
+		if (levelIndex == 0 || !isBoxInSphere(boundsMin, boundsMax, cameraPosition, mLevels[levelIndex - 1].range))
+		{
+			mSelection.push_back({ levelIndex, nodeX, nodeY, 0xF });
+			return true;
+		}
+
+		const TerrainLODLevel& children = mLevels[levelIndex - 1];
+		int quadrantMask = 0;
+
+		for (int child = 0; child < 4; child++)
+		{
+			int childX = nodeX * 2 + (child & 1);
+			int childY = nodeY * 2 + (child >> 1);
+
+			if (childX >= children.nodesPerSide || childY >= children.nodesPerSide) continue; // Past the edge of the terrain
+
+			if (!selectNode(levelIndex - 1, childX, childY, cameraPosition, frustum))
+			{
+				quadrantMask |= 1 << child;
+			}
+		}
+
+		if (quadrantMask != 0)
+		{
+			mSelection.push_back({ levelIndex, nodeX, nodeY, quadrantMask });
+		}
+
+		return true;
+	}
+
+
+	// Flat grid of patch coordinates drawn for every node, indices are grouped by quadrant so each quarter can be drawn alone
+	void createPatch()
+	{
+		const int patchSize = TERRAIN_LOD_PATCH_SIZE;
+		const int halfSize = patchSize / 2;
+		const int rowVertices = patchSize + 1;
+
+		MeshData patch;
+
+		for (int y = 0; y <= patchSize; y++)
+		{
+			for (int x = 0; x <= patchSize; x++)
+			{
+				patch.vertices.push_back(Vertex(glm::vec3(x, 0, y), glm::vec3(0, 1, 0), glm::vec2(x, y)));
+			}
+		}
+
+		for (int quadrant = 0; quadrant < 4; quadrant++)
+		{
+			int startX = (quadrant & 1) * halfSize;
+			int startY = (quadrant >> 1) * halfSize;
+
+			for (int y = startY; y < startY + halfSize; y++)
+			{
+				for (int x = startX; x < startX + halfSize; x++)
+				{
+					unsigned int v0 = y * rowVertices + x;
+					unsigned int v1 = v0 + rowVertices;
+					unsigned int v2 = v1 + 1;
+					unsigned int v3 = v0 + 1;
+
+					// Same winding as the full grid, 0-1-2 and 0-2-3
+					unsigned int quad[6] = { v0, v1, v2, v0, v2, v3 };
+					patch.indices.insert(patch.indices.end(), &quad[0], &quad[6]);
+				}
+			}
+		}
+
+		mPatch.initialize(&patch);
+	}
+
+
+	void release()
+	{
+		mPatch.release();
+
+		if (mHeightTexture != 0)
+		{
+			glDeleteTextures(1, &mHeightTexture);
+			mHeightTexture = 0;
+		}
+	}
+
+
+	Mesh mPatch;
+	GLuint mHeightTexture = 0;
+
+	int mResolution = 0;
+	glm::vec2 mDimensions = glm::vec2(0);
+
+	std::vector<TerrainLODLevel> mLevels;
+	std::vector<TerrainLODSelection> mSelection;
+
+	std::vector<TerrainLODLevel> mPendingLevels; // Built by prepare, swapped in by upload
+	glm::vec2 mPendingDimensions = glm::vec2(0);
+};
@@ -0,0 +1,191 @@
+#pragma once
+#include "TerrainGeneration.hpp"
+
+
+// Single mesh terrain that keeps its vertices around, so changes that only move heights (redistribution, blur,
+// min / max height) rewrite the existing vertex buffer instead of building a new mesh
+class TerrainMesh
+{
+public:
+	TerrainMesh() {}
+
+	// Returns whether the whole mesh had to be rebuilt
+	bool generate(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap)
+	{
+		prepare(terrainInfo, noiseInfo, heightMap);
+		return upload();
+	}
+
+	// CPU half of generate, only touches the CPU copy so it can run on another thread while the current mesh keeps drawing
+	void prepare(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap)
+	{
+		if (hasSameTopology(terrainInfo))
+		{
+			VertexRange changed = updateTerrainHeights(terrainInfo, noiseInfo, heightMap, mMeshData);
+
+			// Grow the pending range in case prepare runs twice before an upload
+			if (!mPendingRebuild && changed.count > 0)
+			{
+				size_t first = mPendingRange.count > 0 ? glm::min(mPendingRange.first, changed.first) : changed.first;
+				size_t end = glm::max(mPendingRange.first + mPendingRange.count, changed.first + changed.count);
+
+				mPendingRange.first = first;
+				mPendingRange.count = end - first;
+			}
+
+			return;
+		}
+
+		generateTerrainFromHeightmap(terrainInfo, noiseInfo, heightMap, mMeshData);
+
+		mHasData = true;
+		mResolution = terrainInfo.resolution;
+		mWidth = terrainInfo.width;
+		mLength = terrainInfo.length;
+		mSharedVertices = terrainInfo.sharedVertices;
+
+		mPendingRebuild = true;
+		mPendingRange.first = 0;
+		mPendingRange.count = mMeshData.vertices.size();
+	}
+
+	// GL half, uploads whatever prepare changed. Returns whether the whole mesh was rebuilt
+	bool upload()
+	{
+		if (!mHasData) return false;
+
+		bool rebuilt = mPendingRebuild;
+
+		if (mPendingRebuild)
+		{
+			mMesh.initialize(&mMeshData);
+		}
+		else
+		{
+			mMesh.updateVertices(mMeshData.vertices.data() + mPendingRange.first, mPendingRange.first, mPendingRange.count);
+		}
+
+		mDrawable = true;
+		mNumVertices = mMeshData.vertices.size();
+		mLastUploadedVertices = mPendingRange.count;
+
+		mPendingRebuild = false;
+		mPendingRange = VertexRange();
+
+		return rebuilt;
+	}
+
+	// Uploads a mesh built elsewhere (the mesh cache). There's no CPU copy of it then, so the next prepare builds from scratch
+	void upload(const Vertex* vertices, size_t numVertices, const unsigned int* indices, size_t numIndices)
+	{
+		release();
+
+		mMesh.initialize(vertices, numVertices, indices, numIndices);
+
+		mDrawable = true;
+		mNumVertices = numVertices;
+		mLastUploadedVertices = numVertices;
+	}
+
+	// Generation straight into GPU memory instead of prepare / upload. Buffers for the new mesh are made and mapped here
+	// on the GL thread, generateTerrainFromHeightmap fills them on any thread, and uploadMapped swaps them in. The current
+	// mesh keeps drawing in the meantime. Nothing is kept on the CPU, so the next prepare after uploadMapped builds from
+	// scratch. False if mapping isn't supported, prepare / upload has to be used then
+	bool map(const TerrainInfo& terrainInfo, Vertex*& vertices, unsigned int*& indices)
+	{
+		size_t numIndices;
+		getTerrainMeshSize(terrainInfo, mMappedVertices, numIndices);
+
+		return mMappedMesh.map(mMappedVertices, numIndices, vertices, indices);
+	}
+
+	// False if the driver lost the mapped contents, the old mesh stays then
+	bool uploadMapped()
+	{
+		if (!mMappedMesh.unmap()) return false;
+
+		mMesh.swap(mMappedMesh);
+		mMappedMesh.release();
+
+		// The CPU copy describes the mesh that was just replaced, so it can't be updated in place anymore
+		releaseMeshData();
+
+		mDrawable = true;
+		mNumVertices = mMappedVertices;
+		mLastUploadedVertices = mMappedVertices;
+
+		return true;
+	}
+
+	// Drops map's buffers when generation didn't fill them, the current mesh and its CPU copy stay as they were
+	void cancelMapped()
+	{
+		mMappedMesh.release();
+	}
+
+	void draw()
+	{
+		if (!mDrawable) return;
+
+		mMesh.draw();
+	}
+
+	// Frees the GPU buffers and the CPU copy, the next generate builds from scratch
+	void release()
+	{
+		mMesh.release();
+		mMappedMesh.release();
+
+		releaseMeshData();
+		mDrawable = false;
+		mNumVertices = 0;
+	}
+
+	// Both describe the uploaded mesh, so they are safe to read while prepare runs on another thread
+	size_t getNumVertices() const { return mNumVertices; }
+	size_t getLastUploadedVertices() const { return mLastUploadedVertices; }
+
+	// What prepare built, only safe to read on the thread that ran it until upload
+	const MeshData& getMeshData() const { return mMeshData; }
+
+	// Whether prepare would only rewrite heights, which needs the CPU copy from the last prepare
+	bool hasSameTopology(const TerrainInfo& terrainInfo) const
+	{
+		return mHasData && terrainInfo.resolution == mResolution && terrainInfo.width == mWidth &&
+			terrainInfo.length == mLength && terrainInfo.sharedVertices == mSharedVertices;
+	}
+
+private:
+	void releaseMeshData()
+	{
+		mMeshData.vertices.clear();
+		mMeshData.vertices.shrink_to_fit();
+		mMeshData.indices.clear();
+		mMeshData.indices.shrink_to_fit();
+
+		mHasData = false;
+		mPendingRebuild = false;
+		mPendingRange = VertexRange();
+	}
+
+	Mesh mMesh;
+	MeshData mMeshData;
+
+	Mesh mMappedMesh; // Being filled by generation on another thread
+	size_t mMappedVertices = 0;
+
+	// What mMeshData was built with
+	bool mHasData = false;
+	int mResolution = 0;
+	float mWidth = 0;
+	float mLength = 0;
+	bool mSharedVertices = true;
+
+	// Changes prepare made that upload still has to send
+	bool mPendingRebuild = false;
+	VertexRange mPendingRange;
+
+	bool mDrawable = false;
+	size_t mNumVertices = 0;
+	size_t mLastUploadedVertices = 0;
+};
@@ -0,0 +1,263 @@
+#pragma once
+#include "TerrainChunks.hpp"
+#include "MappedFile.hpp"
+#include "Hashing.hpp"
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+// Bump whenever generation changes what it builds for the same settings, files from older versions are then ignored
+const uint32_t TERRAIN_MESH_CACHE_VERSION = 3;
+
+const char* const TERRAIN_MESH_CACHE_DIRECTORY = "TerrainCache";
+
+
+// Mesh cache file (.tmc), native layout since it's only ever read back on the machine that wrote it:
+//   TerrainMeshCacheHeader
+//   TerrainChunk for every chunk (chunked meshes only)
+//   Vertices
+//   Indices
+struct TerrainMeshCacheHeader
+{
+	char magic[4]; // "TMC1"
+	uint32_t version;
+	uint64_t key; // hashTerrainMesh of the settings it was built with
+
+	uint64_t numVertices;
+	uint64_t numIndices;
+	uint32_t numChunks;
+
+	// Layouts it was written with, so a change to either struct can't be read back wrong
+	uint32_t vertexBytes;
+	uint32_t chunkBytes;
+	uint32_t reserved;
+};
+
+
+// Everything that changes the mesh a render mode builds. The heightmap file goes in by size and modification time so
+// editing it on disk still rebuilds, same as the heightmap cache
+uint64_t hashTerrainMesh(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, int renderMode, float adaptiveMaxError)
+{
+	Hasher hasher;
+
+	hasher.add(TERRAIN_MESH_CACHE_VERSION);
+	hasher.add(renderMode);
+
+	hasher.add(terrainInfo.resolution);
+	hasher.add(terrainInfo.width);
+	hasher.add(terrainInfo.length);
+	hasher.add(terrainInfo.minHeight);
+	hasher.add(terrainInfo.maxHeight);
+	hasher.add(terrainInfo.sharedVertices);
+
+	hasher.add(noiseInfo.blur);
+	hasher.add(noiseInfo.redistribution);
+	hasher.add(noiseInfo.erosion.getKey());
+	hasher.add(adaptiveMaxError);
+
+	const ProceduralInfo& procedural = noiseInfo.procedural;
+	hasher.add(procedural.enabled);
+
+	if (procedural.enabled)
+	{
+		hasher.add(procedural.seed);
+		hasher.add(procedural.octaves);
+		hasher.add(procedural.frequency);
+		hasher.add(procedural.persistence);
+	}
+	else
+	{
+		const HeightMapSource& source = noiseInfo.source;
+
+		hasher.add(source.path);
+		hasher.add((int)getHeightMapFormat(source));
+		hasher.add(source.rawWidth);
+		hasher.add(source.rawHeight);
+
+		struct stat info;
+
+		if (stat(source.path.c_str(), &info) == 0)
+		{
+			hasher.add((long long)info.st_size);
+			hasher.add((long long)info.st_mtime);
+		}
+	}
+
+	return hasher.get();
+}
+
+
+// One file per render mode holding the last mesh it built, so disk use stays bounded and startup with unchanged
+// settings finds the mesh its last run left
+std::string getTerrainMeshCachePath(int renderMode)
+{
+	return std::string(TERRAIN_MESH_CACHE_DIRECTORY) + "/terrain" + std::to_string(renderMode) + ".tmc";
+}
+
+
+// Whether a cache file with this header is one for key, written by this version. fileSize has to match what it holds
+bool isTerrainMeshCacheValid(const TerrainMeshCacheHeader& header, uint64_t key, size_t fileSize)
+{
+	if (memcmp(header.magic, "TMC1", 4) != 0 || header.version != TERRAIN_MESH_CACHE_VERSION || header.key != key ||
+		header.vertexBytes != sizeof(Vertex) || header.chunkBytes != sizeof(TerrainChunk)) return false;
+
+	return sizeof(TerrainMeshCacheHeader) + (size_t)header.numChunks * sizeof(TerrainChunk) + (size_t)header.numVertices * sizeof(Vertex) +
+		(size_t)header.numIndices * sizeof(unsigned int) == fileSize;
+}
+
+
+// A cache file opened through a memory mapping, vertices and indices point straight into it so they can go from the
+// page cache to the GPU without another copy
+class CachedTerrainMesh
+{
+public:
+	CachedTerrainMesh() {}
+
+	// False if there's no file for the mode, or it was built from other settings or by another version
+	bool open(int renderMode, uint64_t key)
+	{
+		std::string path = getTerrainMeshCachePath(renderMode);
+
+		if (!mFile.open(path)) return false;
+
+		const unsigned char* data = mFile.getData();
+		size_t size = mFile.getSize();
+
+		if (size < sizeof(TerrainMeshCacheHeader)) return false;
+
+		memcpy(&mHeader, data, sizeof(mHeader));
+
+		if (!isTerrainMeshCacheValid(mHeader, key, size)) return false;
+
+		size_t chunksOffset = sizeof(TerrainMeshCacheHeader);
+		size_t verticesOffset = chunksOffset + (size_t)mHeader.numChunks * sizeof(TerrainChunk);
+		size_t indicesOffset = verticesOffset + (size_t)mHeader.numVertices * sizeof(Vertex);
+
+		mChunks.resize(mHeader.numChunks);
+		memcpy(mChunks.data(), data + chunksOffset, mChunks.size() * sizeof(TerrainChunk));
+
+		// Everything after the header is a multiple of 4 bytes long and mappings start on a page, so these are aligned
+		mVertices = (const Vertex*)(data + verticesOffset);
+		mIndices = (const unsigned int*)(data + indicesOffset);
+
+		// Reads every page in now, on whichever thread opened it, so the upload doesn't stall the render thread on disk
+		volatile unsigned char touched = 0;
+
+		for (size_t i = 0; i < size; i += 4096)
+		{
+			touched ^= data[i];
+		}
+
+		return true;
+	}
+
+	const Vertex* getVertices() const { return mVertices; }
+	const unsigned int* getIndices() const { return mIndices; }
+	size_t getNumVertices() const { return (size_t)mHeader.numVertices; }
+	size_t getNumIndices() const { return (size_t)mHeader.numIndices; }
+	const std::vector<TerrainChunk>& getChunks() const { return mChunks; }
+	size_t getFileBytes() const { return mFile.getSize(); }
+
+private:
+	MappedFile mFile;
+	TerrainMeshCacheHeader mHeader;
+
+	std::vector<TerrainChunk> mChunks;
+	const Vertex* mVertices = nullptr;
+	const unsigned int* mIndices = nullptr;
+};
+
+
+// Null if there's no usable cache for these settings
+std::shared_ptr<const CachedTerrainMesh> loadTerrainMeshCache(int renderMode, uint64_t key)
+{
+	std::shared_ptr<CachedTerrainMesh> cached = std::make_shared<CachedTerrainMesh>();
+
+	if (!cached->open(renderMode, key)) return nullptr;
+
+	return cached;
+}
+
+
+// Only reads the header, so it's cheap enough for the render thread to decide whether a build will come from the cache
+bool hasTerrainMeshCache(int renderMode, uint64_t key)
+{
+	std::string path = getTerrainMeshCachePath(renderMode);
+
+	struct stat info;
+
+	if (stat(path.c_str(), &info) != 0) return false;
+
+	FILE* file = fopen(path.c_str(), "rb");
+
+	if (file == nullptr) return false;
+
+	TerrainMeshCacheHeader header;
+	bool read = fread(&header, sizeof(header), 1, file) == 1;
+
+	fclose(file);
+
+	return read && isTerrainMeshCacheValid(header, key, (size_t)info.st_size);
+}
+
+
+// Replaces the mode's cache file. Written to a temporary file first, so a crash halfway through can't leave a file
+// that looks valid. chunks is empty for meshes that aren't chunked
+bool saveTerrainMeshCache(int renderMode, uint64_t key, const MeshData& meshData, const std::vector<TerrainChunk>& chunks = std::vector<TerrainChunk>())
+{
+#ifdef _WIN32
+	_mkdir(TERRAIN_MESH_CACHE_DIRECTORY);
+#else
+	mkdir(TERRAIN_MESH_CACHE_DIRECTORY, 0755);
+#endif
+
+	std::string path = getTerrainMeshCachePath(renderMode);
+	std::string temporaryPath = path + ".tmp";
+
+	FILE* file = fopen(temporaryPath.c_str(), "wb");
+
+	if (file == nullptr)
+	{
+		printf("Failed to write mesh cache %s: can't open file\n", temporaryPath.c_str());
+		return false;
+	}
+
+	TerrainMeshCacheHeader header;
+	memcpy(header.magic, "TMC1", 4);
+	header.version = TERRAIN_MESH_CACHE_VERSION;
+	header.key = key;
+	header.numVertices = meshData.vertices.size();
+	header.numIndices = meshData.indices.size();
+	header.numChunks = (uint32_t)chunks.size();
+	header.vertexBytes = sizeof(Vertex);
+	header.chunkBytes = sizeof(TerrainChunk);
+	header.reserved = 0;
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(chunks.data(), sizeof(TerrainChunk), chunks.size(), file);
+	fwrite(meshData.vertices.data(), sizeof(Vertex), meshData.vertices.size(), file);
+	fwrite(meshData.indices.data(), sizeof(unsigned int), meshData.indices.size(), file);
+
+	bool failed = ferror(file) != 0;
+	failed = fclose(file) != 0 || failed;
+
+	// Windows won't rename over an existing file
+	remove(path.c_str());
+
+	if (failed || rename(temporaryPath.c_str(), path.c_str()) != 0)
+	{
+		printf("Failed to write mesh cache %s\n", path.c_str());
+		remove(temporaryPath.c_str());
+		return false;
+	}
+
+	return true;
+}
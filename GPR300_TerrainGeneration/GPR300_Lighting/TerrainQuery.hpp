@@ -0,0 +1,463 @@
+#pragma once
+#include "TerrainGeneration.hpp"
+#include "TerrainRaycast.hpp"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TERRAIN_QUERY_SSE
+#include <emmintrin.h>
+#endif
+
+
+// Everything a query needs that doesn't depend on where the terrain is, shared by every query of one terrain
+struct TerrainQueryData
+{
+	HeightField heightField;
+	MinMaxQuadtree quadtree; // For raycasts
+};
+
+
+struct TerrainRayHit
+{
+	bool hit = false;
+	float distance = 0; // World units along the ray
+	glm::vec3 position;
+	glm::vec3 normal; // Of the triangle that was hit
+};
+
+
+// Answers "how high is the terrain at world (x, z)" for whole arrays of points, for grounding the camera, placing and
+// scattering things, and where a ray first hits it for picking and line of sight. Heights are bilinear between the
+// grid vertices of the terrain it was built from, and normals come from the same bilinear patch. Points off the terrain
+// get the height of the closest edge. Rays hit the triangles the single mesh draws instead, so picking lands on what's
+// on screen.
+// Nothing changes after construction, so any number of threads can query one at the same time. A new terrain or transform
+// means a new query, the heights and quadtree are shared between them. The transform is assumed to keep the terrain's up
+// pointing up (translation, scale, rotation about y), which is all the terrain ever gets
+class TerrainQuery
+{
+public:
+	TerrainQuery(std::shared_ptr<const TerrainQueryData> data, const TerrainInfo& terrainInfo, const glm::mat4& transform) :
+		mData(data), mTerrainInfo(terrainInfo), mTransform(transform)
+	{
+		const HeightField& heightField = data->heightField;
+		int resolution = heightField.resolution;
+
+		mRowSize = heightField.getRowSize();
+		mLastCell = (float)(resolution - 1);
+		mMaxGrid = (float)resolution;
+
+		float cellWidth = terrainInfo.width / resolution;
+		float cellLength = terrainInfo.length / resolution;
+
+		// World xz straight to grid coordinates, inverse transform then the terrain's centered layout
+		glm::mat4 inverse = glm::inverse(transform);
+
+		mGridX = glm::vec3(inverse[0][0], inverse[2][0], inverse[3][0] + terrainInfo.width / 2) / cellWidth;
+		mGridZ = glm::vec3(inverse[0][2], inverse[2][2], inverse[3][2] + terrainInfo.length / 2) / cellLength;
+
+		// World y from the local point, grid coordinates back to local x / z are folded in
+		mWorldY = glm::vec4(transform[0][1] * cellWidth, transform[1][1], transform[2][1] * cellLength,
+			transform[3][1] - transform[0][1] * terrainInfo.width / 2 - transform[2][1] * terrainInfo.length / 2);
+
+		mSlopeScale = glm::vec2(1.0f / cellWidth, 1.0f / cellLength);
+		mNormalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+
+		// Raycasts run in grid space, x / z in cells and y in local heights
+		glm::mat4 gridFromLocal(1);
+		gridFromLocal[0][0] = 1.0f / cellWidth;
+		gridFromLocal[2][2] = 1.0f / cellLength;
+		gridFromLocal[3][0] = terrainInfo.width / 2 / cellWidth;
+		gridFromLocal[3][2] = terrainInfo.length / 2 / cellLength;
+
+		mGridFromWorld = gridFromLocal * inverse;
+		mCellSize = glm::vec3(cellWidth, 1, cellLength);
+	}
+
+	// World height (and normal, if normals isn't null) under each world xz position
+	void getHeights(const glm::vec2* positions, size_t count, float* heights, glm::vec3* normals = nullptr) const
+	{
+		size_t i = 0;
+
+#ifdef TERRAIN_QUERY_SSE
+		for (; i + 4 <= count; i += 4)
+		{
+			queryFour(&positions[i], &heights[i], normals ? &normals[i] : nullptr);
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			queryPoint(positions[i], heights[i], normals ? &normals[i] : nullptr);
+		}
+	}
+
+	float getHeight(const glm::vec2& position) const
+	{
+		float height;
+		queryPoint(position, height, nullptr);
+
+		return height;
+	}
+
+	glm::vec3 getNormal(const glm::vec2& position) const
+	{
+		float height;
+		glm::vec3 normal;
+		queryPoint(position, height, &normal);
+
+		return normal;
+	}
+
+	// Closest hit along the ray (world space, direction doesn't have to be normalized) no further than maxDistance
+	TerrainRayHit raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance = std::numeric_limits<float>::max()) const
+	{
+		TerrainRayHit hit;
+
+		float directionLength = glm::length(direction);
+
+		if (!(directionLength > 0)) return hit;
+
+		glm::vec3 worldDirection = direction / directionLength;
+
+		// Affine, so distances along the ray stay the same t in grid space
+		glm::vec3 gridOrigin = glm::vec3(mGridFromWorld * glm::vec4(origin, 1));
+		glm::vec3 gridDirection = glm::mat3(mGridFromWorld) * worldDirection;
+
+		float t;
+		glm::vec3 gridNormal;
+
+		if (!mData->quadtree.raycast(mData->heightField, gridOrigin, gridDirection, maxDistance, t, gridNormal)) return hit;
+
+		hit.hit = true;
+		hit.distance = t;
+		hit.position = origin + worldDirection * t;
+		hit.normal = glm::normalize(mNormalMatrix * (gridNormal / mCellSize));
+
+		return hit;
+	}
+
+	// Whether the position is over the terrain rather than clamped onto its edge
+	bool contains(const glm::vec2& position) const
+	{
+		float gridX = mGridX.x * position.x + mGridX.y * position.y + mGridX.z;
+		float gridZ = mGridZ.x * position.x + mGridZ.y * position.y + mGridZ.z;
+
+		return gridX >= 0 && gridZ >= 0 && gridX <= mMaxGrid && gridZ <= mMaxGrid;
+	}
+
+	const TerrainInfo& getTerrainInfo() const { return mTerrainInfo; }
+	const glm::mat4& getTransform() const { return mTransform; }
+	const std::shared_ptr<const TerrainQueryData>& getData() const { return mData; }
+
+private:
+	// The SSE version does the same operations in the same order, so both give the same results
+	void queryPoint(const glm::vec2& position, float& height, glm::vec3* normal) const
+	{
+		float gridX = mGridX.x * position.x + mGridX.y * position.y + mGridX.z;
+		float gridZ = mGridZ.x * position.x + mGridZ.y * position.y + mGridZ.z;
+
+		gridX = glm::min(glm::max(gridX, 0.0f), mMaxGrid);
+		gridZ = glm::min(glm::max(gridZ, 0.0f), mMaxGrid);
+
+		// The far edge belongs to the last cell
+		float cellX = glm::min((float)(int)gridX, mLastCell);
+		float cellZ = glm::min((float)(int)gridZ, mLastCell);
+
+		float fractionX = gridX - cellX;
+		float fractionZ = gridZ - cellZ;
+
+		const float* corner = &mData->heightField.heights[(size_t)(int)cellZ * mRowSize + (int)cellX];
+
+		float h00 = corner[0];
+		float h10 = corner[1];
+		float h01 = corner[mRowSize];
+		float h11 = corner[mRowSize + 1];
+
+		float nearHeight = h00 + (h10 - h00) * fractionX;
+		float farHeight = h01 + (h11 - h01) * fractionX;
+		float localHeight = nearHeight + (farHeight - nearHeight) * fractionZ;
+
+		height = mWorldY.x * gridX + mWorldY.y * localHeight + mWorldY.z * gridZ + mWorldY.w;
+
+		if (normal == nullptr) return;
+
+		float slopeX = ((h10 - h00) + ((h11 - h01) - (h10 - h00)) * fractionZ) * mSlopeScale.x;
+		float slopeZ = (farHeight - nearHeight) * mSlopeScale.y;
+
+		glm::vec3 worldNormal = mNormalMatrix * glm::vec3(-slopeX, 1, -slopeZ);
+		*normal = worldNormal * (1.0f / std::sqrt(worldNormal.x * worldNormal.x + worldNormal.y * worldNormal.y + worldNormal.z * worldNormal.z));
+	}
+
+#ifdef TERRAIN_QUERY_SSE
+	void queryFour(const glm::vec2* positions, float* heights, glm::vec3* normals) const
+	{
+		// Deinterleave the four xz pairs
+		__m128 first = _mm_loadu_ps(&positions[0].x);
+		__m128 second = _mm_loadu_ps(&positions[2].x);
+
+		__m128 x = _mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 z = _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1));
+
+		__m128 gridX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mGridX.x), x), _mm_mul_ps(_mm_set1_ps(mGridX.y), z)), _mm_set1_ps(mGridX.z));
+		__m128 gridZ = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mGridZ.x), x), _mm_mul_ps(_mm_set1_ps(mGridZ.y), z)), _mm_set1_ps(mGridZ.z));
+
+		__m128 zero = _mm_setzero_ps();
+		__m128 maxGrid = _mm_set1_ps(mMaxGrid);
+		__m128 lastCell = _mm_set1_ps(mLastCell);
+
+		gridX = _mm_min_ps(_mm_max_ps(gridX, zero), maxGrid);
+		gridZ = _mm_min_ps(_mm_max_ps(gridZ, zero), maxGrid);
+
+		__m128 cellX = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(gridX)), lastCell);
+		__m128 cellZ = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(gridZ)), lastCell);
+
+		__m128 fractionX = _mm_sub_ps(gridX, cellX);
+		__m128 fractionZ = _mm_sub_ps(gridZ, cellZ);
+
+		__m128i cellXs = _mm_cvttps_epi32(cellX);
+		__m128i cellZs = _mm_cvttps_epi32(cellZ);
+
+		const float* field = mData->heightField.heights.data();
+		__m128 h00, h10, h01, h11;
+
+#ifdef __AVX2__
+		__m128i rowOffset = _mm_set1_epi32(mRowSize);
+		__m128i index = _mm_add_epi32(_mm_mullo_epi32(cellZs, rowOffset), cellXs);
+
+		h00 = _mm_i32gather_ps(field, index, 4);
+		h10 = _mm_i32gather_ps(field + 1, index, 4);
+		h01 = _mm_i32gather_ps(field, _mm_add_epi32(index, rowOffset), 4);
+		h11 = _mm_i32gather_ps(field + 1, _mm_add_epi32(index, rowOffset), 4);
+#else
+		// No 32-bit multiply before SSE4.1, so the corner addresses are worked out a lane at a time
+		alignas(16) int xs[4];
+		alignas(16) int zs[4];
+		_mm_store_si128((__m128i*)xs, cellXs);
+		_mm_store_si128((__m128i*)zs, cellZs);
+
+		int row = mRowSize;
+
+		const float* c0 = field + (size_t)zs[0] * row + xs[0];
+		const float* c1 = field + (size_t)zs[1] * row + xs[1];
+		const float* c2 = field + (size_t)zs[2] * row + xs[2];
+		const float* c3 = field + (size_t)zs[3] * row + xs[3];
+
+		h00 = _mm_setr_ps(c0[0], c1[0], c2[0], c3[0]);
+		h10 = _mm_setr_ps(c0[1], c1[1], c2[1], c3[1]);
+		h01 = _mm_setr_ps(c0[row], c1[row], c2[row], c3[row]);
+		h11 = _mm_setr_ps(c0[row + 1], c1[row + 1], c2[row + 1], c3[row + 1]);
+#endif
+
+		__m128 edgeNear = _mm_sub_ps(h10, h00);
+		__m128 edgeFar = _mm_sub_ps(h11, h01);
+
+		__m128 nearHeight = _mm_add_ps(h00, _mm_mul_ps(edgeNear, fractionX));
+		__m128 farHeight = _mm_add_ps(h01, _mm_mul_ps(edgeFar, fractionX));
+		__m128 across = _mm_sub_ps(farHeight, nearHeight);
+		__m128 localHeight = _mm_add_ps(nearHeight, _mm_mul_ps(across, fractionZ));
+
+		__m128 height = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mWorldY.x), gridX), _mm_mul_ps(_mm_set1_ps(mWorldY.y), localHeight)),
+			_mm_mul_ps(_mm_set1_ps(mWorldY.z), gridZ)), _mm_set1_ps(mWorldY.w));
+
+		_mm_storeu_ps(heights, height);
+
+		if (normals == nullptr) return;
+
+		__m128 slopeX = _mm_mul_ps(_mm_add_ps(edgeNear, _mm_mul_ps(_mm_sub_ps(edgeFar, edgeNear), fractionZ)), _mm_set1_ps(mSlopeScale.x));
+		__m128 slopeZ = _mm_mul_ps(across, _mm_set1_ps(mSlopeScale.y));
+
+		__m128 localX = _mm_sub_ps(zero, slopeX);
+		__m128 localZ = _mm_sub_ps(zero, slopeZ);
+
+		// Same sums as glm's mat3 * vec3, column by column
+		const glm::mat3& m = mNormalMatrix;
+
+		__m128 normalX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][0]), localX), _mm_set1_ps(m[1][0])), _mm_mul_ps(_mm_set1_ps(m[2][0]), localZ));
+		__m128 normalY = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][1]), localX), _mm_set1_ps(m[1][1])), _mm_mul_ps(_mm_set1_ps(m[2][1]), localZ));
+		__m128 normalZ = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][2]), localX), _mm_set1_ps(m[1][2])), _mm_mul_ps(_mm_set1_ps(m[2][2]), localZ));
+
+		__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX, normalX), _mm_mul_ps(normalY, normalY)), _mm_mul_ps(normalZ, normalZ));
+		__m128 inverseLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSquared));
+
+		alignas(16) float outX[4];
+		alignas(16) float outY[4];
+		alignas(16) float outZ[4];
+
+		_mm_store_ps(outX, _mm_mul_ps(normalX, inverseLength));
+		_mm_store_ps(outY, _mm_mul_ps(normalY, inverseLength));
+		_mm_store_ps(outZ, _mm_mul_ps(normalZ, inverseLength));
+
+		for (int i = 0; i < 4; i++)
+		{
+			normals[i] = glm::vec3(outX[i], outY[i], outZ[i]);
+		}
+	}
+#endif
+
+	std::shared_ptr<const TerrainQueryData> mData;
+	TerrainInfo mTerrainInfo;
+	glm::mat4 mTransform;
+
+	int mRowSize;
+	float mLastCell; // Cell coordinate of the last row / column of cells
+	float mMaxGrid;
+
+	glm::vec3 mGridX; // Grid x is mGridX.x * world x + mGridX.y * world z + mGridX.z
+	glm::vec3 mGridZ;
+	glm::vec4 mWorldY; // World y from grid x, local height, grid z and a constant
+
+	glm::vec2 mSlopeScale; // Height difference per cell to slope along local x / z
+	glm::mat3 mNormalMatrix;
+
+	glm::mat4 mGridFromWorld;
+	glm::vec3 mCellSize; // Grid space to local space scale
+};
+
+
+// Grid heights for a query, the same ones the single mesh terrain puts in its vertices, and the quadtree over them
+std::shared_ptr<const TerrainQueryData> generateTerrainQueryData(const TerrainInfo& terrainInfo, const NoiseInfo& noiseInfo, const Image& heightMap)
+{
+	std::shared_ptr<TerrainQueryData> data = std::make_shared<TerrainQueryData>();
+
+	generateHeightField(terrainInfo, noiseInfo, heightMap, data->heightField);
+	data->quadtree.build(data->heightField);
+
+	return data;
+}
+
+
+// Queries per second for heights alone and with normals, one point at a time against batches, and batches split
+// across the thread pool. Points are random over the terrain plus a margin off the edges
+void benchmarkTerrainQuery(const TerrainQuery& query)
+{
+	const TerrainInfo& terrainInfo = query.getTerrainInfo();
+
+	const size_t numPoints = 1 << 20;
+	const int repeats = 10;
+
+	std::vector<glm::vec2> positions(numPoints);
+	std::vector<float> heights(numPoints);
+	std::vector<glm::vec3> normals(numPoints);
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> localX(-terrainInfo.width * .55f, terrainInfo.width * .55f);
+	std::uniform_real_distribution<float> localZ(-terrainInfo.length * .55f, terrainInfo.length * .55f);
+
+	const glm::mat4& transform = query.getTransform();
+
+	for (glm::vec2& position : positions)
+	{
+		glm::vec4 world = transform * glm::vec4(localX(random), 0, localZ(random), 1);
+		position = glm::vec2(world.x, world.z);
+	}
+
+	auto run = [&](const char* name, const std::function<void()>& queries)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (int i = 0; i < repeats; i++)
+		{
+			queries();
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+
+		std::cout << name << ": " << numPoints * repeats / seconds / 1e6 << "M queries/s" << std::endl;
+	};
+
+	std::cout << "Terrain queries, " << numPoints << " random points, grid " << query.getData()->heightField.resolution << std::endl;
+
+	run("Heights, one at a time", [&]
+	{
+		for (size_t i = 0; i < numPoints; i++)
+		{
+			heights[i] = query.getHeight(positions[i]);
+		}
+	});
+
+	run("Heights, batched", [&] { query.getHeights(positions.data(), numPoints, heights.data()); });
+
+	run("Heights + normals, one at a time", [&]
+	{
+		for (size_t i = 0; i < numPoints; i++)
+		{
+			heights[i] = query.getHeight(positions[i]);
+			normals[i] = query.getNormal(positions[i]);
+		}
+	});
+
+	run("Heights + normals, batched", [&] { query.getHeights(positions.data(), numPoints, heights.data(), normals.data()); });
+
+	std::string threaded = "Heights + normals, batched on " + std::to_string(getThreadPool().getNumThreads()) + " threads";
+
+	run(threaded.c_str(), [&]
+	{
+		getThreadPool().parallelFor((int)(numPoints / 4096), [&](int start, int end)
+		{
+			size_t first = (size_t)start * 4096;
+			query.getHeights(&positions[first], (size_t)(end - start) * 4096, &heights[first], &normals[first]);
+		});
+	});
+}
+
+
+// Microseconds per raycast for rays from above the terrain looking down at it at random angles, like picking with the
+// cursor, and for nearly flat rays across the whole terrain, the worst case for line of sight
+void benchmarkTerrainRaycast(const TerrainQuery& query)
+{
+	const TerrainInfo& terrainInfo = query.getTerrainInfo();
+	const glm::mat4& transform = query.getTransform();
+
+	const int numRays = 100000;
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(-.5f, .5f);
+
+	float height = terrainInfo.maxHeight - terrainInfo.minHeight;
+
+	auto run = [&](const char* name, bool flat)
+	{
+		std::vector<glm::vec3> origins(numRays);
+		std::vector<glm::vec3> directions(numRays);
+
+		for (int i = 0; i < numRays; i++)
+		{
+			glm::vec3 start(unit(random) * terrainInfo.width, terrainInfo.maxHeight + height * (flat ? .1f : 1.0f), unit(random) * terrainInfo.length);
+			glm::vec3 target(unit(random) * terrainInfo.width, terrainInfo.minHeight, unit(random) * terrainInfo.length);
+
+			if (flat)
+			{
+				// From one edge towards the opposite one, dropping only a little on the way
+				start.x = -terrainInfo.width / 2;
+				target.x = terrainInfo.width / 2;
+			}
+
+			origins[i] = glm::vec3(transform * glm::vec4(start, 1));
+			directions[i] = glm::vec3(transform * glm::vec4(target - start, 0));
+		}
+
+		int hits = 0;
+
+		auto begin = std::chrono::high_resolution_clock::now();
+
+		for (int i = 0; i < numRays; i++)
+		{
+			hits += query.raycast(origins[i], directions[i]).hit ? 1 : 0;
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		double microseconds = std::chrono::duration<double, std::micro>(end - begin).count();
+
+		std::cout << name << ": " << microseconds / numRays << "us per ray, " << hits << " / " << numRays << " hit" << std::endl;
+	};
+
+	std::cout << "Terrain raycasts, grid " << query.getData()->heightField.resolution << ", " << query.getData()->quadtree.getNumLevels() << " quadtree levels" << std::endl;
+
+	run("Looking down", false);
+	run("Across the terrain", true);
+}
@@ -0,0 +1,293 @@
+#pragma once
+#include "TerrainGeneration.hpp"
+#include <limits>
+
+
+// Lowest and highest height under every node of a quadtree over a height field's cells (a maximum mipmap that keeps the
+// minimum too). Level 0 has one node per cell, every level above halves both sides (rounding up) until one node covers
+// the whole grid. A ray only has to look inside the nodes whose box it goes through, so it reaches the cell it hits
+// after a few dozen box tests instead of crossing thousands of triangles
+class MinMaxQuadtree
+{
+public:
+	MinMaxQuadtree() {}
+
+	void build(const HeightField& heightField)
+	{
+		int resolution = heightField.resolution;
+
+		mLevels.clear();
+		mLevelSizes.clear();
+
+		// Cells, from their 4 corners
+		mLevels.emplace_back((size_t)resolution * resolution);
+		mLevelSizes.push_back(resolution);
+
+		glm::vec2* cells = mLevels[0].data();
+
+		getThreadPool().parallelFor(resolution, [&](int startRow, int endRow)
+		{
+			for (int y = startRow; y < endRow; y++)
+			{
+				const float* row = &heightField.heights[(size_t)y * heightField.getRowSize()];
+				const float* nextRow = row + heightField.getRowSize();
+
+				for (int x = 0; x < resolution; x++)
+				{
+					float lowest = glm::min(glm::min(row[x], row[x + 1]), glm::min(nextRow[x], nextRow[x + 1]));
+					float highest = glm::max(glm::max(row[x], row[x + 1]), glm::max(nextRow[x], nextRow[x + 1]));
+
+					cells[(size_t)y * resolution + x] = glm::vec2(lowest, highest);
+				}
+			}
+		});
+
+		while (mLevelSizes.back() > 1)
+		{
+			int childSize = mLevelSizes.back();
+			int size = (childSize + 1) / 2;
+
+			mLevels.emplace_back((size_t)size * size);
+			mLevelSizes.push_back(size);
+
+			const glm::vec2* children = mLevels[mLevels.size() - 2].data();
+			glm::vec2* nodes = mLevels.back().data();
+
+			getThreadPool().parallelFor(size, [&](int startRow, int endRow)
+			{
+				for (int y = startRow; y < endRow; y++)
+				{
+					for (int x = 0; x < size; x++)
+					{
+						glm::vec2 range(std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+
+						for (int childY = 2 * y; childY < glm::min(2 * y + 2, childSize); childY++)
+						{
+							for (int childX = 2 * x; childX < glm::min(2 * x + 2, childSize); childX++)
+							{
+								const glm::vec2& child = children[(size_t)childY * childSize + childX];
+
+								range.x = glm::min(range.x, child.x);
+								range.y = glm::max(range.y, child.y);
+							}
+						}
+
+						nodes[(size_t)y * size + x] = range;
+					}
+				}
+			});
+		}
+	}
+
+	// Catches the nodes up after the heights of the vertices from (minX, minY) to (maxX, maxY) changed, only the cells
+	// touching them and the nodes above those get recomputed
+	void update(const HeightField& heightField, int minX, int minY, int maxX, int maxY)
+	{
+		if (mLevels.empty()) return;
+
+		int resolution = heightField.resolution;
+
+		// Cells on both sides of a vertex use it
+		int startX = glm::max(minX - 1, 0);
+		int startY = glm::max(minY - 1, 0);
+		int endX = glm::min(maxX, resolution - 1);
+		int endY = glm::min(maxY, resolution - 1);
+
+		glm::vec2* cells = mLevels[0].data();
+
+		for (int y = startY; y <= endY; y++)
+		{
+			const float* row = &heightField.heights[(size_t)y * heightField.getRowSize()];
+			const float* nextRow = row + heightField.getRowSize();
+
+			for (int x = startX; x <= endX; x++)
+			{
+				float lowest = glm::min(glm::min(row[x], row[x + 1]), glm::min(nextRow[x], nextRow[x + 1]));
+				float highest = glm::max(glm::max(row[x], row[x + 1]), glm::max(nextRow[x], nextRow[x + 1]));
+
+				cells[(size_t)y * resolution + x] = glm::vec2(lowest, highest);
+			}
+		}
+
+		for (size_t level = 1; level < mLevels.size(); level++)
+		{
+			int childSize = mLevelSizes[level - 1];
+			int size = mLevelSizes[level];
+
+			startX /= 2;
+			startY /= 2;
+			endX /= 2;
+			endY /= 2;
+
+			const glm::vec2* children = mLevels[level - 1].data();
+			glm::vec2* nodes = mLevels[level].data();
+
+			for (int y = startY; y <= endY; y++)
+			{
+				for (int x = startX; x <= endX; x++)
+				{
+					glm::vec2 range(std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+
+					for (int childY = 2 * y; childY < glm::min(2 * y + 2, childSize); childY++)
+					{
+						for (int childX = 2 * x; childX < glm::min(2 * x + 2, childSize); childX++)
+						{
+							const glm::vec2& child = children[(size_t)childY * childSize + childX];
+
+							range.x = glm::min(range.x, child.x);
+							range.y = glm::max(range.y, child.y);
+						}
+					}
+
+					nodes[(size_t)y * size + x] = range;
+				}
+			}
+		}
+	}
+
+	// Closest hit of origin + t * direction (grid space: x / z in cells, y in heights) on the triangles the mesh draws,
+	// for t from 0 to maxT. Nodes are visited front to back, and a ray's path through one node never overlaps its path
+	// through a sibling, so the first triangle hit is the closest one. normal is the triangle's, in grid space
+	bool raycast(const HeightField& heightField, const glm::vec3& origin, const glm::vec3& direction, float maxT, float& t, glm::vec3& normal) const
+	{
+		if (mLevels.empty()) return false;
+
+		// Infinities for axis aligned rays, the slab tests still come out right with them
+		glm::vec3 inverseDirection = 1.0f / direction;
+
+		// Children go in the order the ray crosses them, the one nearest its start first
+		int firstX = direction.x >= 0 ? 0 : 1;
+		int firstY = direction.z >= 0 ? 0 : 1;
+
+		struct Node
+		{
+			int level;
+			int x;
+			int y;
+		};
+
+		// Each level pushes at most 4 children and pops one, so this never overflows for any grid that fits in memory
+		Node stack[4 * 32];
+		int stackSize = 0;
+
+		stack[stackSize++] = { (int)mLevels.size() - 1, 0, 0 };
+
+		while (stackSize > 0)
+		{
+			Node node = stack[--stackSize];
+
+			int nodeCells = 1 << node.level;
+			int size = mLevelSizes[node.level];
+			const glm::vec2& range = mLevels[node.level][(size_t)node.y * size + node.x];
+
+			glm::vec3 boundsMin((float)(node.x * nodeCells), range.x, (float)(node.y * nodeCells));
+			glm::vec3 boundsMax((float)glm::min((node.x + 1) * nodeCells, heightField.resolution), range.y, (float)glm::min((node.y + 1) * nodeCells, heightField.resolution));
+
+			float enter, exit;
+
+			if (!intersectBox(origin, inverseDirection, boundsMin, boundsMax, maxT, enter, exit)) continue;
+
+			if (node.level == 0)
+			{
+				if (intersectCell(heightField, node.x, node.y, origin, direction, maxT, t, normal)) return true;
+				continue;
+			}
+
+			int childSize = mLevelSizes[node.level - 1];
+
+			// Pushed back to front, so the front one is popped first
+			for (int i = 3; i >= 0; i--)
+			{
+				int childX = 2 * node.x + ((i & 1) ^ firstX);
+				int childY = 2 * node.y + ((i >> 1) ^ firstY);
+
+				if (childX >= childSize || childY >= childSize) continue;
+
+				stack[stackSize++] = { node.level - 1, childX, childY };
+			}
+		}
+
+		return false;
+	}
+
+	int getNumLevels() const { return (int)mLevels.size(); }
+
+private:
+	// Slab test, false if the ray misses the box or only reaches it past maxT
+	static bool intersectBox(const glm::vec3& origin, const glm::vec3& inverseDirection, const glm::vec3& boundsMin, const glm::vec3& boundsMax, float maxT, float& enter, float& exit)
+	{
+		glm::vec3 toMin = (boundsMin - origin) * inverseDirection;
+		glm::vec3 toMax = (boundsMax - origin) * inverseDirection;
+
+		glm::vec3 nearT = glm::min(toMin, toMax);
+		glm::vec3 farT = glm::max(toMin, toMax);
+
+		enter = glm::max(glm::max(nearT.x, nearT.y), glm::max(nearT.z, 0.0f));
+		exit = glm::min(glm::min(farT.x, farT.y), glm::min(farT.z, maxT));
+
+		// A little slack so rays along a box's face or through a shared edge aren't lost between two nodes
+		return enter <= exit * (1 + 1e-5f) + 1e-5f;
+	}
+
+	// The cell's two triangles, split the same way as generateGridIndices (corner 0 to 2)
+	static bool intersectCell(const HeightField& heightField, int x, int y, const glm::vec3& origin, const glm::vec3& direction, float maxT, float& t, glm::vec3& normal)
+	{
+		glm::vec3 v0((float)x, heightField.at(x, y), (float)y);
+		glm::vec3 v1((float)x, heightField.at(x, y + 1), (float)(y + 1));
+		glm::vec3 v2((float)(x + 1), heightField.at(x + 1, y + 1), (float)(y + 1));
+		glm::vec3 v3((float)(x + 1), heightField.at(x + 1, y), (float)y);
+
+		bool hit = false;
+		float closest = maxT;
+
+		if (intersectTriangle(origin, direction, v0, v1, v2, closest))
+		{
+			hit = true;
+			normal = glm::cross(v1 - v0, v2 - v0);
+		}
+
+		if (intersectTriangle(origin, direction, v0, v2, v3, closest))
+		{
+			hit = true;
+			normal = glm::cross(v2 - v0, v3 - v0);
+		}
+
+		if (hit) t = closest;
+
+		return hit;
+	}
+
+	// Moller-Trumbore, both sides count. Only takes hits closer than t, which it then lowers
+	static bool intersectTriangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& t)
+	{
+		const float epsilon = 1e-6f;
+
+		glm::vec3 ab = b - a;
+		glm::vec3 ac = c - a;
+
+		glm::vec3 p = glm::cross(direction, ac);
+		float determinant = glm::dot(ab, p);
+
+		if (std::abs(determinant) < 1e-12f) return false;
+
+		float inverseDeterminant = 1.0f / determinant;
+		glm::vec3 fromA = origin - a;
+
+		float u = glm::dot(fromA, p) * inverseDeterminant;
+		if (u < -epsilon || u > 1 + epsilon) return false;
+
+		glm::vec3 q = glm::cross(fromA, ab);
+
+		float v = glm::dot(direction, q) * inverseDeterminant;
+		if (v < -epsilon || u + v > 1 + epsilon) return false;
+
+		float hitT = glm::dot(ac, q) * inverseDeterminant;
+		if (hitT < 0 || hitT >= t) return false;
+
+		t = hitT;
+		return true;
+	}
+
+	std::vector<std::vector<glm::vec2>> mLevels; // Lowest (x) and highest (y) height of each node, row by row
+	std::vector<int> mLevelSizes; // Nodes per side
+};
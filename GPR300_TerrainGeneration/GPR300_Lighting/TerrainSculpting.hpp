@@ -0,0 +1,343 @@
+#pragma once
+#include "TerrainQuery.hpp"
+#include <cmath>
+
+
+enum SculptTool
+{
+	SCULPT_RAISE,
+	SCULPT_LOWER,
+	SCULPT_SMOOTH,
+	SCULPT_FLATTEN
+};
+
+
+struct SculptBrush
+{
+	int tool = SCULPT_RAISE;
+	float radius = 5; // Local units, same as the terrain's width and length
+
+	// 0 to 1. At 1 raise and lower move the brush's centre by the terrain's whole height range per second, smooth and
+	// flatten get most of the way there in about a tenth of a second
+	float strength = .25f;
+};
+
+
+// Inclusive range of grid vertices, empty while max is below min
+struct GridRect
+{
+	int minX = 0;
+	int minY = 0;
+	int maxX = -1;
+	int maxY = -1;
+
+	bool isEmpty() const { return maxX < minX || maxY < minY; }
+
+	int getWidth() const { return maxX - minX + 1; }
+	int getHeight() const { return maxY - minY + 1; }
+
+	void add(const GridRect& other)
+	{
+		if (other.isEmpty()) return;
+
+		if (isEmpty())
+		{
+			*this = other;
+			return;
+		}
+
+		minX = glm::min(minX, other.minX);
+		minY = glm::min(minY, other.minY);
+		maxX = glm::max(maxX, other.maxX);
+		maxY = glm::max(maxY, other.maxY);
+	}
+
+	// Grown by amount on every side, but kept on the grid
+	GridRect expanded(int amount, int resolution) const
+	{
+		GridRect rect;
+
+		if (isEmpty()) return rect;
+
+		rect.minX = glm::max(minX - amount, 0);
+		rect.minY = glm::max(minY - amount, 0);
+		rect.maxX = glm::min(maxX + amount, resolution);
+		rect.maxY = glm::min(maxY + amount, resolution);
+
+		return rect;
+	}
+};
+
+
+// Shared grid vertices (the same ones generateSharedTerrainFromHeightmap makes) for the vertices in rect. Row y of the
+// rect goes to vertices + (y - rect.minY) * rowStride, so it can write into the whole mesh or a staging area of just
+// the rect. Normals read the heights around the rect too, so they match a full rebuild
+void writeHeightFieldVertices(const HeightField& heightField, const TerrainInfo& terrainInfo, const GridRect& rect, Vertex* vertices, size_t rowStride)
+{
+	int resolution = heightField.resolution;
+	int rowSize = heightField.getRowSize();
+
+	float halfWidth = terrainInfo.width / 2.0f;
+	float halfHeight = terrainInfo.length / 2.0f;
+
+	float triangleWidth = terrainInfo.width / resolution;
+	float triangleHeight = terrainInfo.length / resolution;
+
+	// Normals go one vertex past the rect on each side where there is one, so the rect's own edges get both neighbors
+	int spanStart = glm::max(rect.minX - 1, 0);
+	int spanEnd = glm::min(rect.maxX + 1, resolution);
+	int spanCount = spanEnd - spanStart + 1;
+
+	getThreadPool().parallelFor(rect.getHeight(), [&](int startRow, int endRow)
+	{
+		std::vector<glm::vec3> normals(spanCount);
+
+		for (int row = startRow; row < endRow; row++)
+		{
+			int y = rect.minY + row;
+
+			const float* heights = &heightField.heights[(size_t)y * rowSize];
+			const float* above = &heightField.heights[(size_t)glm::max(y - 1, 0) * rowSize];
+			const float* below = &heightField.heights[(size_t)glm::min(y + 1, resolution) * rowSize];
+
+			computeNormalRow(above + spanStart, heights + spanStart, below + spanStart, spanCount, triangleWidth, triangleHeight, normals.data());
+
+			Vertex* rowVertices = vertices + (size_t)row * rowStride;
+
+			for (int x = rect.minX; x <= rect.maxX; x++)
+			{
+				Vertex& vertex = rowVertices[x - rect.minX];
+
+				vertex.position = glm::vec3(-halfWidth + (triangleWidth * x), heights[x], -halfHeight + (triangleHeight * y));
+				vertex.normal = normals[x - spanStart];
+				vertex.uv = glm::vec2(x, y);
+			}
+		}
+	});
+}
+
+
+// Single mesh terrain whose heights can be edited with brushes. Each brush stroke only touches the heights under it
+// and marks them dirty, then uploadDirty rewrites those vertices and the row of neighbors around them (whose normals
+// changed) with one buffer sub range update per row. The quadtree is caught up at the same time, so raycasts for the
+// next dab already hit the edited surface. Heights live on the CPU (4 bytes per vertex), the vertices only on the GPU
+class SculptedTerrain
+{
+public:
+	SculptedTerrain() {}
+
+	// CPU half, takes its own copy of the heights and quadtree the terrain query was built with
+	void prepare(const TerrainInfo& terrainInfo, const TerrainQueryData& queryData)
+	{
+		mPendingTerrainInfo = terrainInfo;
+		mPendingData = std::make_shared<TerrainQueryData>(queryData);
+
+		int resolution = terrainInfo.resolution;
+		int rowSize = resolution + 1;
+
+		GridRect all;
+		all.maxX = resolution;
+		all.maxY = resolution;
+
+		mPendingMeshData.vertices.resize((size_t)rowSize * rowSize);
+		writeHeightFieldVertices(mPendingData->heightField, terrainInfo, all, mPendingMeshData.vertices.data(), rowSize);
+
+		generateGridIndices(resolution, mPendingMeshData);
+	}
+
+	// GL half, drops any edits to the old terrain
+	void upload()
+	{
+		mMesh.initialize(&mPendingMeshData);
+		mPendingMeshData = MeshData();
+
+		mTerrainInfo = mPendingTerrainInfo;
+		mData = mPendingData;
+		mPendingData = nullptr;
+
+		mDirty = GridRect();
+		mStroke = false;
+	}
+
+	void draw()
+	{
+		if (!mData) return;
+
+		mMesh.draw();
+	}
+
+	// World space, against the heights as they are now
+	TerrainRayHit raycast(const glm::vec3& origin, const glm::vec3& direction, const glm::mat4& transform) const
+	{
+		if (!mData) return TerrainRayHit();
+
+		return TerrainQuery(mData, mTerrainInfo, transform).raycast(origin, direction);
+	}
+
+	// Flatten levels everything to the height where the stroke starts
+	void beginStroke(const glm::vec3& worldPosition, const glm::mat4& transform)
+	{
+		mStroke = true;
+		mFlattenHeight = glm::vec3(glm::inverse(transform) * glm::vec4(worldPosition, 1)).y;
+	}
+
+	// Applies the brush centred on a point of the terrain (world space) for deltaTime seconds, returns whether any
+	// height changed
+	bool sculpt(const glm::vec3& worldPosition, const glm::mat4& transform, const SculptBrush& brush, float deltaTime)
+	{
+		if (!mData || !mStroke || brush.radius <= 0) return false;
+
+		HeightField& heightField = mData->heightField;
+		int resolution = heightField.resolution;
+		int rowSize = heightField.getRowSize();
+
+		float cellWidth = mTerrainInfo.width / resolution;
+		float cellLength = mTerrainInfo.length / resolution;
+
+		glm::vec3 local = glm::vec3(glm::inverse(transform) * glm::vec4(worldPosition, 1));
+
+		glm::vec2 center((local.x + mTerrainInfo.width / 2) / cellWidth, (local.z + mTerrainInfo.length / 2) / cellLength);
+		glm::vec2 radius(brush.radius / cellWidth, brush.radius / cellLength);
+
+		GridRect rect;
+		rect.minX = glm::max((int)std::ceil(center.x - radius.x), 0);
+		rect.minY = glm::max((int)std::ceil(center.y - radius.y), 0);
+		rect.maxX = glm::min((int)std::floor(center.x + radius.x), resolution);
+		rect.maxY = glm::min((int)std::floor(center.y + radius.y), resolution);
+
+		if (rect.isEmpty()) return false;
+
+		// Smoothing reads the neighbors as they were before this dab, so rows don't smear into the ones after them
+		GridRect source = rect.expanded(1, resolution);
+
+		if (brush.tool == SCULPT_SMOOTH)
+		{
+			mScratch.resize((size_t)source.getWidth() * source.getHeight());
+
+			for (int y = source.minY; y <= source.maxY; y++)
+			{
+				const float* row = &heightField.heights[(size_t)y * rowSize + source.minX];
+				std::copy(row, row + source.getWidth(), &mScratch[(size_t)(y - source.minY) * source.getWidth()]);
+			}
+		}
+
+		float heightRange = mTerrainInfo.maxHeight - mTerrainInfo.minHeight;
+
+		auto before = [&](int x, int y)
+		{
+			x = glm::clamp(x, source.minX, source.maxX);
+			y = glm::clamp(y, source.minY, source.maxY);
+			return mScratch[(size_t)(y - source.minY) * source.getWidth() + (x - source.minX)];
+		};
+
+		getThreadPool().parallelFor(rect.getHeight(), [&](int startRow, int endRow)
+		{
+			for (int y = rect.minY + startRow; y < rect.minY + endRow; y++)
+			{
+				float* row = &heightField.heights[(size_t)y * rowSize];
+
+				for (int x = rect.minX; x <= rect.maxX; x++)
+				{
+					glm::vec2 offset = (glm::vec2(x, y) - center) / radius;
+					float distanceSquared = glm::dot(offset, offset);
+
+					if (distanceSquared >= 1) continue;
+
+					// Smooth falloff, full strength in the middle and flat at the edge
+					float falloff = (1 - distanceSquared) * (1 - distanceSquared);
+
+					if (brush.tool == SCULPT_RAISE || brush.tool == SCULPT_LOWER)
+					{
+						float amount = brush.strength * heightRange * deltaTime * falloff;
+						row[x] += brush.tool == SCULPT_RAISE ? amount : -amount;
+						continue;
+					}
+
+					float target = mFlattenHeight;
+
+					if (brush.tool == SCULPT_SMOOTH)
+					{
+						target = (before(x - 1, y - 1) + before(x, y - 1) + before(x + 1, y - 1) +
+							before(x - 1, y) + before(x, y) + before(x + 1, y) +
+							before(x - 1, y + 1) + before(x, y + 1) + before(x + 1, y + 1)) / 9;
+					}
+
+					// Exponential approach, so the result doesn't depend on the frame rate
+					float blend = 1 - std::exp(-20 * brush.strength * deltaTime * falloff);
+					row[x] += (target - row[x]) * blend;
+				}
+			}
+		});
+
+		mData->quadtree.update(heightField, rect.minX, rect.minY, rect.maxX, rect.maxY);
+		mDirty.add(rect);
+		mStrokeChanged = true;
+
+		return true;
+	}
+
+	// Returns whether the stroke changed anything, the terrain query needs a new copy of the heights then
+	bool endStroke()
+	{
+		bool changed = mStroke && mStrokeChanged;
+
+		mStroke = false;
+		mStrokeChanged = false;
+
+		return changed;
+	}
+
+	// Call on the GL thread once a frame, sends every vertex whose position or normal changed since the last call.
+	// Returns how many vertices that was
+	size_t uploadDirty()
+	{
+		if (mDirty.isEmpty()) return 0;
+
+		// Normals use the heights on either side
+		GridRect rect = mDirty.expanded(1, mTerrainInfo.resolution);
+		mDirty = GridRect();
+
+		int width = rect.getWidth();
+
+		mStaging.resize((size_t)width * rect.getHeight());
+		writeHeightFieldVertices(mData->heightField, mTerrainInfo, rect, mStaging.data(), width);
+
+		size_t rowSize = (size_t)mTerrainInfo.resolution + 1;
+
+		// Rows of the rect aren't next to each other in the buffer, so one sub range each instead of the whole span
+		for (int y = rect.minY; y <= rect.maxY; y++)
+		{
+			mMesh.updateVertices(&mStaging[(size_t)(y - rect.minY) * width], y * rowSize + rect.minX, width);
+		}
+
+		return mStaging.size();
+	}
+
+	// Copy of the heights as they are now, for a terrain query that other threads can keep using while sculpting goes on
+	HeightField getHeightField() const
+	{
+		return mData ? mData->heightField : HeightField();
+	}
+
+	bool isStroking() const { return mStroke; }
+	const TerrainInfo& getTerrainInfo() const { return mTerrainInfo; }
+
+private:
+	Mesh mMesh;
+
+	TerrainInfo mTerrainInfo = TerrainInfo(0, 0, 0, 0, 0);
+	std::shared_ptr<TerrainQueryData> mData; // Heights being edited, never handed out since they change under anyone reading them
+
+	TerrainInfo mPendingTerrainInfo = TerrainInfo(0, 0, 0, 0, 0);
+	std::shared_ptr<TerrainQueryData> mPendingData;
+	MeshData mPendingMeshData;
+
+	GridRect mDirty; // Vertices whose heights changed since the last upload
+
+	bool mStroke = false;
+	bool mStrokeChanged = false;
+	float mFlattenHeight = 0;
+
+	std::vector<float> mScratch;
+	std::vector<Vertex> mStaging;
+};
@@ -0,0 +1,346 @@
+#pragma once
+#include "TiledHeightMap.hpp"
+#include "TerrainGeneration.hpp"
+#include "Frustum.hpp"
+#include "EW/Shader.h"
+#include <algorithm>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+const int DEFAULT_STREAMED_TILE_RADIUS = 3; // Tiles kept loaded in every direction around the camera's tile
+const int DEFAULT_STREAMED_TILE_CAPACITY = 128; // Tile textures kept around, recently used ones outside the radius stay until this is passed
+const int MAX_STREAMED_TILE_UPLOADS = 4; // Per frame, so a burst of finished tiles doesn't hitch
+
+
+// Terrain drawn straight from a tiled heightmap, only the tiles around the camera are ever decoded. Decoding (and the
+// page faults that read a tile in from disk) happens on the thread pool, the render thread just uploads finished tiles
+// and keeps an LRU of their textures. Every tile draws the same flat grid, terrainShader.vert's tile mode reads the
+// heights from the tile's texture like GPU displacement does
+class StreamedTerrain
+{
+public:
+	StreamedTerrain() {}
+
+	~StreamedTerrain()
+	{
+		release();
+	}
+
+	// CPU half, only maps the file and checks its tile table, nothing is decoded. Returns false (and prints why) if the
+	// file can't be opened
+	bool prepare(const std::string& path)
+	{
+		std::shared_ptr<TiledHeightMap> map = std::make_shared<TiledHeightMap>();
+
+		if (!map->open(path)) return false;
+
+		mPendingMap = map;
+
+		// Grid of one tile's cells, positions come from the shader so only the uvs (grid coordinates) matter
+		int tileSize = map->getTileSize();
+
+		if (tileSize != mGridTileSize)
+		{
+			generateFlatTerrainGrid(TerrainInfo(tileSize, (float)tileSize, (float)tileSize, 0, 0), mPendingGrid);
+			mGridChanged = true;
+			mGridTileSize = tileSize;
+		}
+
+		return true;
+	}
+
+	// GL half, drops every tile of the old map. Decodes still running for it are thrown away when they finish
+	void upload()
+	{
+		releaseTiles();
+
+		mMap = mPendingMap;
+		mPendingMap = nullptr;
+
+		if (mGridChanged)
+		{
+			mGrid.initialize(&mPendingGrid);
+
+			mPendingGrid = MeshData();
+			mGridChanged = false;
+		}
+	}
+
+	// Call once a frame on the render thread. Asks for the tiles within radius of the camera (in the terrain's local
+	// space), closest first, uploads a few that have finished decoding and evicts the least recently used past capacity
+	void update(const glm::vec3& localCameraPosition, const glm::vec2& dimensions, int radius, int capacity)
+	{
+		if (!mMap) return;
+
+		int tileSize = mMap->getTileSize();
+		int tilesX = mMap->getTilesX();
+		int tilesY = mMap->getTilesY();
+
+		glm::vec2 cellSize = getCellSize(dimensions);
+		glm::vec2 cameraSample = (glm::vec2(localCameraPosition.x, localCameraPosition.z) + dimensions * .5f) / cellSize;
+
+		// Off the edge of the map still streams the closest tiles
+		int cameraTileX = glm::clamp((int)glm::floor(cameraSample.x / tileSize), 0, tilesX - 1);
+		int cameraTileY = glm::clamp((int)glm::floor(cameraSample.y / tileSize), 0, tilesY - 1);
+
+		mWanted.clear();
+
+		for (int tileY = glm::max(cameraTileY - radius, 0); tileY <= glm::min(cameraTileY + radius, tilesY - 1); tileY++)
+		{
+			for (int tileX = glm::max(cameraTileX - radius, 0); tileX <= glm::min(cameraTileX + radius, tilesX - 1); tileX++)
+			{
+				mWanted.push_back(tileY * tilesX + tileX);
+			}
+		}
+
+		std::sort(mWanted.begin(), mWanted.end(), [&](int a, int b)
+		{
+			glm::vec2 aCenter = (glm::vec2(a % tilesX, a / tilesX) + .5f) * (float)tileSize;
+			glm::vec2 bCenter = (glm::vec2(b % tilesX, b / tilesX) + .5f) * (float)tileSize;
+
+			return glm::distance(aCenter, cameraSample) < glm::distance(bCenter, cameraSample);
+		});
+
+		// Closest first, so the tile under the camera is never stuck behind far ones
+		int maxDecoding = (int)getThreadPool().getNumThreads() * 2;
+
+		for (int index : mWanted)
+		{
+			auto resident = mResidentLookup.find(index);
+
+			if (resident != mResidentLookup.end())
+			{
+				mResident.splice(mResident.begin(), mResident, resident->second);
+			}
+			else if ((int)mDecoding.size() < maxDecoding && mDecoding.count(index) == 0 && mFailed.count(index) == 0)
+			{
+				startDecode(index);
+			}
+		}
+
+		uploadDecoded();
+
+		// Wanted tiles were all just moved to the front, so they never get evicted
+		size_t maxResident = (size_t)glm::max(capacity, (int)mWanted.size());
+
+		while (mResident.size() > maxResident)
+		{
+			glDeleteTextures(1, &mResident.back().texture);
+
+			mResidentLookup.erase(mResident.back().index);
+			mResident.pop_back();
+		}
+	}
+
+	// Draws the wanted tiles that are loaded and in the frustum (in the terrain's local space), returns how many
+	int draw(Shader& shader, const Frustum& frustum, const glm::vec2& dimensions, float redistribution, float minHeight, float maxHeight)
+	{
+		if (!mMap) return 0;
+
+		int tileSize = mMap->getTileSize();
+		int tilesX = mMap->getTilesX();
+
+		glm::vec2 cellSize = getCellSize(dimensions);
+		glm::vec2 lastSample = glm::vec2(mMap->getWidth(), mMap->getHeight()) - 1.0f;
+
+		// Min and max height come from _LocalMinHeight and _LocalMaxHeight, which the terrain shader already has
+		shader.setInt("_TileHeights", 4);
+		shader.setFloat("_Redistribution", redistribution);
+		shader.setVec2("_HeightMapSize", lastSample + 1.0f);
+
+		glActiveTexture(GL_TEXTURE4);
+
+		int numDrawn = 0;
+
+		for (int index : mWanted)
+		{
+			auto resident = mResidentLookup.find(index);
+
+			if (resident == mResidentLookup.end()) continue;
+
+			int tileX = index % tilesX;
+			int tileY = index / tilesX;
+
+			// Header min / max give the bounds without looking at the samples
+			const TiledHeightMapTile& tile = mMap->getTile(tileX, tileY);
+
+			glm::vec2 origin = glm::vec2(tileX, tileY) * (float)tileSize;
+			glm::vec2 boundsMin = origin * cellSize - dimensions * .5f;
+			glm::vec2 boundsMax = glm::min(origin + (float)tileSize, lastSample) * cellSize - dimensions * .5f;
+
+			float lowest = getRedistributedHeight(tile.minValue, redistribution, minHeight, maxHeight);
+			float highest = getRedistributedHeight(tile.maxValue, redistribution, minHeight, maxHeight);
+
+			if (!isBoxInFrustum(frustum, glm::vec3(boundsMin.x, lowest, boundsMin.y), glm::vec3(boundsMax.x, highest, boundsMax.y))) continue;
+
+			glBindTexture(GL_TEXTURE_2D, resident->second->texture);
+			shader.setVec2("_TileOrigin", origin);
+
+			mGrid.draw();
+			numDrawn++;
+		}
+
+		glActiveTexture(GL_TEXTURE0);
+
+		return numDrawn;
+	}
+
+	void release()
+	{
+		releaseTiles();
+
+		mMap = nullptr;
+		mGrid.release();
+		mGridTileSize = -1;
+	}
+
+	const TiledHeightMap* getMap() const { return mMap.get(); }
+
+	int getNumResident() const { return (int)mResident.size(); }
+	int getNumDecoding() const { return (int)mDecoding.size(); }
+	int getNumWanted() const { return (int)mWanted.size(); }
+	int getNumFailed() const { return (int)mFailed.size(); }
+
+	size_t getResidentBytes() const
+	{
+		int tileSamples = mMap ? mMap->getTileSamples() : 0;
+		return mResident.size() * tileSamples * tileSamples * sizeof(unsigned short);
+	}
+
+private:
+	struct DecodedTile
+	{
+		std::shared_ptr<const TiledHeightMap> map; // Map it was decoded from, tiles of a map that's since been replaced are dropped
+		int index;
+		bool succeeded;
+		std::vector<unsigned short> samples;
+	};
+
+	// Shared with the decode jobs so they can still hand tiles back if this is destroyed first
+	struct DecodeQueue
+	{
+		std::mutex mutex;
+		std::vector<DecodedTile> tiles;
+	};
+
+	struct ResidentTile
+	{
+		int index;
+		GLuint texture;
+	};
+
+	glm::vec2 getCellSize(const glm::vec2& dimensions) const
+	{
+		return dimensions / (glm::vec2(mMap->getWidth(), mMap->getHeight()) - 1.0f);
+	}
+
+	void startDecode(int index)
+	{
+		std::shared_ptr<const TiledHeightMap> map = mMap;
+		std::shared_ptr<DecodeQueue> queue = mDecodeQueue;
+
+		mDecoding.insert(index);
+
+		getThreadPool().submit([map, queue, index]
+		{
+			DecodedTile tile;
+			tile.map = map;
+			tile.index = index;
+
+			int tileSamples = map->getTileSamples();
+			tile.samples.resize((size_t)tileSamples * tileSamples);
+			tile.succeeded = map->decodeTile(index % map->getTilesX(), index / map->getTilesX(), tile.samples.data());
+
+			std::lock_guard<std::mutex> lock(queue->mutex);
+			queue->tiles.push_back(std::move(tile));
+		});
+	}
+
+	void uploadDecoded()
+	{
+		std::vector<DecodedTile> decoded;
+
+		{
+			std::lock_guard<std::mutex> lock(mDecodeQueue->mutex);
+
+			size_t count = glm::min(mDecodeQueue->tiles.size(), (size_t)MAX_STREAMED_TILE_UPLOADS);
+
+			std::move(mDecodeQueue->tiles.begin(), mDecodeQueue->tiles.begin() + count, std::back_inserter(decoded));
+			mDecodeQueue->tiles.erase(mDecodeQueue->tiles.begin(), mDecodeQueue->tiles.begin() + count);
+		}
+
+		// On the unit draw samples tiles from, so the terrain texture on unit 0 isn't replaced
+		glActiveTexture(GL_TEXTURE4);
+
+		for (DecodedTile& tile : decoded)
+		{
+			if (tile.map != mMap) continue;
+
+			mDecoding.erase(tile.index);
+
+			if (!tile.succeeded)
+			{
+				printf("Tiled heightmap %s: tile %d is corrupt, it won't be drawn\n", mMap->getPath().c_str(), tile.index);
+				mFailed.insert(tile.index);
+				continue;
+			}
+
+			ResidentTile resident;
+			resident.index = tile.index;
+
+			int tileSamples = mMap->getTileSamples();
+
+			// Same format and sampling as DisplacedTerrain's heightmap texture
+			glGenTextures(1, &resident.texture);
+			glBindTexture(GL_TEXTURE_2D, resident.texture);
+
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, tileSamples, tileSamples, 0, GL_RED, GL_UNSIGNED_SHORT, tile.samples.data());
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			mResident.push_front(resident);
+			mResidentLookup[tile.index] = mResident.begin();
+		}
+
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	void releaseTiles()
+	{
+		for (ResidentTile& resident : mResident)
+		{
+			glDeleteTextures(1, &resident.texture);
+		}
+
+		mResident.clear();
+		mResidentLookup.clear();
+		mDecoding.clear();
+		mFailed.clear();
+		mWanted.clear();
+	}
+
+	std::shared_ptr<const TiledHeightMap> mMap;
+	std::shared_ptr<const TiledHeightMap> mPendingMap;
+
+	std::shared_ptr<DecodeQueue> mDecodeQueue = std::make_shared<DecodeQueue>();
+	std::set<int> mDecoding;
+	std::set<int> mFailed;
+
+	std::list<ResidentTile> mResident; // Most recently used first
+	std::unordered_map<int, std::list<ResidentTile>::iterator> mResidentLookup;
+
+	std::vector<int> mWanted; // Closest first
+
+	Mesh mGrid;
+	MeshData mPendingGrid;
+	bool mGridChanged = false;
+	int mGridTileSize = -1; // Tile size of the last grid prepare built
+};
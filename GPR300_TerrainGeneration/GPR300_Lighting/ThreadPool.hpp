@@ -0,0 +1,162 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of worker threads that jobs can be split across
+class ThreadPool
+{
+public:
+	ThreadPool(unsigned int numThreads = std::thread::hardware_concurrency())
+	{
+		numThreads = std::max(numThreads, 1u);
+
+		// The thread calling parallelFor works too, so it only needs numThreads - 1 helpers
+		for (unsigned int i = 1; i < numThreads; i++)
+		{
+			workers.emplace_back([this] { workerLoop(); });
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+
+		queueCondition.notify_all();
+
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	// Counts the calling thread
+	unsigned int getNumThreads() const { return (unsigned int)workers.size() + 1; }
+
+
+	// Runs task on a worker without waiting for it
+	void submit(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			tasks.push_back(std::move(task));
+		}
+
+		queueCondition.notify_one();
+	}
+
+
+	// Calls func(start, end) on ranges covering [0, count) and returns once all of them are done
+	// maxThreads limits how many threads take part (0 uses all of them)
+	void parallelFor(int count, const std::function<void(int, int)>& func, unsigned int maxThreads = 0)
+	{
+		if (count <= 0) return;
+
+		unsigned int numThreads = getNumThreads();
+
+		if (maxThreads > 0)
+		{
+			numThreads = std::min(numThreads, maxThreads);
+		}
+
+		if (numThreads <= 1 || count == 1)
+		{
+			func(0, count);
+			return;
+		}
+
+		// Several ranges per thread so one slow range doesn't hold everything up
+		struct Job
+		{
+			std::function<void(int, int)> func;
+			int count;
+			int rangeSize;
+			int numRanges;
+
+			std::atomic<int> nextRange{ 0 };
+			std::atomic<int> rangesDone{ 0 };
+
+			std::mutex doneMutex;
+			std::condition_variable doneCondition;
+
+			void run()
+			{
+				int range;
+				while ((range = nextRange.fetch_add(1)) < numRanges)
+				{
+					int start = range * rangeSize;
+					func(start, std::min(start + rangeSize, count));
+
+					if (rangesDone.fetch_add(1) + 1 == numRanges)
+					{
+						std::lock_guard<std::mutex> lock(doneMutex);
+						doneCondition.notify_all();
+					}
+				}
+			}
+		};
+
+		// Shared so helpers that only start after the work is finished still have a valid job
+		std::shared_ptr<Job> job = std::make_shared<Job>();
+		job->func = func;
+		job->count = count;
+		job->rangeSize = std::max(1, count / (int)(numThreads * 4));
+		job->numRanges = (count + job->rangeSize - 1) / job->rangeSize;
+
+		for (unsigned int i = 1; i < numThreads; i++)
+		{
+			submit([job] { job->run(); });
+		}
+
+		job->run();
+
+		std::unique_lock<std::mutex> lock(job->doneMutex);
+		job->doneCondition.wait(lock, [&] { return job->rangesDone.load() == job->numRanges; });
+	}
+
+private:
+	void workerLoop()
+	{
+		while (true)
+		{
+			std::function<void()> task;
+
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueCondition.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+				if (stopping && tasks.empty()) return;
+
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+
+			task();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	bool stopping = false;
+};
+
+
+// Pool shared by all terrain work, sized to the machine's core count
+ThreadPool& getThreadPool()
+{
+	static ThreadPool threadPool;
+	return threadPool;
+}
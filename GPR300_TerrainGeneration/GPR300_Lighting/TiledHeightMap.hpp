@@ -0,0 +1,499 @@
+#pragma once
+#include "HeightMapCache.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+const int DEFAULT_HEIGHT_MAP_TILE_SIZE = 256;
+const int TILED_HEIGHT_MAP_APRON = 1; // Extra samples kept on every side of a tile, enough for central difference normals
+
+
+// Tiled heightmap file (.thm), little-endian:
+//   TiledHeightMapHeader
+//   TiledHeightMapTile for every tile, a row of tiles at a time
+//   Tile data
+// Tile x, y covers samples x * tileSize to (x + 1) * tileSize (its last row and column are the next tile's first) plus
+// the apron, so every tile can be drawn and lit without its neighbors. Samples past the edge of the map repeat the edge
+struct TiledHeightMapHeader
+{
+	char magic[4]; // "THM1"
+	uint32_t width;
+	uint32_t height;
+	uint32_t tileSize;
+	uint32_t tilesX;
+	uint32_t tilesY;
+	uint32_t reserved[2];
+};
+
+
+enum TiledHeightMapEncoding
+{
+	TILE_ENCODING_RAW, // uint16 samples
+	TILE_ENCODING_DELTA, // Difference from a prediction, zigzagged and stored 7 bits a byte, see encodeTileDeltas
+};
+
+
+struct TiledHeightMapTile
+{
+	uint64_t offset; // From the start of the file
+	uint32_t bytes;
+	uint16_t minValue; // Over every stored sample, apron included, so bounds are known without decoding
+	uint16_t maxValue;
+	uint32_t encoding;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(TiledHeightMapHeader) == 32, "TiledHeightMapHeader is written to disk as is");
+static_assert(sizeof(TiledHeightMapTile) == 24, "TiledHeightMapTile is written to disk as is");
+
+
+// Samples along each side of a stored tile
+int getTiledHeightMapTileSamples(int tileSize)
+{
+	return tileSize + 1 + 2 * TILED_HEIGHT_MAP_APRON;
+}
+
+
+// Left + above - above left, which is exact on slopes so smooth terrain only leaves small differences
+int predictTileSample(const unsigned short* samples, int rowSize, int x, int y)
+{
+	const unsigned short* sample = &samples[(size_t)y * rowSize + x];
+
+	if (y == 0) return x == 0 ? 0 : sample[-1];
+	if (x == 0) return sample[-rowSize];
+
+	return glm::clamp(sample[-1] + sample[-rowSize] - sample[-rowSize - 1], 0, HEIGHT_MAP_MAX_VALUE);
+}
+
+
+// Differences wrap at 16 bits and are zigzagged (0, -1, 1, -2, ...) so small ones of either sign take one byte
+void encodeTileDeltas(const unsigned short* samples, int rowSize, std::vector<unsigned char>& bytes)
+{
+	bytes.clear();
+
+	for (int y = 0; y < rowSize; y++)
+	{
+		for (int x = 0; x < rowSize; x++)
+		{
+			int difference = (int16_t)(samples[(size_t)y * rowSize + x] - predictTileSample(samples, rowSize, x, y));
+			unsigned int zigzag = difference >= 0 ? (unsigned int)difference * 2 : (unsigned int)-difference * 2 - 1;
+
+			while (zigzag >= 0x80)
+			{
+				bytes.push_back((unsigned char)(zigzag | 0x80));
+				zigzag >>= 7;
+			}
+
+			bytes.push_back((unsigned char)zigzag);
+		}
+	}
+}
+
+
+// Returns false if the data runs out or doesn't decode to 16-bit values
+bool decodeTileDeltas(const unsigned char* bytes, size_t numBytes, int rowSize, unsigned short* samples)
+{
+	const unsigned char* end = bytes + numBytes;
+
+	for (int y = 0; y < rowSize; y++)
+	{
+		for (int x = 0; x < rowSize; x++)
+		{
+			unsigned int zigzag = 0;
+
+			for (int shift = 0;; shift += 7)
+			{
+				if (bytes == end || shift > 14) return false;
+
+				unsigned char byte = *bytes++;
+				zigzag |= (unsigned int)(byte & 0x7F) << shift;
+
+				if ((byte & 0x80) == 0) break;
+			}
+
+			if (zigzag > 0xFFFF) return false;
+
+			int difference = (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+			samples[(size_t)y * rowSize + x] = (unsigned short)(predictTileSample(samples, rowSize, x, y) + difference);
+		}
+	}
+
+	return bytes == end;
+}
+
+
+// Tiled heightmap read through a memory mapping. Opening only reads the header and tile table, tile data is paged in
+// from disk as tiles get decoded. decodeTile only reads, so any number of threads can decode at once
+class TiledHeightMap
+{
+public:
+	TiledHeightMap() {}
+
+	// Prints why and returns false if the file isn't a tiled heightmap
+	bool open(const std::string& path)
+	{
+		mPath = path;
+		mTiles = nullptr;
+
+		if (!isLittleEndian())
+		{
+			printf("Failed to open tiled heightmap %s: only little-endian machines can read it\n", path.c_str());
+			return false;
+		}
+
+		// Tiles are read wherever the camera is, so read ahead wouldn't help
+		if (!mFile.open(path, true))
+		{
+			printf("Failed to open tiled heightmap %s: can't map file\n", path.c_str());
+			return false;
+		}
+
+		if (mFile.getSize() < sizeof(TiledHeightMapHeader))
+		{
+			printf("Failed to open tiled heightmap %s: file is too small\n", path.c_str());
+			return false;
+		}
+
+		memcpy(&mHeader, mFile.getData(), sizeof(mHeader));
+
+		if (memcmp(mHeader.magic, "THM1", 4) != 0 || mHeader.width < 2 || mHeader.height < 2 || mHeader.tileSize == 0 ||
+			mHeader.tilesX != getTileCount(mHeader.width, mHeader.tileSize) || mHeader.tilesY != getTileCount(mHeader.height, mHeader.tileSize))
+		{
+			printf("Failed to open tiled heightmap %s: bad header\n", path.c_str());
+			return false;
+		}
+
+		if (mFile.getSize() < sizeof(TiledHeightMapHeader) + (size_t)getNumTiles() * sizeof(TiledHeightMapTile))
+		{
+			printf("Failed to open tiled heightmap %s: tile table is cut off\n", path.c_str());
+			return false;
+		}
+
+		// Mappings start on a page, so the table right after the 32 byte header is aligned well enough to read in place
+		mTiles = (const TiledHeightMapTile*)(mFile.getData() + sizeof(TiledHeightMapHeader));
+
+		return true;
+	}
+
+	// Fills getTileSamples() squared samples, row by row. Returns false if the tile's data is out of the file or corrupt
+	bool decodeTile(int tileX, int tileY, unsigned short* samples) const
+	{
+		const TiledHeightMapTile& tile = getTile(tileX, tileY);
+		int rowSize = getTileSamples();
+
+		if (tile.offset > mFile.getSize() || tile.bytes > mFile.getSize() - tile.offset) return false;
+
+		const unsigned char* data = mFile.getData() + tile.offset;
+
+		if (tile.encoding == TILE_ENCODING_DELTA)
+		{
+			return decodeTileDeltas(data, tile.bytes, rowSize, samples);
+		}
+
+		size_t numSamples = (size_t)rowSize * rowSize;
+
+		if (tile.encoding != TILE_ENCODING_RAW || tile.bytes != numSamples * sizeof(unsigned short)) return false;
+
+		memcpy(samples, data, tile.bytes);
+		return true;
+	}
+
+	// Enough tiles of tileSize cells to cover size samples
+	static uint32_t getTileCount(uint32_t size, uint32_t tileSize)
+	{
+		return (size - 2) / tileSize + 1;
+	}
+
+	const TiledHeightMapTile& getTile(int tileX, int tileY) const { return mTiles[(size_t)tileY * mHeader.tilesX + tileX]; }
+
+	int getWidth() const { return (int)mHeader.width; }
+	int getHeight() const { return (int)mHeader.height; }
+	int getTileSize() const { return (int)mHeader.tileSize; }
+	int getTileSamples() const { return getTiledHeightMapTileSamples(getTileSize()); }
+	int getTilesX() const { return (int)mHeader.tilesX; }
+	int getTilesY() const { return (int)mHeader.tilesY; }
+	int getNumTiles() const { return getTilesX() * getTilesY(); }
+	size_t getFileBytes() const { return mFile.getSize(); }
+	const std::string& getPath() const { return mPath; }
+
+private:
+	std::string mPath;
+	MappedFile mFile;
+
+	TiledHeightMapHeader mHeader;
+	const TiledHeightMapTile* mTiles = nullptr;
+};
+
+
+// Reads a heightmap a row at a time. Raw files are read straight off disk so DEMs too big to load can still be worked
+// through, images can only be decoded whole so they come from the heightmap cache (blurred by blur)
+class HeightMapRowReader
+{
+public:
+	HeightMapRowReader() {}
+	HeightMapRowReader(const HeightMapRowReader&) = delete;
+	HeightMapRowReader& operator=(const HeightMapRowReader&) = delete;
+
+	~HeightMapRowReader()
+	{
+		close();
+	}
+
+	// Prints why and returns false if the source can't be read
+	bool open(const HeightMapSource& source, float blur)
+	{
+		close();
+
+		mFormat = getHeightMapFormat(source);
+
+		if (mFormat == HEIGHT_MAP_IMAGE)
+		{
+			mImage = getHeightMapCache().get(source, blur);
+
+			mWidth = mImage->width();
+			mHeight = mImage->height();
+
+			return !mImage->is_empty();
+		}
+
+		mFile = fopen(source.path.c_str(), "rb");
+
+		if (mFile == nullptr)
+		{
+			printf("Failed to load heightmap %s: can't open file\n", source.path.c_str());
+			return false;
+		}
+
+		bool isFloat = mFormat == HEIGHT_MAP_RAW_FLOAT32;
+
+		if (!getRawHeightMapSize(mFile, source, isFloat ? sizeof(float) : sizeof(uint16_t), mWidth, mHeight) ||
+			(isFloat && !getRawFloat32Range(mFile, source, (size_t)mWidth * mHeight, mMinValue, mMaxValue)))
+		{
+			close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void close()
+	{
+		if (mFile != nullptr) fclose(mFile);
+
+		mFile = nullptr;
+		mImage = nullptr;
+		mWidth = mHeight = 0;
+	}
+
+	// Fills width heights, returns false if the file ended early
+	bool readRow(int y, unsigned short* heights)
+	{
+		if (mImage)
+		{
+			memcpy(heights, mImage->data(0, y), mWidth * sizeof(unsigned short));
+			return true;
+		}
+
+		if (mFormat == HEIGHT_MAP_RAW_FLOAT32)
+		{
+			mFloats.resize(mWidth);
+
+			if (seekHeightMapFile(mFile, (long long)y * mWidth * sizeof(float), SEEK_SET) != 0 || readRawFloats(mFile, mFloats.data(), mWidth) != (size_t)mWidth) return false;
+
+			normalizeRawFloats(mFloats.data(), mWidth, mMinValue, mMaxValue, heights);
+			return true;
+		}
+
+		if (seekHeightMapFile(mFile, (long long)y * mWidth * sizeof(uint16_t), SEEK_SET) != 0 || fread(heights, sizeof(uint16_t), mWidth, mFile) != (size_t)mWidth) return false;
+
+		if (!isLittleEndian())
+		{
+			for (int x = 0; x < mWidth; x++)
+			{
+				heights[x] = (unsigned short)((heights[x] >> 8) | (heights[x] << 8));
+			}
+		}
+
+		return true;
+	}
+
+	int getWidth() const { return mWidth; }
+	int getHeight() const { return mHeight; }
+
+private:
+	HeightMapFormat mFormat = HEIGHT_MAP_IMAGE;
+
+	std::shared_ptr<const Image> mImage;
+
+	FILE* mFile = nullptr;
+	float mMinValue = 0;
+	float mMaxValue = 0;
+	std::vector<float> mFloats;
+
+	int mWidth = 0;
+	int mHeight = 0;
+};
+
+
+// Converts source into a tiled heightmap at path. Only one row of tiles (plus apron) is in memory at a time, so raw
+// DEMs of any size can be converted. Tiles are encoded across the thread pool, and with compress each one is delta
+// encoded if that comes out smaller. onProgress (if set) gets 0 to 1 as rows of tiles finish
+bool writeTiledHeightMap(const HeightMapSource& source, float blur, const std::string& path, int tileSize, bool compress, const std::function<void(float)>& onProgress = nullptr)
+{
+	if (!isLittleEndian())
+	{
+		printf("Failed to write tiled heightmap %s: only little-endian machines can write it\n", path.c_str());
+		return false;
+	}
+
+	HeightMapRowReader reader;
+
+	if (tileSize < 1 || !reader.open(source, blur)) return false;
+
+	int width = reader.getWidth();
+	int height = reader.getHeight();
+
+	if (width < 2 || height < 2)
+	{
+		printf("Failed to write tiled heightmap %s: heightmap has to be at least 2 x 2\n", path.c_str());
+		return false;
+	}
+
+	FILE* file = fopen(path.c_str(), "wb");
+
+	if (file == nullptr)
+	{
+		printf("Failed to write tiled heightmap %s: can't open file\n", path.c_str());
+		return false;
+	}
+
+	TiledHeightMapHeader header;
+	memcpy(header.magic, "THM1", 4);
+	header.width = width;
+	header.height = height;
+	header.tileSize = tileSize;
+	header.tilesX = TiledHeightMap::getTileCount(width, tileSize);
+	header.tilesY = TiledHeightMap::getTileCount(height, tileSize);
+	header.reserved[0] = header.reserved[1] = 0;
+
+	int tilesX = (int)header.tilesX;
+	int tilesY = (int)header.tilesY;
+	int rowSize = getTiledHeightMapTileSamples(tileSize);
+	size_t rawTileBytes = (size_t)rowSize * rowSize * sizeof(unsigned short);
+
+	// Table is filled in as tiles are written and goes back in at the end
+	std::vector<TiledHeightMapTile> tiles((size_t)tilesX * tilesY);
+	memset(tiles.data(), 0, tiles.size() * sizeof(TiledHeightMapTile));
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(tiles.data(), sizeof(TiledHeightMapTile), tiles.size(), file);
+
+	std::vector<unsigned short> band((size_t)rowSize * width);
+	std::vector<std::vector<unsigned short>> tileSamples(tilesX);
+	std::vector<std::vector<unsigned char>> tileBytes(tilesX);
+
+	bool failed = false;
+
+	for (int tileY = 0; tileY < tilesY && !failed; tileY++)
+	{
+		// Rows of this row of tiles, apron included, clamped to the map
+		for (int i = 0; i < rowSize && !failed; i++)
+		{
+			int y = glm::clamp(tileY * tileSize - TILED_HEIGHT_MAP_APRON + i, 0, height - 1);
+			failed = !reader.readRow(y, &band[(size_t)i * width]);
+		}
+
+		if (failed)
+		{
+			printf("Failed to write tiled heightmap %s: heightmap ended early\n", path.c_str());
+			break;
+		}
+
+		getThreadPool().parallelFor(tilesX, [&](int startTile, int endTile)
+		{
+			for (int tileX = startTile; tileX < endTile; tileX++)
+			{
+				std::vector<unsigned short>& samples = tileSamples[tileX];
+				samples.resize((size_t)rowSize * rowSize);
+
+				unsigned short lowest = HEIGHT_MAP_MAX_VALUE;
+				unsigned short highest = 0;
+
+				for (int y = 0; y < rowSize; y++)
+				{
+					for (int x = 0; x < rowSize; x++)
+					{
+						int bandX = glm::clamp(tileX * tileSize - TILED_HEIGHT_MAP_APRON + x, 0, width - 1);
+						unsigned short value = band[(size_t)y * width + bandX];
+
+						samples[(size_t)y * rowSize + x] = value;
+						lowest = glm::min(lowest, value);
+						highest = glm::max(highest, value);
+					}
+				}
+
+				TiledHeightMapTile& tile = tiles[(size_t)tileY * tilesX + tileX];
+				tile.minValue = lowest;
+				tile.maxValue = highest;
+				tile.encoding = TILE_ENCODING_RAW;
+
+				if (compress)
+				{
+					encodeTileDeltas(samples.data(), rowSize, tileBytes[tileX]);
+
+					if (tileBytes[tileX].size() < rawTileBytes)
+					{
+						tile.encoding = TILE_ENCODING_DELTA;
+					}
+				}
+			}
+		});
+
+		for (int tileX = 0; tileX < tilesX; tileX++)
+		{
+			TiledHeightMapTile& tile = tiles[(size_t)tileY * tilesX + tileX];
+
+			const void* data = tileSamples[tileX].data();
+			size_t bytes = rawTileBytes;
+
+			if (tile.encoding == TILE_ENCODING_DELTA)
+			{
+				data = tileBytes[tileX].data();
+				bytes = tileBytes[tileX].size();
+			}
+
+			tile.offset = (uint64_t)tellHeightMapFile(file);
+			tile.bytes = (uint32_t)bytes;
+
+			fwrite(data, 1, bytes, file);
+		}
+
+		if (onProgress) onProgress((float)(tileY + 1) / tilesY);
+	}
+
+	if (!failed)
+	{
+		seekHeightMapFile(file, sizeof(TiledHeightMapHeader), SEEK_SET);
+		fwrite(tiles.data(), sizeof(TiledHeightMapTile), tiles.size(), file);
+	}
+
+	// Write errors (a full disk) only show up for sure once the file is closed
+	failed = ferror(file) != 0 || failed;
+	failed = fclose(file) != 0 || failed;
+
+	if (failed)
+	{
+		printf("Failed to write tiled heightmap %s\n", path.c_str());
+		remove(path.c_str());
+		return false;
+	}
+
+	return true;
+}
@@ -13,6 +13,7 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#undef STB_IMAGE_IMPLEMENTATION // Headers below include stb_image.h again for the declarations only
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw.h"
@@ -26,6 +27,19 @@
 #include "EW/ShapeGen.h"
 
 #include "TerrainGeneration.hpp"
+#include "TerrainMesh.hpp"
+#include "TerrainChunks.hpp"
+#include "TerrainLOD.hpp"
+#include "TerrainDisplacement.hpp"
+#include "TerrainCompact.hpp"
+#include "TerrainAdaptive.hpp"
+#include "TerrainStreaming.hpp"
+#include "TerrainMeshCache.hpp"
+#include "TerrainQuery.hpp"
+#include "TerrainSculpting.hpp"
+#include "TerrainColors.hpp"
+#include "MeshOptimization.hpp"
+#include "BackgroundTask.hpp"
 
 void processInput(GLFWwindow* window);
 void resizeFrameBufferCallback(GLFWwindow* window, int width, int height);
@@ -72,13 +86,33 @@ ew::MeshData cubeMeshData;
 ew::MeshData sphereMeshData;
 ew::MeshData cylinderMeshData;
 ew::MeshData planeMeshData;
-ew::MeshData terrainMeshData;
 
 ew::Mesh cubeMesh;
 ew::Mesh sphereMesh;
 ew::Mesh planeMesh;
 ew::Mesh cylinderMesh;
-ew::Mesh terrainMesh;
+TerrainMesh terrainMesh;
+
+ChunkedTerrainData terrainChunkedData;
+ChunkedTerrainMesh terrainChunkedMesh;
+
+HeightField terrainHeightField; // Only holds heights between an LOD build and its upload
+TerrainLOD terrainLOD;
+
+DisplacedTerrain terrainDisplaced;
+
+CompactTerrain terrainCompact;
+
+AdaptiveTerrain terrainAdaptive;
+
+StreamedTerrain terrainStreamed;
+
+SculptedTerrain terrainSculpted;
+
+// Height and normal lookups on the built terrain. Replaced whole, anyone still querying the old one keeps it alive
+std::mutex terrainQueryMutex;
+std::shared_ptr<const TerrainQuery> terrainQuery;
+int terrainQueryBuild = 0; // Goes up every terrain build, so a query that finishes after a newer build is thrown away
 
 
 std::vector<glm::vec3> terrainColArray =
@@ -112,7 +146,60 @@ const int MAX_TERRAIN_COLORS = 32;
 
 float terrainBlendThreshold = .06f;
 
+// Colors, thresholds and blend baked for terrainShader.frag, only rebaked when the Color Info tab changes something
+TerrainColorTexture terrainColorTexture;
+bool terrainColorsChanged = true;
+
+const int TERRAIN_COLOR_TEXTURE_UNIT = 6;
+
 int terrainResolution = 1000;
+bool terrainSharedVertices = true;
+
+enum TerrainRenderMode
+{
+	SINGLE_MESH,
+	CHUNKED,
+	LOD,
+	GPU_DISPLACEMENT,
+	COMPACT,
+	ADAPTIVE,
+	STREAMED,
+	SCULPTED
+};
+
+const char* terrainRenderModeNames[] = { "Single Mesh", "Chunked", "LOD", "GPU Displacement", "Compact (Vertex Pulling)", "Adaptive (RTIN)", "Streamed Tiles", "Sculpted" };
+int terrainRenderMode = CHUNKED;
+int terrainDrawnRenderMode = CHUNKED; // Mode of the terrain that is actually built, lags behind while a rebuild runs
+
+BackgroundTask terrainBuildTask;
+bool terrainRebuildQueued = false; // Regenerate was asked for while a build was still running
+
+int terrainChunksDrawn = 0;
+
+bool terrainPackedNormals = true; // Compact terrain stores normals instead of working them out in the vertex shader
+
+float terrainAdaptiveMaxError = 1; // How far in world units the adaptive mesh can be off from the full resolution grid
+
+// Single mesh, chunked and adaptive meshes are saved to disk, so starting again with the same settings skips generating
+bool terrainMeshCacheEnabled = true;
+bool terrainLoadedFromCache = false; // Whether the terrain being drawn came from the mesh cache
+
+// Single mesh and chunked terrain get generated straight into mapped GPU buffers, so there's never a full copy of the
+// mesh in RAM. Mesh cache hits and height-only single mesh changes still go the usual way, but a build that does go
+// into GPU buffers has nothing to save to the cache, so it's off by default to let the cache fill
+bool terrainDirectUpload = false;
+
+int terrainStreamRadius = DEFAULT_STREAMED_TILE_RADIUS;
+int terrainStreamCapacity = DEFAULT_STREAMED_TILE_CAPACITY;
+
+// Left mouse button sculpts the sculpted terrain while the cursor is free
+SculptBrush terrainSculptBrush;
+const char* terrainSculptToolNames[] = { "Raise", "Lower", "Smooth", "Flatten" };
+size_t terrainSculptUploadedVertices = 0;
+double terrainSculptMilliseconds = 0;
+
+float terrainLODPixelError = 2; // How far in pixels a LOD level can be off from the full resolution terrain
+int terrainLODTrianglesDrawn = 0;
 
 float terrainWidth = 1000;
 float terrainLength = 1000;
@@ -120,9 +207,55 @@ float terrainLength = 1000;
 float localMinHeight = -20;
 float localMaxHeight = 120;
 
+char heightmapPath[256] = "TerrainGenerationImages/TerrainGenerationNoise.png";
+int heightmapFormat = HEIGHT_MAP_AUTO;
+int heightmapRawWidth = 0; // 0 means square, worked out from the file size
+int heightmapRawHeight = 0;
+
 float heightmapBlurAmount = 3;
 float heightmapRedistribution = 4;
 
+// Procedural terrain from SimplexNoise instead of the heightmap file
+bool proceduralEnabled = false;
+int proceduralSeed = 0;
+int proceduralOctaves = 6;
+float proceduralFrequency = 4;
+float proceduralPersistence = .5f;
+
+// Hydraulic and thermal erosion, run on the blurred heightmap before the terrain gets built from it
+ErosionInfo heightmapErosion;
+
+// Shaded relief of the erosion while it runs, written from whichever thread is eroding and shown in Heightmap Info
+struct ErosionPreview
+{
+	std::mutex mutex;
+	std::vector<unsigned char> pixels;
+	int width = 0;
+	int height = 0;
+	int iteration = 0;
+	bool changed = false;
+};
+
+const int EROSION_PREVIEW_SIZE = 256;
+const int EROSION_PREVIEW_TEXTURE_UNIT = 7; // Its own unit so uploading it doesn't replace anything the terrain samples
+
+ErosionPreview erosionPreview;
+GLuint erosionPreviewTexture = 0;
+int erosionPreviewWidth = 0;
+int erosionPreviewHeight = 0;
+int erosionPreviewIteration = 0;
+
+BackgroundTask erosionPreviewTask;
+
+int heightmapCacheMegabytes = (int)(DEFAULT_HEIGHT_MAP_CACHE_BYTES / (1024 * 1024));
+
+// Tiled heightmap the streamed render mode reads, made from the heightmap above with Convert To Tiled
+char tiledHeightmapPath[256] = "TerrainGenerationImages/TerrainGenerationNoise.thm";
+int tiledHeightmapTileSize = DEFAULT_HEIGHT_MAP_TILE_SIZE;
+bool tiledHeightmapCompressed = true;
+
+BackgroundTask tiledHeightmapConvertTask;
+
 float terrainNoiseInfluence = .4;
 
 
@@ -239,17 +372,530 @@ GLuint createTexture(const char* filePath, GLuint textureNum)
 
    
 
+TerrainInfo getTerrainInfo()
+{
+	return TerrainInfo(terrainResolution, terrainWidth, terrainLength, localMinHeight, localMaxHeight, terrainSharedVertices);
+}
+
+
+NoiseInfo getNoiseInfo()
+{
+	HeightMapSource source(heightmapPath, (HeightMapFormat)heightmapFormat, heightmapRawWidth, heightmapRawHeight);
+	ProceduralInfo procedural(proceduralEnabled, proceduralSeed, proceduralOctaves, proceduralFrequency, proceduralPersistence);
+
+	return NoiseInfo(source, heightmapBlurAmount, heightmapRedistribution, procedural, heightmapErosion);
+}
+
+
+// Called on the eroding thread every few iterations, the pixels are made there and only swapped in under the lock
+void updateErosionPreview(const HeightMapErosion& erosion)
+{
+	std::vector<unsigned char> pixels;
+	int width, height;
+
+	erosion.writePreview(pixels, width, height, EROSION_PREVIEW_SIZE);
+
+	std::lock_guard<std::mutex> lock(erosionPreview.mutex);
+
+	erosionPreview.pixels.swap(pixels);
+	erosionPreview.width = width;
+	erosionPreview.height = height;
+	erosionPreview.iteration = erosion.getIteration();
+	erosionPreview.changed = true;
+}
+
+
+// Main thread, once a frame. One channel, shown as gray
+void uploadErosionPreview()
+{
+	std::lock_guard<std::mutex> lock(erosionPreview.mutex);
+
+	if (!erosionPreview.changed) return;
+
+	erosionPreview.changed = false;
+
+	glActiveTexture(GL_TEXTURE0 + EROSION_PREVIEW_TEXTURE_UNIT);
+
+	if (erosionPreviewTexture == 0)
+	{
+		glGenTextures(1, &erosionPreviewTexture);
+		glBindTexture(GL_TEXTURE_2D, erosionPreviewTexture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		GLint swizzle[] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+		glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, erosionPreviewTexture);
+
+	// Rows of one byte pixels aren't 4 byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, erosionPreview.width, erosionPreview.height, 0, GL_RED, GL_UNSIGNED_BYTE, erosionPreview.pixels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	glActiveTexture(GL_TEXTURE0);
+
+	erosionPreviewWidth = erosionPreview.width;
+	erosionPreviewHeight = erosionPreview.height;
+	erosionPreviewIteration = erosionPreview.iteration;
+}
+
+
+std::shared_ptr<const TerrainQuery> getTerrainQuery()
+{
+	std::lock_guard<std::mutex> lock(terrainQueryMutex);
+	return terrainQuery;
+}
+
+
+// Returns the build number to publish the new terrain's query with
+int startTerrainQueryBuild()
+{
+	std::lock_guard<std::mutex> lock(terrainQueryMutex);
+	return ++terrainQueryBuild;
+}
+
+
+// Safe from any thread, does nothing if another terrain was built since
+void publishTerrainQuery(int build, std::shared_ptr<const TerrainQuery> query)
+{
+	std::lock_guard<std::mutex> lock(terrainQueryMutex);
+
+	if (build == terrainQueryBuild)
+	{
+		terrainQuery = query;
+	}
+}
+
+
+// Call once a frame, a moved terrain gets a new query sharing the same heights
+void updateTerrainQueryTransform()
+{
+	std::lock_guard<std::mutex> lock(terrainQueryMutex);
+
+	glm::mat4 transform = terrainTransform.getModelMatrix();
+
+	if (terrainQuery && terrainQuery->getTransform() != transform)
+	{
+		terrainQuery = std::make_shared<const TerrainQuery>(terrainQuery->getData(), terrainQuery->getTerrainInfo(), transform);
+	}
+}
+
+
+// Closest point where the ray (world space) hits the terrain, a miss until the current terrain has a query
+TerrainRayHit raycastTerrain(const glm::vec3& origin, const glm::vec3& direction)
+{
+	std::shared_ptr<const TerrainQuery> query = getTerrainQuery();
+
+	if (!query) return TerrainRayHit();
+
+	return query->raycast(origin, direction);
+}
+
+
+// Cursor position in window coordinates, the middle of the window while the mouse is looking around
+glm::vec2 getCursorWindowPosition(GLFWwindow* window)
+{
+	int windowWidth, windowHeight;
+	glfwGetWindowSize(window, &windowWidth, &windowHeight);
+
+	double cursorX = windowWidth * .5;
+	double cursorY = windowHeight * .5;
+
+	if (glfwGetInputMode(window, GLFW_CURSOR) != GLFW_CURSOR_DISABLED)
+	{
+		glfwGetCursorPos(window, &cursorX, &cursorY);
+	}
+
+	return glm::vec2((float)cursorX, (float)cursorY);
+}
+
+
+// World space direction from the camera through a point in the window (in window coordinates, like the cursor's)
+glm::vec3 getCameraRayDirection(float windowX, float windowY, int windowWidth, int windowHeight)
+{
+	glm::vec2 clip(2 * windowX / windowWidth - 1, 1 - 2 * windowY / windowHeight);
+	glm::mat4 clipToWorld = glm::inverse(camera.getProjectionMatrix() * camera.getViewMatrix());
+
+	glm::vec4 nearPoint = clipToWorld * glm::vec4(clip, -1, 1);
+	glm::vec4 farPoint = clipToWorld * glm::vec4(clip, 1, 1);
+
+	return glm::normalize(glm::vec3(farPoint) / farPoint.w - glm::vec3(nearPoint) / nearPoint.w);
+}
+
+
+// Heightmap loading and mesh generation run in the background while the old terrain keeps drawing,
+// the new one gets uploaded and swapped in on the main thread once it's done
 void generateTerrain()
 {
-	terrainMeshData.indices.clear();
-	terrainMeshData.vertices.clear();
+	if (terrainBuildTask.isRunning())
+	{
+		terrainRebuildQueued = true;
+		return;
+	}
+
+	// The UI keeps changing the globals while the build runs, so it works from a copy
+	TerrainInfo terrainInfo = getTerrainInfo();
+	NoiseInfo noiseInfo = getNoiseInfo();
+	int renderMode = terrainRenderMode;
+	bool packedNormals = terrainPackedNormals;
+	float adaptiveMaxError = terrainAdaptiveMaxError;
+	std::string tiledPath = tiledHeightmapPath;
+
+	// Stays false if the heightmap couldn't be loaded, the old terrain is kept then
+	std::shared_ptr<bool> built = std::make_shared<bool>(false);
+
+	// Set instead when the mesh cache had this exact terrain
+	std::shared_ptr<std::shared_ptr<const CachedTerrainMesh>> cachedMesh = std::make_shared<std::shared_ptr<const CachedTerrainMesh>>();
+
+	// Heights and quadtree for the terrain query, built alongside the mesh whenever the heightmap gets loaded anyway
+	std::shared_ptr<std::shared_ptr<const TerrainQueryData>> queryData = std::make_shared<std::shared_ptr<const TerrainQueryData>>();
+
+	// Buffers mapped here on the GL thread for generation to write into. Null if mapping isn't supported, which falls
+	// back to building in RAM
+	struct MappedTerrainBuffers
+	{
+		Vertex* vertices = nullptr;
+		unsigned int* indices = nullptr;
+	};
+
+	MappedTerrainBuffers mapped;
+
+	bool cacheableMode = renderMode == SINGLE_MESH || renderMode == CHUNKED || renderMode == ADAPTIVE;
+	uint64_t cacheKey = hashTerrainMesh(terrainInfo, noiseInfo, renderMode, adaptiveMaxError);
+
+	// A hit needs no generation at all, so buffers are only mapped when the cache doesn't have this terrain
+	bool cacheHit = terrainMeshCacheEnabled && cacheableMode && hasTerrainMeshCache(renderMode, cacheKey);
+
+	if (terrainDirectUpload && !cacheHit)
+	{
+		// Height-only changes rewrite the existing vertex buffer from the CPU copy, which beats generating everything again
+		if (renderMode == SINGLE_MESH && !terrainMesh.hasSameTopology(terrainInfo))
+		{
+			terrainMesh.map(terrainInfo, mapped.vertices, mapped.indices);
+		}
+		else if (renderMode == CHUNKED)
+		{
+			terrainChunkedMesh.map(terrainInfo, mapped.vertices, mapped.indices);
+		}
+	}
+
+	// A mapped build has no copy of the mesh in RAM to save, so it skips the cache
+	bool useMeshCache = terrainMeshCacheEnabled && cacheableMode && mapped.vertices == nullptr;
 
-	TerrainInfo terrainInfo = TerrainInfo(terrainResolution, terrainWidth, terrainLength, localMinHeight, localMaxHeight);
-	NoiseInfo noiseInfo = NoiseInfo("TerrainGenerationImages/TerrainGenerationNoise.png", heightmapBlurAmount, heightmapRedistribution);
+	terrainBuildTask.start([terrainInfo, noiseInfo, renderMode, packedNormals, adaptiveMaxError, tiledPath, useMeshCache, cacheKey, built, cachedMesh, queryData, mapped](BackgroundTask& task)
+	{
+		// Unchanged settings skip the heightmap and generation, the mesh goes from the file mapping straight to the GPU
+		if (useMeshCache)
+		{
+			task.setProgress(0, "Loading cached mesh");
+			*cachedMesh = loadTerrainMeshCache(renderMode, cacheKey);
 
-	createTerrain(terrainInfo, noiseInfo, terrainMeshData);
+			if (*cachedMesh)
+			{
+				*built = true;
+				task.setProgress(1, "Uploading");
+				return;
+			}
+		}
+
+		// Never loads the whole heightmap, only maps the tiled file. Tiles are decoded around the camera while drawing
+		if (renderMode == STREAMED)
+		{
+			task.setProgress(0, "Opening tiled heightmap");
+			*built = terrainStreamed.prepare(tiledPath);
 
-	terrainMesh.initialize(&terrainMeshData);
+			task.setProgress(1, "Uploading");
+			return;
+		}
+
+		task.setProgress(0, noiseInfo.procedural.enabled ? "Generating noise" : "Loading heightmap");
+
+		// Only gets called if the eroded heightmap wasn't cached
+		std::shared_ptr<const Image> heightMap = readHeightMap(terrainInfo, noiseInfo, [&task, &noiseInfo](const HeightMapErosion& erosion)
+		{
+			task.setProgress(.5f * erosion.getIteration() / noiseInfo.erosion.iterations, "Eroding");
+			updateErosionPreview(erosion);
+		});
+
+		if (heightMap->is_empty()) return;
+
+		task.setProgress(.5f, "Building terrain");
+
+		*queryData = generateTerrainQueryData(terrainInfo, noiseInfo, *heightMap);
+
+		if (mapped.vertices != nullptr)
+		{
+			if (renderMode == CHUNKED)
+			{
+				generateChunkedTerrainFromHeightmap(terrainInfo, noiseInfo, *heightMap, terrainChunkedData, mapped.vertices, mapped.indices);
+			}
+			else
+			{
+				generateTerrainFromHeightmap(terrainInfo, noiseInfo, *heightMap, mapped.vertices, mapped.indices);
+			}
+		}
+		else if (renderMode == CHUNKED)
+		{
+			generateChunkedTerrainFromHeightmap(terrainInfo, noiseInfo, *heightMap, terrainChunkedData);
+		}
+		else if (renderMode == LOD)
+		{
+			generateHeightField(terrainInfo, noiseInfo, *heightMap, terrainHeightField);
+			terrainLOD.prepare(terrainInfo, terrainHeightField);
+		}
+		else if (renderMode == GPU_DISPLACEMENT)
+		{
+			// Grid is only rebuilt if resolution, width or length changed
+			terrainDisplaced.prepare(terrainInfo, heightMap);
+		}
+		else if (renderMode == COMPACT)
+		{
+			terrainCompact.prepare(terrainInfo, noiseInfo, *heightMap, packedNormals);
+		}
+		else if (renderMode == ADAPTIVE)
+		{
+			terrainAdaptive.prepare(terrainInfo, noiseInfo, *heightMap, adaptiveMaxError);
+		}
+		else if (renderMode == SCULPTED)
+		{
+			// Starts from the heights the query was just built with
+			terrainSculpted.prepare(terrainInfo, **queryData);
+		}
+		else
+		{
+			// Only rebuilds everything if resolution, width, length or vertex sharing changed, otherwise just rewrites heights
+			terrainMesh.prepare(terrainInfo, noiseInfo, *heightMap);
+		}
+
+		if (useMeshCache)
+		{
+			task.setProgress(.9f, "Saving mesh cache");
+
+			if (renderMode == CHUNKED)
+			{
+				saveTerrainMeshCache(renderMode, cacheKey, terrainChunkedData.meshData, terrainChunkedData.chunks);
+			}
+			else if (renderMode == ADAPTIVE)
+			{
+				saveTerrainMeshCache(renderMode, cacheKey, terrainAdaptive.getPendingMeshData());
+			}
+			else
+			{
+				saveTerrainMeshCache(renderMode, cacheKey, terrainMesh.getMeshData());
+			}
+		}
+
+		*built = true;
+		task.setProgress(1, "Uploading");
+	},
+	[terrainInfo, noiseInfo, renderMode, built, cachedMesh, queryData, mapped]()
+	{
+		if (!*built)
+		{
+			// Nothing was written into the mapped buffers, they go without touching what's drawing
+			if (mapped.vertices != nullptr)
+			{
+				if (renderMode == CHUNKED)
+				{
+					terrainChunkedMesh.cancelMapped();
+				}
+				else
+				{
+					terrainMesh.cancelMapped();
+				}
+			}
+
+			return;
+		}
+
+		// The mapped buffers are swapped in first, if the driver lost what was written the old terrain stays and it's
+		// generated again
+		if (mapped.vertices != nullptr)
+		{
+			bool uploaded = renderMode == CHUNKED ? terrainChunkedMesh.uploadMapped(terrainChunkedData.chunks) : terrainMesh.uploadMapped();
+
+			if (!uploaded)
+			{
+				printf("Mapped terrain buffers were lost, generating again\n");
+				terrainRebuildQueued = true;
+				return;
+			}
+		}
+
+		int queryBuild = startTerrainQueryBuild();
+		glm::mat4 transform = terrainTransform.getModelMatrix();
+
+		if (*queryData)
+		{
+			publishTerrainQuery(queryBuild, std::make_shared<const TerrainQuery>(*queryData, terrainInfo, transform));
+		}
+		else if (renderMode == STREAMED)
+		{
+			// Tiles are only ever decoded around the camera, there's no full set of heights to query
+			publishTerrainQuery(queryBuild, nullptr);
+		}
+		else
+		{
+			// Came from the mesh cache without loading the heightmap, so the query catches up on the thread pool instead
+			// of holding up the first frame
+			getThreadPool().submit([terrainInfo, noiseInfo, transform, queryBuild]
+			{
+				std::shared_ptr<const Image> heightMap = readHeightMap(terrainInfo, noiseInfo);
+
+				if (heightMap->is_empty()) return;
+
+				publishTerrainQuery(queryBuild, std::make_shared<const TerrainQuery>(generateTerrainQueryData(terrainInfo, noiseInfo, *heightMap), terrainInfo, transform));
+			});
+		}
+
+		if (renderMode != SINGLE_MESH)
+		{
+			terrainMesh.release();
+		}
+
+		terrainLoadedFromCache = *cachedMesh != nullptr;
+
+		if (*cachedMesh)
+		{
+			const CachedTerrainMesh& cached = **cachedMesh;
+
+			if (renderMode == CHUNKED)
+			{
+				terrainChunkedMesh.initialize(cached.getVertices(), cached.getNumVertices(), cached.getIndices(), cached.getNumIndices(), cached.getChunks());
+			}
+			else if (renderMode == ADAPTIVE)
+			{
+				terrainAdaptive.upload(cached.getVertices(), cached.getNumVertices(), cached.getIndices(), cached.getNumIndices());
+			}
+			else
+			{
+				terrainMesh.upload(cached.getVertices(), cached.getNumVertices(), cached.getIndices(), cached.getNumIndices());
+			}
+
+			// Drops the mapping, the GPU has its own copy now
+			*cachedMesh = nullptr;
+		}
+		else if (mapped.vertices != nullptr)
+		{
+			// Already swapped in above
+		}
+		else if (renderMode == CHUNKED)
+		{
+			terrainChunkedMesh.initialize(&terrainChunkedData);
+
+			// Only needed until it's on the GPU
+			terrainChunkedData.meshData = MeshData();
+		}
+		else if (renderMode == LOD)
+		{
+			terrainLOD.upload(terrainHeightField);
+
+			// The GPU has the heights now, no need to keep them around until the next LOD build
+			terrainHeightField = HeightField();
+		}
+		else if (renderMode == GPU_DISPLACEMENT)
+		{
+			terrainDisplaced.upload();
+		}
+		else if (renderMode == COMPACT)
+		{
+			terrainCompact.upload();
+		}
+		else if (renderMode == ADAPTIVE)
+		{
+			terrainAdaptive.upload();
+		}
+		else if (renderMode == STREAMED)
+		{
+			terrainStreamed.upload();
+		}
+		else if (renderMode == SCULPTED)
+		{
+			terrainSculpted.upload();
+		}
+		else
+		{
+			terrainMesh.upload();
+		}
+
+		terrainDrawnRenderMode = renderMode;
+	});
+}
+
+
+// Call once a frame, brushes the sculpted terrain under the cursor while the left button is held and sends whatever
+// changed to the GPU. The terrain query gets a copy of the new heights once a stroke ends
+void updateTerrainSculpting(GLFWwindow* window)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	glm::mat4 transform = terrainTransform.getModelMatrix();
+
+	bool brushing = terrainDrawnRenderMode == SCULPTED && !terrainBuildTask.isRunning() &&
+		glfwGetInputMode(window, GLFW_CURSOR) != GLFW_CURSOR_DISABLED && !ImGui::GetIO().WantCaptureMouse &&
+		glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+
+	if (brushing)
+	{
+		int windowWidth, windowHeight;
+		glfwGetWindowSize(window, &windowWidth, &windowHeight);
+
+		glm::vec2 cursor = getCursorWindowPosition(window);
+		glm::vec3 cameraPosition = camera.getPosition();
+
+		TerrainRayHit hit = terrainSculpted.raycast(cameraPosition, getCameraRayDirection(cursor.x, cursor.y, windowWidth, windowHeight), transform);
+
+		if (hit.hit)
+		{
+			if (!terrainSculpted.isStroking())
+			{
+				terrainSculpted.beginStroke(hit.position, transform);
+			}
+
+			terrainSculpted.sculpt(hit.position, transform, terrainSculptBrush, deltaTime);
+		}
+	}
+	else if (terrainSculpted.endStroke())
+	{
+		// Other threads can be reading the current query, so it's replaced with one over a copy instead of edited
+		int queryBuild = startTerrainQueryBuild();
+		TerrainInfo terrainInfo = terrainSculpted.getTerrainInfo();
+
+		std::shared_ptr<TerrainQueryData> data = std::make_shared<TerrainQueryData>();
+		data->heightField = terrainSculpted.getHeightField();
+
+		getThreadPool().submit([data, terrainInfo, transform, queryBuild]
+		{
+			data->quadtree.build(data->heightField);
+			publishTerrainQuery(queryBuild, std::make_shared<const TerrainQuery>(data, terrainInfo, transform));
+		});
+	}
+
+	size_t uploaded = terrainSculpted.uploadDirty();
+
+	if (uploaded > 0)
+	{
+		auto end = std::chrono::high_resolution_clock::now();
+
+		terrainSculptUploadedVertices = uploaded;
+		terrainSculptMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	}
+}
+
+
+// Call once a frame, swaps in a finished build and starts the next one if it was asked for in the meantime
+void updateTerrainBuild()
+{
+	if (terrainBuildTask.poll() && terrainRebuildQueued)
+	{
+		terrainRebuildQueued = false;
+		generateTerrain();
+	}
 }
 
 
@@ -339,8 +985,68 @@ void drawScene(Shader &shader, glm::mat4 view, glm::mat4 projection, float time)
 	//shader.setMat4("_Model", planeTransform.getModelMatrix());
 	//planeMesh.draw();
 
-	shader.setMat4("_Model", terrainTransform.getModelMatrix());
-	terrainMesh.draw();
+	glm::mat4 terrainModel = terrainTransform.getModelMatrix();
+	shader.setMat4("_Model", terrainModel);
+
+	// Matches the VERTEX_MODE constants in terrainShader.vert
+	int vertexMode = 0;
+
+	if (terrainDrawnRenderMode == LOD)
+	{
+		vertexMode = 1;
+	}
+	else if (terrainDrawnRenderMode == GPU_DISPLACEMENT)
+	{
+		vertexMode = 2;
+	}
+	else if (terrainDrawnRenderMode == COMPACT)
+	{
+		vertexMode = 3;
+	}
+	else if (terrainDrawnRenderMode == STREAMED)
+	{
+		vertexMode = 4;
+	}
+
+	shader.setInt("_TerrainVertexMode", vertexMode);
+
+	if (terrainDrawnRenderMode == CHUNKED)
+	{
+		terrainChunksDrawn = terrainChunkedMesh.draw(extractFrustum(projection * view * terrainModel));
+	}
+	else if (terrainDrawnRenderMode == LOD)
+	{
+		terrainLODTrianglesDrawn = terrainLOD.draw(shader, terrainModel, view, projection, camera.getPosition(), camera.getFov(), SCREEN_HEIGHT, terrainLODPixelError);
+	}
+	else if (terrainDrawnRenderMode == GPU_DISPLACEMENT)
+	{
+		terrainDisplaced.draw(shader, heightmapRedistribution);
+	}
+	else if (terrainDrawnRenderMode == COMPACT)
+	{
+		terrainChunksDrawn = terrainCompact.draw(shader, extractFrustum(projection * view * terrainModel));
+	}
+	else if (terrainDrawnRenderMode == ADAPTIVE)
+	{
+		terrainAdaptive.draw();
+	}
+	else if (terrainDrawnRenderMode == SCULPTED)
+	{
+		terrainSculpted.draw();
+	}
+	else if (terrainDrawnRenderMode == STREAMED)
+	{
+		// Scene is drawn once a frame, so this is where tiles around the camera get asked for and uploaded
+		glm::vec2 dimensions(terrainWidth, terrainLength);
+		glm::vec3 localCameraPosition = glm::vec3(glm::inverse(terrainModel) * glm::vec4(camera.getPosition(), 1));
+
+		terrainStreamed.update(localCameraPosition, dimensions, terrainStreamRadius, terrainStreamCapacity);
+		terrainChunksDrawn = terrainStreamed.draw(shader, extractFrustum(projection * view * terrainModel), dimensions, heightmapRedistribution, localMinHeight, localMaxHeight);
+	}
+	else
+	{
+		terrainMesh.draw();
+	}
 }
 
 
@@ -402,6 +1108,11 @@ int main() {
 	ew::createCylinder(1.0f, 0.5f, 64, cylinderMeshData);
 	ew::createPlane(1.0f, 1.0f, planeMeshData);
 
+	// The sphere's rings go round in order, so most of its vertices get transformed twice. The cylinder's were already
+	// close to once each, it mostly gets the overdraw order
+	optimizeMesh(sphereMeshData);
+	optimizeMesh(cylinderMeshData);
+
 
 
 	terrainTransform.position = glm::vec3(0, -20, 0);
@@ -454,6 +1165,7 @@ int main() {
 
 	terrainShader.setInt("_Texture", 0);
 	terrainShader.setInt("_NoiseTexture", 1);
+	terrainShader.setInt("_TerrainColorTexture", TERRAIN_COLOR_TEXTURE_UNIT);
 
 
 	/*glActiveTexture(GL_TEXTURE1);
@@ -505,6 +1217,11 @@ int main() {
 
 	while (!glfwWindowShouldClose(window)) {
 		processInput(window);
+		updateTerrainBuild();
+		updateTerrainQueryTransform();
+		tiledHeightmapConvertTask.poll();
+		erosionPreviewTask.poll();
+		uploadErosionPreview();
 		glClearColor(bgColor.r, bgColor.g, bgColor.b, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -516,6 +1233,8 @@ int main() {
 		deltaTime = time - lastFrameTime;
 		lastFrameTime = time;
 
+		updateTerrainSculpting(window);
+
 		//UPDATE
 		//cubeTransform.rotation.x += deltaTime;
 
@@ -537,24 +1256,20 @@ int main() {
 		//glCullFace(GL_FRONT);
 		//drawScene(depthShader, lightView, lightProj, time);
 
-		GLint programIndex = 0;
-		glGetIntegerv(GL_CURRENT_PROGRAM, &programIndex);
-
 		terrainShader.setVec3("_ModelWorldPos", terrainTransform.position);
 		terrainShader.setFloat("_LocalMinHeight", localMinHeight);
 		terrainShader.setFloat("_LocalMaxHeight", localMaxHeight);
 
-		int numElements = terrainColArray.size(); // Can use for both colorArray and thresholds because they should always match
+		if (terrainColorsChanged)
+		{
+			terrainColorTexture.update(terrainColArray, terrainColThresholds, terrainBlendThreshold, TERRAIN_COLOR_TEXTURE_UNIT);
+			terrainColorsChanged = false;
+		}
 
-		terrainShader.setInt("_NumLoadedTerrainColors", numElements);
-		terrainShader.setFloat("_TerrainColorBlendThreshold", terrainBlendThreshold);
 		terrainShader.setFloat("_TerrainNoiseInfluence", terrainNoiseInfluence);
 
 		terrainShader.setVec2("_TerrainDimensions", glm::vec2(terrainWidth, terrainLength));
 
-		glUniform3fv(glGetUniformLocation(programIndex, "_TerrainColorArray"), numElements, &terrainColArray[0].x);
-		glUniform1fv(glGetUniformLocation(programIndex, "_TerrainColorThresholds"), numElements, &terrainColThresholds[0]);
-
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 		glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
@@ -578,19 +1293,310 @@ int main() {
 				ImGui::SliderFloat("Terrain Length", &terrainLength, .01, 5000);
 				ImGui::SliderInt("Terrain Resolution", &terrainResolution, 1, 4000);
 
+				if (ImGui::Combo("Render Mode", &terrainRenderMode, terrainRenderModeNames, IM_ARRAYSIZE(terrainRenderModeNames)))
+				{
+					generateTerrain();
+				}
+
+				if (terrainRenderMode == CHUNKED)
+				{
+					ImGui::Text("Chunks Drawn: %d / %d", terrainChunksDrawn, terrainChunkedMesh.getNumChunks());
+				}
+				else if (terrainRenderMode == LOD)
+				{
+					ImGui::SliderFloat("LOD Pixel Error", &terrainLODPixelError, .25, 16);
+					ImGui::Text("LOD Levels: %d, Nodes Drawn: %d, Triangles: %d", terrainLOD.getNumLevels(), terrainLOD.getNumSelectedNodes(), terrainLODTrianglesDrawn);
+				}
+				else if (terrainRenderMode == COMPACT)
+				{
+					if (ImGui::Checkbox("Packed Normals", &terrainPackedNormals))
+					{
+						generateTerrain();
+					}
+
+					ImGui::Text("Chunks Drawn: %d / %d", terrainChunksDrawn, terrainCompact.getNumChunks());
+					ImGui::Text("GPU Memory: %.2f MB, %.2f MB as a single mesh", terrainCompact.getGPUBytes() / (1024.0f * 1024.0f), terrainCompact.getMeshGPUBytes() / (1024.0f * 1024.0f));
+				}
+				else if (terrainRenderMode == ADAPTIVE)
+				{
+					if (ImGui::SliderFloat("Max Error", &terrainAdaptiveMaxError, .01, 20, "%.3f", ImGuiSliderFlags_Logarithmic))
+					{
+						generateTerrain();
+					}
+
+					ImGui::Text("Triangles: %zu, Vertices: %zu", terrainAdaptive.getNumTriangles(), terrainAdaptive.getNumVertices());
+
+					if (ImGui::Button("Benchmark Adaptive")) // Prints triangle counts and build times for every bundled heightmap
+					{
+						const char* heightMapPaths[] = { "TerrainGenerationImages/TerrainGenerationNoise.png", "TerrainGenerationImages/TerrainHeightmapNoise.png",
+							"TerrainGenerationImages/Alternative/TerrainGenerationNoise.png" };
+
+						for (const char* path : heightMapPaths)
+						{
+							std::shared_ptr<const Image> heightMap = getHeightMapCache().get(HeightMapSource(path), heightmapBlurAmount);
+
+							if (heightMap->is_empty()) continue;
+
+							std::cout << path << std::endl;
+							benchmarkAdaptiveTerrain(getTerrainInfo(), getNoiseInfo(), *heightMap);
+						}
+					}
+				}
+				else if (terrainRenderMode == STREAMED)
+				{
+					ImGui::InputText("Tiled Path", tiledHeightmapPath, sizeof(tiledHeightmapPath));
+					ImGui::SliderInt("Stream Radius (Tiles)", &terrainStreamRadius, 0, 16);
+					ImGui::SliderInt("Tile Capacity", &terrainStreamCapacity, 1, 1024);
+
+					const TiledHeightMap* tiledHeightMap = terrainStreamed.getMap();
+
+					if (tiledHeightMap != nullptr)
+					{
+						ImGui::Text("Map: %d x %d, %d x %d tiles of %d, %.1f MB on disk", tiledHeightMap->getWidth(), tiledHeightMap->getHeight(), tiledHeightMap->getTilesX(), tiledHeightMap->getTilesY(),
+							tiledHeightMap->getTileSize(), tiledHeightMap->getFileBytes() / (1024.0f * 1024.0f));
+						ImGui::Text("Tiles Drawn: %d / %d, Resident: %d (%.1f MB), Decoding: %d", terrainChunksDrawn, terrainStreamed.getNumWanted(), terrainStreamed.getNumResident(),
+							terrainStreamed.getResidentBytes() / (1024.0f * 1024.0f), terrainStreamed.getNumDecoding());
+					}
+					else
+					{
+						ImGui::Text("No tiled heightmap open, make one with Convert To Tiled in Heightmap Info");
+					}
+				}
+				else if (terrainRenderMode == SCULPTED)
+				{
+					ImGui::Combo("Brush", &terrainSculptBrush.tool, terrainSculptToolNames, IM_ARRAYSIZE(terrainSculptToolNames));
+					ImGui::SliderFloat("Brush Radius", &terrainSculptBrush.radius, .1f, 100);
+					ImGui::SliderFloat("Brush Strength", &terrainSculptBrush.strength, .01f, 1);
+					ImGui::Text("Hold left mouse with the cursor free to sculpt, regenerating throws the edits away");
+					ImGui::Text("Last Edit: %zu vertices uploaded, %.2fms", terrainSculptUploadedVertices, terrainSculptMilliseconds);
+				}
+				else if (terrainRenderMode == SINGLE_MESH)
+				{
+					ImGui::Checkbox("Shared Vertices", &terrainSharedVertices);
+					ImGui::Text("Vertices Uploaded Last Regenerate: %zu / %zu", terrainMesh.getLastUploadedVertices(), terrainMesh.getNumVertices());
+				}
+
+				if (terrainRenderMode == SINGLE_MESH || terrainRenderMode == CHUNKED || terrainRenderMode == ADAPTIVE)
+				{
+					ImGui::Checkbox("Cache Mesh On Disk", &terrainMeshCacheEnabled);
+					ImGui::SameLine();
+					ImGui::Text(terrainLoadedFromCache ? "(Loaded from cache)" : "(Generated)");
+				}
+
+				if (terrainRenderMode == SINGLE_MESH || terrainRenderMode == CHUNKED)
+				{
+					// Cache hits and height-only changes still go the usual way
+					ImGui::Checkbox("Generate Into GPU Buffers", &terrainDirectUpload);
+
+					if (terrainDirectUpload)
+					{
+						ImGui::TextWrapped("Meshes generated this way aren't saved to the mesh cache, and the single mesh keeps no CPU copy for height-only updates");
+					}
+				}
+
 				if (ImGui::Button("Regenerate Terrain"))
 				{
 					generateTerrain();
 				}
 
+				if (terrainBuildTask.isRunning())
+				{
+					ImGui::ProgressBar(terrainBuildTask.getProgress(), ImVec2(-1, 0), terrainBuildTask.getStage());
+				}
+
+				if (ImGui::Button("Benchmark Generation")) // Prints thread scaling to the console
+				{
+					std::shared_ptr<const Image> heightMap = readHeightMap(getTerrainInfo(), getNoiseInfo());
+
+					if (!heightMap->is_empty())
+					{
+						benchmarkTerrainGeneration(getTerrainInfo(), getNoiseInfo(), *heightMap);
+					}
+				}
+
+				if (ImGui::Button("Benchmark Vertex Cache")) // Prints miss ratios before and after reordering to the console
+				{
+					benchmarkVertexCache(terrainResolution);
+				}
+
+				std::shared_ptr<const TerrainQuery> query = getTerrainQuery();
+
+				if (query)
+				{
+					glm::vec3 cameraPosition = camera.getPosition();
+					float groundHeight = query->getHeight(glm::vec2(cameraPosition.x, cameraPosition.z));
+
+					ImGui::Text("Ground Below Camera: %.2f (%.2f above it)", groundHeight, cameraPosition.y - groundHeight);
+
+					// Whatever is under the cursor, or the middle of the screen while the mouse is looking around
+					int windowWidth, windowHeight;
+					glfwGetWindowSize(window, &windowWidth, &windowHeight);
+
+					glm::vec2 cursor = getCursorWindowPosition(window);
+					glm::vec3 rayDirection = getCameraRayDirection(cursor.x, cursor.y, windowWidth, windowHeight);
+
+					auto pickStart = std::chrono::high_resolution_clock::now();
+					TerrainRayHit pick = raycastTerrain(cameraPosition, rayDirection);
+					auto pickEnd = std::chrono::high_resolution_clock::now();
+
+					double pickMicroseconds = std::chrono::duration<double, std::micro>(pickEnd - pickStart).count();
+
+					if (pick.hit)
+					{
+						ImGui::Text("Cursor: (%.1f, %.1f, %.1f), %.1f away, picked in %.1fus", pick.position.x, pick.position.y, pick.position.z, pick.distance, pickMicroseconds);
+					}
+					else
+					{
+						ImGui::Text("Cursor: not on the terrain, %.1fus", pickMicroseconds);
+					}
+
+					if (ImGui::Button("Benchmark Queries")) // Prints height / normal queries per second to the console
+					{
+						benchmarkTerrainQuery(*query);
+					}
+
+					ImGui::SameLine();
+
+					if (ImGui::Button("Benchmark Raycasts")) // Prints microseconds per ray to the console
+					{
+						benchmarkTerrainRaycast(*query);
+					}
+				}
+
 				ImGui::EndTabItem();
 			}
 
 			if (ImGui::BeginTabItem("Heightmap Info"))
 			{
+				ImGui::Checkbox("Procedural", &proceduralEnabled);
+
+				if (proceduralEnabled)
+				{
+					ImGui::InputInt("Seed", &proceduralSeed);
+					ImGui::SliderInt("Octaves", &proceduralOctaves, 1, 12);
+					ImGui::SliderFloat("Frequency", &proceduralFrequency, .25f, 32);
+					ImGui::SliderFloat("Persistence", &proceduralPersistence, 0, 1);
+				}
+				else
+				{
+					// 16-bit PNGs and raw uint16 / float32 DEMs keep their precision, 8-bit images still work as before
+					ImGui::InputText("Path", heightmapPath, sizeof(heightmapPath));
+
+					const char* heightmapFormatNames[] = { "Auto (From Extension)", "Image", "Raw 16-bit", "Raw Float" };
+					ImGui::Combo("Format", &heightmapFormat, heightmapFormatNames, IM_ARRAYSIZE(heightmapFormatNames));
+
+					if (getHeightMapFormat(getNoiseInfo().source) != HEIGHT_MAP_IMAGE)
+					{
+						ImGui::InputInt("Raw Width", &heightmapRawWidth);
+						ImGui::InputInt("Raw Height", &heightmapRawHeight);
+						ImGui::Text("Leave width and height at 0 for a square file");
+					}
+				}
+
 				ImGui::SliderFloat("Blur Amount", &heightmapBlurAmount, 0, 30);
 				ImGui::SliderFloat("Redistribution", &heightmapRedistribution, 0, 10);
 
+				if (terrainRenderMode == GPU_DISPLACEMENT)
+				{
+					ImGui::Text("Redistribution updates live, blur needs a regenerate");
+				}
+
+				// Eroded heightmaps are cached like blurred ones, so previewing first makes the regenerate after it instant
+				ImGui::Separator();
+				ImGui::Checkbox("Erosion", &heightmapErosion.enabled);
+
+				if (heightmapErosion.enabled)
+				{
+					ImGui::SliderInt("Iterations", &heightmapErosion.iterations, 1, 2000);
+					ImGui::SliderFloat("Relief", &heightmapErosion.relief, .01f, 1);
+					ImGui::SliderFloat("Rain", &heightmapErosion.rain, 0, .1f);
+					ImGui::SliderFloat("Sediment Capacity", &heightmapErosion.sedimentCapacity, 0, 4);
+					ImGui::SliderFloat("Dissolving", &heightmapErosion.dissolving, 0, 1);
+					ImGui::SliderFloat("Deposition", &heightmapErosion.deposition, 0, 1);
+					ImGui::SliderFloat("Evaporation", &heightmapErosion.evaporation, 0, 1);
+					ImGui::SliderFloat("Talus Angle", &heightmapErosion.talusAngle, 0, 89);
+					ImGui::SliderFloat("Thermal Rate", &heightmapErosion.thermalRate, 0, .5f);
+
+					if (erosionPreviewTask.isRunning())
+					{
+						ImGui::ProgressBar(erosionPreviewTask.getProgress(), ImVec2(-1, 0), erosionPreviewTask.getStage());
+					}
+					else if (ImGui::Button("Preview Erosion"))
+					{
+						TerrainInfo terrainInfo = getTerrainInfo();
+						NoiseInfo noiseInfo = getNoiseInfo();
+
+						erosionPreviewTask.start([terrainInfo, noiseInfo](BackgroundTask& task)
+						{
+							task.setProgress(0, "Loading heightmap");
+
+							readHeightMap(terrainInfo, noiseInfo, [&task, &noiseInfo](const HeightMapErosion& erosion)
+							{
+								task.setProgress((float)erosion.getIteration() / noiseInfo.erosion.iterations, "Eroding");
+								updateErosionPreview(erosion);
+							});
+						},
+						[]() {});
+					}
+
+					if (erosionPreviewTexture != 0)
+					{
+						ImGui::Text("Iteration %d", erosionPreviewIteration);
+						ImGui::Image((ImTextureID)(intptr_t)erosionPreviewTexture, ImVec2((float)erosionPreviewWidth, (float)erosionPreviewHeight));
+					}
+				}
+
+				// Decoded and blurred heightmaps are kept around so regenerating doesn't reread or reblur them
+				if (ImGui::SliderInt("Cache Size (MB)", &heightmapCacheMegabytes, 0, 2048))
+				{
+					getHeightMapCache().setMaxBytes((size_t)heightmapCacheMegabytes * 1024 * 1024);
+				}
+
+				HeightMapCache& heightMapCache = getHeightMapCache();
+				ImGui::Text("Cached: %zu images, %.1f MB, %d hits, %d misses", heightMapCache.getNumEntries(), heightMapCache.getBytes() / (1024.0f * 1024.0f), heightMapCache.getHits(), heightMapCache.getMisses());
+
+				if (ImGui::Button("Benchmark Blur")) // Prints blurHeightMap vs CImg at 1K, 4K and 8K to the console
+				{
+					benchmarkHeightMapBlur(heightmapBlurAmount);
+				}
+
+				// Raw DEMs are converted a row of tiles at a time so they never have to fit in memory, images get blurred first
+				ImGui::Separator();
+				ImGui::InputText("Tiled Path", tiledHeightmapPath, sizeof(tiledHeightmapPath));
+				ImGui::InputInt("Tile Size", &tiledHeightmapTileSize);
+				ImGui::Checkbox("Delta Compression", &tiledHeightmapCompressed);
+
+				tiledHeightmapTileSize = glm::clamp(tiledHeightmapTileSize, 16, 1024);
+
+				if (tiledHeightmapConvertTask.isRunning())
+				{
+					ImGui::ProgressBar(tiledHeightmapConvertTask.getProgress(), ImVec2(-1, 0), tiledHeightmapConvertTask.getStage());
+				}
+				else if (ImGui::Button("Convert To Tiled"))
+				{
+					HeightMapSource source = getNoiseInfo().source;
+					float blur = heightmapBlurAmount;
+					std::string tiledPath = tiledHeightmapPath;
+					int tileSize = tiledHeightmapTileSize;
+					bool compress = tiledHeightmapCompressed;
+
+					std::shared_ptr<bool> converted = std::make_shared<bool>(false);
+
+					tiledHeightmapConvertTask.start([source, blur, tiledPath, tileSize, compress, converted](BackgroundTask& task)
+					{
+						task.setProgress(0, "Converting");
+						*converted = writeTiledHeightMap(source, blur, tiledPath, tileSize, compress, [&task](float progress) { task.setProgress(progress, "Converting"); });
+					},
+					[converted]()
+					{
+						// Streamed terrain picks the new file up straight away
+						if (*converted && terrainRenderMode == STREAMED)
+						{
+							generateTerrain();
+						}
+					});
+				}
+
 				if (ImGui::Button("Regenerate Terrain"))
 				{
 					generateTerrain();
@@ -601,13 +1607,14 @@ int main() {
 
 			if (ImGui::BeginTabItem("Color Info"))
 			{
-				ImGui::SliderFloat("Blend Threshold", &terrainBlendThreshold, 0, 1);
+				// Anything here that changes the bands rebakes the color texture before the next draw
+				terrainColorsChanged |= ImGui::SliderFloat("Blend Threshold", &terrainBlendThreshold, 0, 1);
 				ImGui::SliderFloat("Noise Influence", &terrainNoiseInfluence, 0, 1);
 
 				for (int i = 0; i < terrainColArray.size(); i++)
 				{
 					const std::string colorLabel = "Color " + std::to_string(i);
-					ImGui::ColorEdit3(colorLabel.c_str(), &terrainColArray[i].r);
+					terrainColorsChanged |= ImGui::ColorEdit3(colorLabel.c_str(), &terrainColArray[i].r);
 
 					const std::string thresholdLabel = "Theshold " + std::to_string(i);
 
@@ -633,7 +1640,7 @@ int main() {
 						max = terrainColThresholds[i + 1];
 					}
 
-					ImGui::SliderFloat(thresholdLabel.c_str(), &terrainColThresholds[i], min, max);
+					terrainColorsChanged |= ImGui::SliderFloat(thresholdLabel.c_str(), &terrainColThresholds[i], min, max);
 
 					ImGui::NewLine();
 				}
@@ -646,6 +1653,7 @@ int main() {
 						terrainColThresholds.pop_back();
 
 						terrainColThresholds[terrainColArray.size() - 1] = 1;
+						terrainColorsChanged = true;
 					}
 				}
 
@@ -668,6 +1676,7 @@ int main() {
 
 						terrainColThresholds[terrainColThresholds.size() - 1] = glm::mix(lower, 1.0f, .5);
 						terrainColThresholds.push_back(1);
+						terrainColorsChanged = true;
 					}
 				}
 
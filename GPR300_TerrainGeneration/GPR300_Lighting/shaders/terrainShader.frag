@@ -12,13 +12,8 @@ uniform vec3 _ModelWorldPos;
 uniform float _LocalMinHeight;
 uniform float _LocalMaxHeight;
 
-const int MAX_TERRAIN_COLORS = 32;
-
-uniform vec3[MAX_TERRAIN_COLORS] _TerrainColorArray; // Must have same number of elements as _TerrainColorThresholds
-uniform float[MAX_TERRAIN_COLORS] _TerrainColorThresholds; // Must be sorted and have same number of elements as _TerrainColorArray
-
-uniform int _NumLoadedTerrainColors;
-uniform float _TerrainColorBlendThreshold;
+// Color for each height portion with the bands and blending already worked out, texel i is portion i / (size - 1)
+uniform sampler1D _TerrainColorTexture;
 
 uniform float _TerrainNoiseInfluence;
 
@@ -253,32 +248,9 @@ void main()
     float terrainColorPortion = (localPos.y - _LocalMinHeight) / (_LocalMaxHeight - _LocalMinHeight);
     terrainColorPortion = clamp(terrainColorPortion + noiseInfluence, 0.0, 1.0);
 
-    vec3 terrainHeightColor = vec3(terrainColorPortion, terrainColorPortion, terrainColorPortion);
-
-    int i;
-    for(i = 0; i < _NumLoadedTerrainColors; i++)
-    {
-        if(terrainColorPortion <= _TerrainColorThresholds[i])
-        {
-            terrainHeightColor = _TerrainColorArray[i];
-            break;
-        }
-    }
-
-    // If portion is close to being a different color, blend between the colors
-    if(i < _NumLoadedTerrainColors - 1 && _TerrainColorThresholds[i] - terrainColorPortion <= _TerrainColorBlendThreshold)
-    {
-        vec3 prevColor = _TerrainColorArray[i];
-        vec3 thisColor = _TerrainColorArray[i + 1];
-
-        float minThreshold = _TerrainColorThresholds[i] - _TerrainColorBlendThreshold;
-        float maxThreshold = _TerrainColorThresholds[i];
-
-        float portion = (terrainColorPortion - minThreshold) / (maxThreshold - minThreshold);
-        portion = clamp(portion, 0, 1);
-
-        terrainHeightColor = mix(prevColor, thisColor, portion);
-    }
+    // Texel centers, so portion 0 and 1 land exactly on the first and last color
+    float colorTextureSize = float(textureSize(_TerrainColorTexture, 0));
+    vec3 terrainHeightColor = texture(_TerrainColorTexture, (terrainColorPortion * (colorTextureSize - 1) + 0.5) / colorTextureSize).rgb;
 
     //vec4 color = texture(_Texture, uv) * (vec4(ambient, 1.0f) + (vec4(diffuseAndSpecularTotal, 1.0f)));
     vec4 color = texture(_Texture, uv) * vec4(terrainHeightColor, 1);
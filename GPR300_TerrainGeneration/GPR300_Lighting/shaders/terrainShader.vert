@@ -7,6 +7,46 @@ uniform mat4 _Model;
 uniform mat4 _View;
 uniform mat4 _Projection;
 
+// Where vertices come from
+const int VERTEX_MODE_MESH = 0; // Vertex attributes are the final positions
+const int VERTEX_MODE_LOD_PATCH = 1; // vPos.xz is a coordinate on a LOD patch and heights come from _HeightTexture
+const int VERTEX_MODE_HEIGHTMAP = 2; // Flat grid, vUV is the grid coordinate and heights come from _HeightmapTexture
+const int VERTEX_MODE_COMPACT = 3; // No attributes, gl_VertexID and _ChunkOrigin give the grid coordinate and heights come from _CompactVertices
+const int VERTEX_MODE_TILE = 4; // Flat grid of one streamed tile, vUV is the grid coordinate in the tile and heights come from _TileHeights
+
+uniform int _TerrainVertexMode = VERTEX_MODE_MESH;
+
+uniform vec2 _TerrainDimensions;
+
+uniform sampler2D _HeightTexture; // Final terrain heights, one texel per grid vertex
+uniform vec2 _NodeOrigin; // Grid coordinate of the LOD node's corner
+uniform float _NodeScale; // Grid cells per patch quad
+uniform vec2 _MorphRange; // Distances where the node starts and finishes morphing into the next level
+uniform vec3 _LODViewerPosition; // Camera in the terrain's local space
+
+uniform sampler2D _HeightmapTexture; // Blurred heightmap, red channel
+uniform int _TerrainResolution;
+uniform float _Redistribution;
+uniform float _LocalMinHeight;
+uniform float _LocalMaxHeight;
+
+// Compact terrain, 16-bit values packed two to a uint. Each vertex is a height, or a height then an octahedral normal
+layout(std430, binding = 0) readonly buffer CompactTerrainVertices
+{
+    uint _CompactVertices[];
+};
+
+uniform int _CompactShortsPerVertex; // 2 when normals are packed in, 1 when they're worked out here
+uniform float _CompactMinHeight;
+uniform float _CompactHeightScale;
+uniform vec2 _ChunkOrigin; // Grid coordinate of the chunk's first vertex
+uniform int _ChunkRowVertices;
+
+// Streamed tiles of a tiled heightmap
+uniform sampler2D _TileHeights; // One tile's heights, with a sample of apron on every side
+uniform vec2 _TileOrigin; // Sample of the whole map under the tile's first vertex
+uniform vec2 _HeightMapSize; // Samples across the whole map
+
 out struct Vertex{
     vec3 WorldNormal;
     vec3 WorldPosition;
@@ -15,11 +55,168 @@ out struct Vertex{
 
 out vec4 lightSpacePos; // This is the fragment's homogenous clip coordinates from the POV of the light.
 
+
+float sampleHeight(vec2 gridPos)
+{
+    vec2 texSize = vec2(textureSize(_HeightTexture, 0));
+    return textureLod(_HeightTexture, (gridPos + 0.5) / texSize, 0).r;
+}
+
+
+vec3 gridToLocal(vec2 gridPos, vec2 resolution)
+{
+    vec2 xz = gridPos / resolution * _TerrainDimensions - _TerrainDimensions * 0.5;
+    return vec3(xz.x, sampleHeight(gridPos), xz.y);
+}
+
+
+// Same as getHeight in TerrainGeneration.hpp
+float heightmapHeight(vec2 gridPos)
+{
+    ivec2 size = textureSize(_HeightmapTexture, 0);
+    vec2 uv = clamp(gridPos, 0.0, float(_TerrainResolution)) / float(_TerrainResolution);
+
+    float portion = texelFetch(_HeightmapTexture, min(ivec2(uv * vec2(size)), size - 1), 0).r;
+    portion = pow(max(portion, 1e-7), _Redistribution);
+
+    return (portion * (_LocalMaxHeight - _LocalMinHeight)) + _LocalMinHeight;
+}
+
+
+uint readCompactShort(int index)
+{
+    uint word = _CompactVertices[index >> 1];
+    return (index & 1) == 0 ? word & 0xFFFFu : word >> 16;
+}
+
+
+int compactVertexIndex(ivec2 gridPos)
+{
+    gridPos = clamp(gridPos, ivec2(0), ivec2(_TerrainResolution));
+    return (gridPos.y * (_TerrainResolution + 1) + gridPos.x) * _CompactShortsPerVertex;
+}
+
+
+float compactHeight(ivec2 gridPos)
+{
+    return _CompactMinHeight + float(readCompactShort(compactVertexIndex(gridPos))) * _CompactHeightScale;
+}
+
+
+// Undoes packTerrainNormal in TerrainCompact.hpp
+vec3 unpackCompactNormal(uint packed)
+{
+    vec2 p = vec2(packed & 0xFFu, packed >> 8) / 255.0 * 2.0 - 1.0;
+    vec3 normal = vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y);
+
+    if (normal.y < 0.0)
+    {
+        normal.xz = (1.0 - abs(normal.zx)) * vec2(normal.x >= 0.0 ? 1.0 : -1.0, normal.z >= 0.0 ? 1.0 : -1.0);
+    }
+
+    return normalize(normal);
+}
+
+
+// Same as heightmapHeight, tilePos is in the tile's own grid so -1 and tile size + 1 are the apron
+float tileHeight(ivec2 tilePos)
+{
+    float portion = texelFetch(_TileHeights, tilePos + 1, 0).r;
+    portion = pow(max(portion, 1e-7), _Redistribution);
+
+    return (portion * (_LocalMaxHeight - _LocalMinHeight)) + _LocalMinHeight;
+}
+
+
 void main()
 {    
-    v_out.WorldPosition = vec3(_Model * vec4(vPos,1));
-    v_out.WorldNormal = transpose(inverse(mat3(_Model))) * vNormal;
-    v_out.UV = vUV;
+    vec3 localPos = vPos;
+    vec3 localNormal = vNormal;
+    vec2 uv = vUV;
+
+    if (_TerrainVertexMode == VERTEX_MODE_LOD_PATCH)
+    {
+        vec2 resolution = vec2(textureSize(_HeightTexture, 0)) - 1.0;
+
+        vec2 gridPos = min(_NodeOrigin + vPos.xz * _NodeScale, resolution);
+        float dist = distance(gridToLocal(gridPos, resolution), _LODViewerPosition);
+
+        // Odd patch vertices slide onto their even neighbor, so at 1 the patch matches the next level's grid
+        float morph = clamp((dist - _MorphRange.x) / (_MorphRange.y - _MorphRange.x), 0.0, 1.0);
+        vec2 morphedPatchPos = vPos.xz - fract(vPos.xz * 0.5) * 2.0 * morph;
+
+        gridPos = min(_NodeOrigin + morphedPatchPos * _NodeScale, resolution);
+        localPos = gridToLocal(gridPos, resolution);
+
+        // Central differences of the height field
+        vec2 cellSize = _TerrainDimensions / resolution;
+        float left = sampleHeight(gridPos - vec2(1, 0));
+        float right = sampleHeight(gridPos + vec2(1, 0));
+        float down = sampleHeight(gridPos - vec2(0, 1));
+        float up = sampleHeight(gridPos + vec2(0, 1));
+        localNormal = normalize(vec3((left - right) / (2.0 * cellSize.x), 1.0, (down - up) / (2.0 * cellSize.y)));
+
+        uv = gridPos;
+    }
+    else if (_TerrainVertexMode == VERTEX_MODE_HEIGHTMAP)
+    {
+        vec2 gridPos = vUV;
+        localPos.y = heightmapHeight(gridPos);
+
+        vec2 cellSize = _TerrainDimensions / float(_TerrainResolution);
+        float left = heightmapHeight(gridPos - vec2(1, 0));
+        float right = heightmapHeight(gridPos + vec2(1, 0));
+        float down = heightmapHeight(gridPos - vec2(0, 1));
+        float up = heightmapHeight(gridPos + vec2(0, 1));
+        localNormal = normalize(vec3((left - right) / (2.0 * cellSize.x), 1.0, (down - up) / (2.0 * cellSize.y)));
+    }
+    else if (_TerrainVertexMode == VERTEX_MODE_COMPACT)
+    {
+        // Chunks hanging off the far edge clamp onto it, same as the chunked mesh
+        ivec2 localPos2D = ivec2(gl_VertexID % _ChunkRowVertices, gl_VertexID / _ChunkRowVertices);
+        ivec2 gridPos = min(ivec2(_ChunkOrigin) + localPos2D, ivec2(_TerrainResolution));
+
+        vec2 xz = vec2(gridPos) / float(_TerrainResolution) * _TerrainDimensions - _TerrainDimensions * 0.5;
+        localPos = vec3(xz.x, compactHeight(gridPos), xz.y);
+
+        if (_CompactShortsPerVertex == 2)
+        {
+            localNormal = unpackCompactNormal(readCompactShort(compactVertexIndex(gridPos) + 1));
+        }
+        else
+        {
+            vec2 cellSize = _TerrainDimensions / float(_TerrainResolution);
+            float left = compactHeight(gridPos - ivec2(1, 0));
+            float right = compactHeight(gridPos + ivec2(1, 0));
+            float down = compactHeight(gridPos - ivec2(0, 1));
+            float up = compactHeight(gridPos + ivec2(0, 1));
+            localNormal = normalize(vec3((left - right) / (2.0 * cellSize.x), 1.0, (down - up) / (2.0 * cellSize.y)));
+        }
+
+        uv = vec2(gridPos);
+    }
+    else if (_TerrainVertexMode == VERTEX_MODE_TILE)
+    {
+        // Tiles hanging off the far edge of the map clamp onto it
+        vec2 gridPos = min(_TileOrigin + vUV, _HeightMapSize - 1.0);
+        ivec2 tilePos = ivec2(gridPos - _TileOrigin);
+
+        vec2 cellSize = _TerrainDimensions / (_HeightMapSize - 1.0);
+        vec2 xz = gridPos * cellSize - _TerrainDimensions * 0.5;
+        localPos = vec3(xz.x, tileHeight(tilePos), xz.y);
+
+        float left = tileHeight(tilePos - ivec2(1, 0));
+        float right = tileHeight(tilePos + ivec2(1, 0));
+        float down = tileHeight(tilePos - ivec2(0, 1));
+        float up = tileHeight(tilePos + ivec2(0, 1));
+        localNormal = normalize(vec3((left - right) / (2.0 * cellSize.x), 1.0, (down - up) / (2.0 * cellSize.y)));
+
+        uv = gridPos;
+    }
+
+    v_out.WorldPosition = vec3(_Model * vec4(localPos,1));
+    v_out.WorldNormal = transpose(inverse(mat3(_Model))) * localNormal;
+    v_out.UV = uv;
 
-    gl_Position = _Projection * _View * _Model * vec4(vPos,1);
+    gl_Position = _Projection * _View * _Model * vec4(localPos,1);
 }